@@ -0,0 +1,306 @@
+#include "common/BufferPool.h"
+
+#include <common/Logger.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+
+namespace common {
+
+static const size_t kBufferPoolClassCount = kBufferPoolClassSizes.size();
+
+// Blocks moved between a thread cache and the depot at a time
+static const size_t kBufferPoolMagazineSize = 32;
+
+// Free bytes the depot holds on to per class, beyond which blocks are given
+// back to the system
+static const size_t kBufferPoolDepotMaxBytes = 4 << 20;
+
+static const size_t kBufferPoolArenaAlignment = 64;
+static const size_t kBufferPoolHugePageSize = 2 << 20;
+
+static size_t roundUp(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+class BufferPool::ThreadCache {
+public:
+  ThreadCache(BufferPool& pool) : pool_(pool) {
+    for (auto& blocks : this->blocks) {
+      blocks.reserve(2 * kBufferPoolMagazineSize);
+    }
+
+    std::lock_guard<std::mutex> lock(pool_.cachesMutex_);
+    pool_.caches_.push_back(this);
+  }
+
+  ~ThreadCache();
+
+  std::array<std::vector<void*>, kBufferPoolClassCount> blocks;
+
+  // Both only ever written by the owning thread, but read by getUsage().
+  // Frees from other threads can take inUseBytes below zero.
+  std::atomic<ptrdiff_t> inUseBytes{0};
+  std::atomic<ptrdiff_t> cachedBytes{0};
+
+  static void add(std::atomic<ptrdiff_t>& counter, ptrdiff_t delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta,
+                  std::memory_order_relaxed);
+  }
+
+private:
+  BufferPool& pool_;
+};
+
+// Set once the calling thread's cache is gone, which can happen before the
+// last buffers are freed (e.g. by static destructors).
+static thread_local bool tBufferPoolCacheDestroyed = false;
+
+BufferPool::ThreadCache::~ThreadCache() {
+  for (size_t cls = 0; cls < kBufferPoolClassCount; cls++) {
+    pool_.drain(cls, blocks[cls], blocks[cls].size());
+  }
+
+  std::lock_guard<std::mutex> lock(pool_.cachesMutex_);
+  auto& caches = pool_.caches_;
+  caches.erase(std::find(caches.begin(), caches.end(), this));
+  pool_.retiredInUseBytes_ += inUseBytes.load(std::memory_order_relaxed);
+  tBufferPoolCacheDestroyed = true;
+}
+
+/* static */ BufferPool& BufferPool::getInstance() {
+  // Never destroyed, as buffers may still be freed during static destruction
+  static BufferPool* instance = new BufferPool();
+  return *instance;
+}
+
+/* static */ size_t BufferPool::getClass(size_t size) {
+  for (size_t cls = 0; cls < kBufferPoolClassCount; cls++) {
+    if (size <= kBufferPoolClassSizes[cls]) {
+      return cls;
+    }
+  }
+  return kBufferPoolClassCount;
+}
+
+BufferPool::ThreadCache* BufferPool::getCache() {
+  if (tBufferPoolCacheDestroyed) {
+    return nullptr;
+  }
+
+  static thread_local ThreadCache cache(*this);
+  return &cache;
+}
+
+void* BufferPool::allocate(size_t size) {
+  size_t cls = getClass(size);
+  ThreadCache* cache = getCache();
+
+  if (cls == kBufferPoolClassCount) {
+    void* buffer = malloc(size);
+    assertTrue(buffer != nullptr, "Out of memory in BufferPool.");
+    if (cache != nullptr) {
+      ThreadCache::add(cache->inUseBytes, size);
+    } else {
+      retiredInUseBytes_ += size;
+    }
+    return buffer;
+  }
+
+  ptrdiff_t blockSize = kBufferPoolClassSizes[cls];
+
+  if (cache == nullptr) {
+    std::vector<void*> blocks;
+    refill(cls, blocks);
+    void* block = blocks.back();
+    blocks.pop_back();
+    drain(cls, blocks, blocks.size());
+    retiredInUseBytes_ += blockSize;
+    return block;
+  }
+
+  auto& blocks = cache->blocks[cls];
+  if (blocks.empty()) {
+    refill(cls, blocks);
+    ThreadCache::add(cache->cachedBytes, ptrdiff_t(blocks.size()) * blockSize);
+  }
+
+  void* block = blocks.back();
+  blocks.pop_back();
+  ThreadCache::add(cache->cachedBytes, -blockSize);
+  ThreadCache::add(cache->inUseBytes, blockSize);
+  return block;
+}
+
+void BufferPool::free(void* buffer, size_t size) {
+  size_t cls = getClass(size);
+  ThreadCache* cache = getCache();
+
+  if (cls == kBufferPoolClassCount) {
+    ::free(buffer);
+    if (cache != nullptr) {
+      ThreadCache::add(cache->inUseBytes, -ptrdiff_t(size));
+    } else {
+      retiredInUseBytes_ -= size;
+    }
+    return;
+  }
+
+  ptrdiff_t blockSize = kBufferPoolClassSizes[cls];
+
+  if (cache == nullptr) {
+    std::vector<void*> blocks{buffer};
+    drain(cls, blocks, 1);
+    retiredInUseBytes_ -= blockSize;
+    return;
+  }
+
+  auto& blocks = cache->blocks[cls];
+  blocks.push_back(buffer);
+  ThreadCache::add(cache->cachedBytes, blockSize);
+  ThreadCache::add(cache->inUseBytes, -blockSize);
+
+  if (blocks.size() >= 2 * kBufferPoolMagazineSize) {
+    drain(cls, blocks, kBufferPoolMagazineSize);
+    ThreadCache::add(cache->cachedBytes,
+                     -ptrdiff_t(kBufferPoolMagazineSize) * blockSize);
+  }
+}
+
+// Moves a magazine's worth of blocks from the depot into `blocks`, making new
+// ones if the depot runs dry.
+void BufferPool::refill(size_t cls, std::vector<void*>& blocks) {
+  {
+    auto& depot = depots_[cls];
+    std::lock_guard<std::mutex> lock(depot.mutex);
+
+    size_t count = std::min(kBufferPoolMagazineSize, depot.blocks.size());
+    blocks.insert(blocks.end(), depot.blocks.end() - count, depot.blocks.end());
+    depot.blocks.resize(depot.blocks.size() - count);
+  }
+
+  while (blocks.size() < kBufferPoolMagazineSize) {
+    blocks.push_back(allocateBlock(cls));
+  }
+}
+
+// Moves the last `count` of `blocks` into the depot.
+void BufferPool::drain(size_t cls, std::vector<void*>& blocks, size_t count) {
+  size_t maxCount = kBufferPoolDepotMaxBytes / kBufferPoolClassSizes[cls];
+  std::vector<void*> surplus;
+
+  {
+    auto& depot = depots_[cls];
+    std::lock_guard<std::mutex> lock(depot.mutex);
+
+    for (size_t i = 0; i < count; i++) {
+      void* block = blocks.back();
+      blocks.pop_back();
+
+      if (depot.blocks.size() < maxCount || isInArena(block)) {
+        depot.blocks.push_back(block);
+      } else {
+        surplus.push_back(block);
+      }
+    }
+  }
+
+  for (auto block : surplus) {
+    ::free(block);
+  }
+}
+
+void* BufferPool::allocateBlock(size_t cls) {
+  size_t blockSize = kBufferPoolClassSizes[cls];
+
+  {
+    std::lock_guard<std::mutex> lock(arenaMutex_);
+    size_t size = roundUp(blockSize, kBufferPoolArenaAlignment);
+    if (arena_ != nullptr && arenaUsed_ + size <= arenaSize_) {
+      void* block = arena_ + arenaUsed_;
+      arenaUsed_ += size;
+      return block;
+    }
+  }
+
+  void* block = malloc(blockSize);
+  assertTrue(block != nullptr, "Out of memory in BufferPool.");
+  return block;
+}
+
+bool BufferPool::isInArena(void* block) const {
+  auto address = static_cast<Byte*>(block);
+  return arena_ != nullptr && address >= arena_ &&
+         address < arena_ + arenaSize_;
+}
+
+bool BufferPool::reserveArena(size_t size) {
+  std::lock_guard<std::mutex> lock(arenaMutex_);
+
+  if (arena_ != nullptr) {
+    LOG_E("BufferPool") << "Arena already reserved." << std::endl;
+    return true;
+  }
+
+  size = roundUp(size, kBufferPoolHugePageSize);
+  void* arena = MAP_FAILED;
+  bool hugePages = false;
+
+#if TARGET_LINUX
+  arena = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  hugePages = (arena != MAP_FAILED);
+#endif
+
+  if (arena == MAP_FAILED) {
+    arena = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED) {
+      LOG_E("BufferPool") << "Cannot reserve an arena of " << size
+                          << " bytes: " << strerror(errno) << std::endl;
+      return false;
+    }
+
+#if TARGET_LINUX
+    // Transparent huge pages, which is the next best thing
+    madvise(arena, size, MADV_HUGEPAGE);
+#endif
+  }
+
+  LOG_I("BufferPool") << "Reserved an arena of " << (size >> 20) << " MB"
+                      << (hugePages ? " on huge pages." : ".") << std::endl;
+
+  arena_ = static_cast<Byte*>(arena);
+  arenaSize_ = size;
+  return true;
+}
+
+BufferPool::Usage BufferPool::getUsage() {
+  ptrdiff_t inUseBytes = retiredInUseBytes_;
+  ptrdiff_t cachedBytes = 0;
+
+  {
+    std::lock_guard<std::mutex> lock(cachesMutex_);
+    for (auto cache : caches_) {
+      inUseBytes += cache->inUseBytes.load(std::memory_order_relaxed);
+      cachedBytes += cache->cachedBytes.load(std::memory_order_relaxed);
+    }
+  }
+
+  for (size_t cls = 0; cls < kBufferPoolClassCount; cls++) {
+    std::lock_guard<std::mutex> lock(depots_[cls].mutex);
+    cachedBytes += depots_[cls].blocks.size() * kBufferPoolClassSizes[cls];
+  }
+
+  // Racing threads may leave the sum off for a moment
+  size_t clamped = static_cast<size_t>(std::max(inUseBytes, ptrdiff_t{0}));
+  size_t highWater = std::max(highWaterBytes_.load(), clamped);
+  highWaterBytes_ = highWater;
+
+  return Usage{clamped, highWater, static_cast<size_t>(cachedBytes)};
+}
+} // namespace common
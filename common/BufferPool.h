@@ -0,0 +1,89 @@
+#pragma once
+
+#include <common/Util.h>
+
+#include <stddef.h>
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace common {
+
+// Block sizes the pool hands out. Anything bigger goes straight to malloc().
+static const std::array<size_t, 6> kBufferPoolClassSizes = {
+    128, 512, 2048, 4096 + 32, 16384, 65536};
+
+// Allocates packet buffers from a few size classes.
+//
+// Each thread keeps a cache (a magazine of up to 2 * kBufferPoolMagazineSize
+// blocks) per class, which serves most allocations without any locking. Whole
+// magazines go back and forth between the thread caches and a global depot, so
+// a buffer may be freed by a different thread than the one that allocated it.
+//
+// The depot keeps only so many free blocks per class and gives the rest back
+// to the system. Blocks carved out of the (optional) arena are kept for good.
+class BufferPool {
+public:
+  struct Usage {
+    // Handed out and not yet freed
+    size_t inUseBytes;
+    // The most inUseBytes seen by getUsage() so far
+    size_t highWaterBytes;
+    // Free, but held on to by the thread caches and the depot
+    size_t cachedBytes;
+  };
+
+  static BufferPool& getInstance();
+
+  void* allocate(size_t size);
+  // `size` must be the same as was asked of allocate().
+  void free(void* buffer, size_t size);
+
+  // Backs future allocations with an arena of `size` bytes, on huge pages
+  // if the system lets us. Returns whether there now is an arena.
+  bool reserveArena(size_t size);
+
+  Usage getUsage();
+
+private:
+  BufferPool() = default;
+
+  BufferPool(BufferPool const& copy) = delete;
+  BufferPool& operator=(BufferPool const& copy) = delete;
+
+  BufferPool(BufferPool&& move) = delete;
+  BufferPool& operator=(BufferPool&& move) = delete;
+
+  class ThreadCache;
+
+  struct Depot {
+    std::mutex mutex;
+    std::vector<void*> blocks;
+  };
+
+  std::array<Depot, kBufferPoolClassSizes.size()> depots_;
+
+  std::mutex arenaMutex_;
+  Byte* arena_ = nullptr;
+  size_t arenaSize_ = 0;
+  size_t arenaUsed_ = 0;
+
+  std::mutex cachesMutex_;
+  std::vector<ThreadCache*> caches_;
+  // In use by threads that have exited since
+  std::atomic<ptrdiff_t> retiredInUseBytes_{0};
+  std::atomic<size_t> highWaterBytes_{0};
+
+  static size_t getClass(size_t size);
+
+  ThreadCache* getCache();
+  void refill(size_t cls, std::vector<void*>& blocks);
+  void drain(size_t cls, std::vector<void*>& blocks, size_t count);
+  void* allocateBlock(size_t cls);
+  bool isInArena(void* block) const;
+
+  friend class ThreadCache;
+};
+} // namespace common
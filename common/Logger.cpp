@@ -0,0 +1,318 @@
+#include "common/Logger.h"
+
+#if TARGET_IOS
+#include <os/log.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+namespace common {
+
+// How long the writer may sit on lines before writing them out
+static const auto kLoggerWriterInterval = std::chrono::milliseconds(20);
+
+// A single-producer single-consumer queue of lines: the owning thread pushes,
+// and the writer pops. Positions are running totals of bytes.
+class LogLine::Ring {
+public:
+  struct Header {
+    LogTag tag;
+    LogLevel level;
+    struct timespec time;
+    size_t length;
+  };
+
+  // Set by the owning thread as it exits, after which the writer gets rid of
+  // the line once the ring is drained.
+  std::atomic<bool> isRetired{false};
+  // Lines that didn't fit
+  std::atomic<size_t> dropped{0};
+
+  // Returns whether the ring is now more than half full, or false if the line
+  // is dropped.
+  bool push(Header const& header, char const* text) {
+    size_t size = sizeof(Header) + header.length;
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    uint64_t head = head_.load(std::memory_order_acquire);
+
+    if (kLoggerRingCapacity - (tail - head) < size) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    copyIn(tail, &header, sizeof(Header));
+    copyIn(tail + sizeof(Header), text, header.length);
+    tail_.store(tail + size, std::memory_order_release);
+
+    return (tail + size - head) > kLoggerRingCapacity / 2;
+  }
+
+  // Appends the text of the oldest line to `text`, or returns false if there
+  // isn't any.
+  bool pop(Header& header, std::string& text) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+
+    if (head == tail) {
+      return false;
+    }
+
+    copyOut(head, &header, sizeof(Header));
+    size_t offset = text.length();
+    text.resize(offset + header.length);
+    copyOut(head + sizeof(Header), &text[offset], header.length);
+    head_.store(head + sizeof(Header) + header.length,
+                std::memory_order_release);
+
+    return true;
+  }
+
+private:
+  static_assert((kLoggerRingCapacity & (kLoggerRingCapacity - 1)) == 0,
+                "kLoggerRingCapacity must be a power of 2.");
+
+  char buffer_[kLoggerRingCapacity];
+  alignas(64) std::atomic<uint64_t> head_{0};
+  alignas(64) std::atomic<uint64_t> tail_{0};
+
+  void copyIn(uint64_t position, void const* data, size_t size) {
+    size_t offset = position & (kLoggerRingCapacity - 1);
+    size_t first = std::min(size, kLoggerRingCapacity - offset);
+    memcpy(buffer_ + offset, data, first);
+    memcpy(buffer_, static_cast<char const*>(data) + first, size - first);
+  }
+
+  void copyOut(uint64_t position, void* data, size_t size) const {
+    size_t offset = position & (kLoggerRingCapacity - 1);
+    size_t first = std::min(size, kLoggerRingCapacity - offset);
+    memcpy(data, buffer_ + offset, first);
+    memcpy(static_cast<char*>(data) + first, buffer_, size - first);
+  }
+};
+
+LogLine::LogLine() : stream_(&buffer_), ring_(new Ring()) {}
+
+LogLine::~LogLine() = default;
+
+void LogLine::begin(LogTag tag, LogLevel level) {
+  // Otherwise, the previous line isn't over yet.
+  if (buffer_.size() == 0) {
+    tag_ = tag;
+    level_ = level;
+    isEnabled_ = Logger::isEnabled(level);
+  }
+}
+
+LogLine& LogLine::operator<<(std::ostream& (*os)(std::ostream&)) {
+  if (!isEnabled_) {
+    return *this;
+  }
+
+  if (os == static_cast<std::ostream& (*)(std::ostream&)>(std::endl)) {
+    submit();
+  } else {
+    stream_ << os;
+  }
+  return *this;
+}
+
+void LogLine::submit() {
+  auto header = Ring::Header{tag_, level_, {}, buffer_.size()};
+  clock_gettime(CLOCK_REALTIME, &header.time);
+
+  bool isFilling = ring_->push(header, buffer_.data());
+  buffer_.clear();
+
+  auto& logger = Logger::getDefault();
+  if (level_ == ERROR) {
+    logger.flush();
+  } else if (isFilling) {
+    logger.wakeUp();
+  }
+}
+
+Logger::Logger() {
+  writer_ = std::thread([this]() { run(); });
+
+  // Lines still in the rings would be lost otherwise.
+  std::atexit([]() { Logger::getDefault().flush(); });
+}
+
+/* static */ Logger& Logger::getDefault() {
+  // Never destroyed, as lines may still be logged during static destruction
+  static Logger* instance = new Logger();
+  return *instance;
+}
+
+// Hands the calling thread's line over to the writer as the thread exits.
+class Logger::LineOwner {
+public:
+  ~LineOwner() {
+    auto line = tLine_;
+    tLine_ = nullptr;
+    line->ring_->isRetired.store(true, std::memory_order_release);
+  }
+};
+
+/* static */ void Logger::createLine() {
+  tLine_ = new LogLine();
+
+  auto& logger = getDefault();
+  {
+    std::lock_guard<std::mutex> lock(logger.mutex_);
+    logger.lines_.push_back(tLine_);
+  }
+
+  // Lines created after this is gone (e.g. logging from other thread-local
+  // destructors) are never retired, and stay around.
+  static thread_local LineOwner owner;
+}
+
+void Logger::flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t request = ++flushesRequested_;
+  wakeUp_.notify_one();
+  didFlush_.wait(lock, [this, request]() { return flushesDone_ >= request; });
+}
+
+void Logger::run() {
+  struct Entry {
+    LogLine::Ring::Header header;
+    size_t offset;
+  };
+
+  std::vector<LogLine*> lines;
+  std::vector<Entry> entries;
+  std::string texts;
+  std::string output;
+
+  while (true) {
+    uint64_t request;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wakeUp_.wait_for(lock, kLoggerWriterInterval, [this]() {
+        return flushesRequested_ > flushesDone_ ||
+               isBacklogged_.load(std::memory_order_relaxed);
+      });
+      isBacklogged_.store(false, std::memory_order_relaxed);
+      request = flushesRequested_;
+      lines = lines_;
+    }
+
+    entries.clear();
+    texts.clear();
+    output.clear();
+
+    std::vector<LogLine*> retired;
+    for (auto line : lines) {
+      auto& ring = *line->ring_;
+      // Checked first, as lines may still come in until the flag is set.
+      bool isRetired = ring.isRetired.load(std::memory_order_acquire);
+
+      Entry entry;
+      entry.offset = texts.length();
+      while (ring.pop(entry.header, texts)) {
+        entries.push_back(entry);
+        entry.offset = texts.length();
+      }
+
+      size_t dropped = ring.dropped.exchange(0, std::memory_order_relaxed);
+      if (dropped > 0) {
+        auto notice = "Dropped " + std::to_string(dropped) +
+                      " lines as the logging thread got ahead.";
+        auto header =
+            LogLine::Ring::Header{"Logger", ERROR, {}, notice.length()};
+        clock_gettime(CLOCK_REALTIME, &header.time);
+        entries.push_back(Entry{header, texts.length()});
+        texts += notice;
+      }
+
+      if (isRetired) {
+        retired.push_back(line);
+      }
+    }
+
+    // Lines of different threads are interleaved by when they were logged.
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](Entry const& a, Entry const& b) {
+                       return std::tie(a.header.time.tv_sec,
+                                       a.header.time.tv_nsec) <
+                              std::tie(b.header.time.tv_sec,
+                                       b.header.time.tv_nsec);
+                     });
+
+    for (auto const& entry : entries) {
+      auto const& header = entry.header;
+
+      if (header.time.tv_sec != headerSecond_) {
+        char buffer[64];
+        struct tm timeInfo;
+        localtime_r(&header.time.tv_sec, &timeInfo);
+        strftime(buffer, sizeof(buffer), "[%F %H:%M:%S", &timeInfo);
+
+        headerSecond_ = header.time.tv_sec;
+        headerPrefix_ = buffer;
+      }
+
+      char subsecond[16];
+      snprintf(subsecond, sizeof(subsecond), ".%06d] [",
+               static_cast<int>(header.time.tv_nsec / 1000 % 1000000));
+
+      size_t lineStart = output.length();
+      output += headerPrefix_;
+      output += subsecond;
+      output.append(header.tag.name, header.tag.length);
+      output += "] ";
+      for (size_t i = header.tag.length; i < kLoggerTagPaddingTo; i++) {
+        output += " ";
+      }
+      output.append(texts, entry.offset, header.length);
+      output += "\n";
+
+      if (!!tee) {
+        tee(output.substr(lineStart));
+      }
+    }
+
+    write(output);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto line : retired) {
+        lines_.erase(std::find(lines_.begin(), lines_.end(), line));
+        delete line;
+      }
+      flushesDone_ = request;
+    }
+    didFlush_.notify_all();
+  }
+}
+
+#if TARGET_IOS
+void Logger::write(std::string const& lines) {
+  static os_log_t logObject = os_log_create("me.ljh.stun", "");
+
+  size_t start = 0;
+  while (start < lines.length()) {
+    size_t end = lines.find('\n', start);
+    os_log_error(logObject, "%s",
+                 lines.substr(start, end - start + 1).c_str());
+    start = end + 1;
+  }
+}
+#else
+void Logger::write(std::string const& lines) {
+  if (lines.empty()) {
+    return;
+  }
+
+  out_ << lines;
+  out_.flush();
+}
+#endif
+} // namespace common
@@ -2,132 +2,243 @@
 
 #include <common/Util.h>
 
-#if TARGET_IOS
-#include <os/log.h>
-#endif
+#include <time.h>
 
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
 #include <functional>
 #include <iostream>
-#include <sstream>
-#include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Log statements below this level compile to nothing, e.g. 1 to leave out
+// LOG_VV-s. Either way, the arguments of a statement are only evaluated if it
+// is going to be logged.
+#ifndef STUN_MIN_LOG_LEVEL
+#define STUN_MIN_LOG_LEVEL 0
+#endif
 
-// TODO: Switch to <ctime> and std:: things once we can.
-#include <time.h>
+#define LOG_AT(tag, level)                                                     \
+  !::common::Logger::isEnabled(level)                                          \
+      ? (void)0                                                                \
+      : ::common::LogLine::Voidify() & ::common::Logger::getLine(tag, level)
 
-#define L()                                                                    \
-  ::common::Logger::getDefault("=======").withLogLevel(common::LogLevel::INFO)
-#define LOG_E(tag)                                                             \
-  ::common::Logger::getDefault(tag).withLogLevel(common::LogLevel::ERROR)
-#define LOG_I(tag)                                                             \
-  ::common::Logger::getDefault(tag).withLogLevel(common::LogLevel::INFO)
-#define LOG_V(tag)                                                             \
-  ::common::Logger::getDefault(tag).withLogLevel(common::LogLevel::VERBOSE)
-#define LOG_VV(tag)                                                            \
-  ::common::Logger::getDefault(tag).withLogLevel(common::LogLevel::VERY_VERBOSE)
+#define L() LOG_AT("=======", common::LogLevel::INFO)
+#define LOG_E(tag) LOG_AT(tag, common::LogLevel::ERROR)
+#define LOG_I(tag) LOG_AT(tag, common::LogLevel::INFO)
+#define LOG_V(tag) LOG_AT(tag, common::LogLevel::VERBOSE)
+#define LOG_VV(tag) LOG_AT(tag, common::LogLevel::VERY_VERBOSE)
 
 namespace common {
 
 static const size_t kLoggerTagPaddingTo = 9;
+// Longer lines are cut short
+static const size_t kLoggerMaxLineLength = 4096;
+// Each logging thread gets this much room for lines that are yet to be
+// written. Lines that don't fit are dropped, and counted.
+static const size_t kLoggerRingCapacity = 256 * 1024;
 
 enum LogLevel { VERY_VERBOSE, VERBOSE, INFO, ERROR };
 
-class Logger {
-public:
-  Logger(std::ostream& out = std::cout) : out_(out) {}
+// Tags are always string literals, so lines only need to point to them.
+struct LogTag {
+  constexpr LogTag() : name(""), length(0) {}
+
+  template <size_t N>
+  constexpr LogTag(char const (&name)[N]) : name(name), length(N - 1) {}
 
-  template <typename T> Logger& operator<<(const T& v) {
-    if (level_ < threshold_) {
+  char const* name;
+  size_t length;
+};
+
+class Logger;
+
+// The line a thread is logging, put together in a fixed buffer of its own and
+// handed over to the Logger's writer upon std::endl.
+class LogLine {
+public:
+  template <typename T> LogLine& operator<<(const T& v) {
+    if (!isEnabled_) {
       return *this;
     }
 
-    if (!linePrimed_) {
-      buffer_ << logHeader() << "[" << tag_ << "] ";
-      for (size_t i = tag_.length(); i < kLoggerTagPaddingTo; i++) {
-        buffer_ << " ";
+    // Skips std::ostream's formatting for integers and strings, unless the
+    // stream was told to format them differently. Characters (including
+    // Byte-s) and bools are still left to the stream.
+    // The sizeof() test is nested, since manipulators like std::left are
+    // functions.
+    if constexpr (std::is_integral_v<T>) {
+      if constexpr (sizeof(T) > 1) {
+        if (isPlain()) {
+          char digits[24];
+          auto result = std::to_chars(digits, digits + sizeof(digits), v);
+          buffer_.sputn(digits, result.ptr - digits);
+          return *this;
+        }
+      }
+    } else if constexpr (std::is_convertible_v<T const&, std::string_view>) {
+      if (stream_.width() == 0) {
+        std::string_view view = v;
+        buffer_.sputn(view.data(), view.length());
+        return *this;
       }
-      linePrimed_ = true;
     }
-    buffer_ << v;
+
+    stream_ << v;
     return *this;
   }
 
-  Logger& operator<<(std::ostream& (*os)(std::ostream&)) {
-    if (level_ < threshold_) {
-      return *this;
-    }
+  LogLine& operator<<(std::ostream& (*os)(std::ostream&));
 
-    buffer_ << os;
-    linePrimed_ = false;
-    flush();
+  // Turns a whole log statement into a void expression, for LOG_AT.
+  struct Voidify {
+    void operator&(LogLine&) {}
+  };
 
-    return *this;
-  }
+private:
+  LogLine();
+  ~LogLine();
 
-  static Logger& getDefault(std::string const& tag) {
-    static Logger defaultLogger;
-    defaultLogger.tag_ = tag;
-    return defaultLogger;
-  }
+  class Buffer : public std::streambuf {
+  public:
+    Buffer() { clear(); }
 
-  Logger& withLogLevel(LogLevel level) {
-    level_ = level;
-    return *this;
-  }
+    char const* data() const { return pbase(); }
+    size_t size() const { return pptr() - pbase(); }
+    void clear() { setp(data_, data_ + kLoggerMaxLineLength); }
+
+  protected:
+    // Drops whatever doesn't fit
+    virtual int_type overflow(int_type c) override {
+      return traits_type::not_eof(c);
+    }
 
-  void setLoggingThreshold(LogLevel threshold) { threshold_ = threshold; }
+  private:
+    char data_[kLoggerMaxLineLength];
+  };
 
-  std::function<void(std::string)> tee;
+  class Ring;
 
-private:
-  const size_t kSecTimestampBufferSize = 64;
-  const size_t kSubsecTimestampBufferSize = 64;
+  Buffer buffer_;
+  std::ostream stream_;
+  std::unique_ptr<Ring> ring_;
 
-  bool linePrimed_ = false;
-  std::string tag_;
-  std::ostream& out_;
-  LogLevel threshold_ = VERBOSE;
+  LogTag tag_;
   LogLevel level_ = VERBOSE;
-  std::stringstream buffer_;
-
-  std::string logHeader() {
-    char secTimestampBuffer[kSecTimestampBufferSize];
-    char subsecTimestampBuffer[kSubsecTimestampBufferSize];
-
-    struct timespec secAndNsec;
-    clock_gettime(CLOCK_REALTIME, &secAndNsec);
-    struct tm const* timeInfo = localtime(&secAndNsec.tv_sec);
-
-    strftime(secTimestampBuffer, kSecTimestampBufferSize, "%F %H:%M:%S",
-             timeInfo);
-    snprintf(subsecTimestampBuffer, kSubsecTimestampBufferSize, ".%06ld",
-             secAndNsec.tv_nsec / 1000);
-    return "[" + std::string{secTimestampBuffer} +
-           std::string{subsecTimestampBuffer} + "] ";
+  bool isEnabled_ = false;
+
+  void begin(LogTag tag, LogLevel level);
+  void submit();
+
+  bool isPlain() const {
+    return (stream_.flags() & std::ios_base::basefield) == std::ios_base::dec &&
+           stream_.width() == 0;
   }
 
-#if TARGET_IOS
-  void flush() {
-    static os_log_t logObject = os_log_create("me.ljh.stun", "");
+  friend class Logger;
 
-    os_log_error(logObject, "%s", buffer_.str().c_str());
+private:
+  LogLine(LogLine const& copy) = delete;
+  LogLine& operator=(LogLine const& copy) = delete;
 
-    if (!!tee) {
-      tee(buffer_.str());
+  LogLine(LogLine&& move) = delete;
+  LogLine& operator=(LogLine&& move) = delete;
+};
+
+// Writes the lines of all threads out on a background thread of its own, so
+// that logging only costs the caller some formatting into a thread-local
+// buffer and a copy into a lock-free ring. The timestamp and tag of each line
+// are only rendered by the writer.
+//
+// ERROR lines are the exception, and block until they are written out, as
+// they tend to be followed by the process going down.
+class Logger {
+public:
+  static Logger& getDefault();
+
+  static LogLine& getLine(LogTag tag, LogLevel level) {
+    if (tLine_ == nullptr) {
+      createLine();
     }
 
-    buffer_.str("");
+    tLine_->begin(tag, level);
+    return *tLine_;
   }
-#else
-  void flush() {
-    out_ << buffer_.str();
-    out_.flush();
 
-    if (!!tee) {
-      tee(buffer_.str());
-    }
+  static bool isEnabled(LogLevel level) {
+    return level >= STUN_MIN_LOG_LEVEL &&
+           level >= threshold_.load(std::memory_order_relaxed);
+  }
 
-    buffer_.str("");
+  void setLoggingThreshold(LogLevel threshold) {
+    threshold_.store(threshold, std::memory_order_relaxed);
   }
-#endif
+
+  LogLevel getLoggingThreshold() const {
+    return threshold_.load(std::memory_order_relaxed);
+  }
+
+  // Blocks until all lines logged so far are written out.
+  void flush();
+
+  // Called on the writer thread with each line. Should be set before anything
+  // gets logged.
+  std::function<void(std::string)> tee;
+
+private:
+  Logger();
+
+  std::ostream& out_ = std::cout;
+  // Static for isEnabled() to be as cheap as it gets
+  inline static std::atomic<LogLevel> threshold_{VERBOSE};
+
+  // Guards the lines, and the flushes asked for and done
+  std::mutex mutex_;
+  std::condition_variable wakeUp_;
+  std::condition_variable didFlush_;
+  std::vector<LogLine*> lines_;
+  uint64_t flushesRequested_ = 0;
+  uint64_t flushesDone_ = 0;
+  // Set when a ring is filling up, for the writer not to wait out its interval
+  std::atomic<bool> isBacklogged_{false};
+
+  std::thread writer_;
+
+  // The rendered header of the second last written in, e.g.
+  // "[2020-01-01 12:34:56", to be reused until the second changes
+  time_t headerSecond_ = -1;
+  std::string headerPrefix_;
+
+  class LineOwner;
+
+  // The calling thread's line, until the thread exits. Left to the writer to
+  // get rid of after that, once everything in it is written out.
+  inline static thread_local LogLine* tLine_ = nullptr;
+
+  static void createLine();
+  void wakeUp() {
+    if (!isBacklogged_.exchange(true, std::memory_order_relaxed)) {
+      wakeUp_.notify_one();
+    }
+  }
+
+  void run();
+  void write(std::string const& lines);
+
+  friend class LogLine;
+
+private:
+  Logger(Logger const& copy) = delete;
+  Logger& operator=(Logger const& copy) = delete;
+
+  Logger(Logger&& move) = delete;
+  Logger& operator=(Logger&& move) = delete;
 };
 } // namespace common
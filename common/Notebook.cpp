@@ -1,7 +1,12 @@
 #include "common/Notebook.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <common/Logger.h>
 #include <common/Util.h>
 
 #include <fstream>
@@ -20,6 +25,23 @@ Notebook::Notebook(std::string path) : path_(path) {
   }
 
   Notebook::instance_ = this;
+
+  writer_ = std::thread([this]() { run(); });
+}
+
+Notebook::~Notebook() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    isStopping_ = true;
+  }
+  wakeUp_.notify_one();
+  writer_.join();
+
+  flush();
+
+  if (Notebook::instance_ == this) {
+    Notebook::instance_ = nullptr;
+  }
 }
 
 /* static */ Notebook& Notebook::getInstance() {
@@ -28,10 +50,85 @@ Notebook::Notebook(std::string path) : path_(path) {
   return *Notebook::instance_;
 }
 
-void Notebook::save() {
-  std::ofstream output(path_);
-  output << storage_.dump() << std::endl;
+void Notebook::update(std::function<void(json&)> const& change) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  change(storage_);
+  isDirty_ = true;
 }
 
-json& Notebook::operator[](std::string key) { return storage_[key]; }
+void Notebook::flush() {
+  std::lock_guard<std::mutex> flushLock(flushMutex_);
+
+  std::string content;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!isDirty_) {
+      return;
+    }
+    content = storage_.dump();
+    isDirty_ = false;
+  }
+
+  if (!write(content)) {
+    // Tried again with the next flush
+    std::lock_guard<std::mutex> lock(mutex_);
+    isDirty_ = true;
+  }
+}
+
+void Notebook::run() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wakeUp_.wait_for(lock, kNotebookFlushInterval,
+                       [this]() { return isStopping_; });
+      if (isStopping_) {
+        return;
+      }
+    }
+
+    flush();
+  }
+}
+
+bool Notebook::write(std::string const& content) {
+  std::string tempPath = path_ + ".tmp";
+
+  int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG_E("Notebook") << "Cannot open " << tempPath << ": " << strerror(errno)
+                      << std::endl;
+    return false;
+  }
+
+  std::string data = content + "\n";
+  size_t written = 0;
+  while (written < data.length()) {
+    ssize_t ret = ::write(fd, data.data() + written, data.length() - written);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret < 0) {
+      break;
+    }
+    written += ret;
+  }
+
+  // The data has to be on disk before the rename is, or a crash in between
+  // might leave an empty notebook behind.
+  bool succeeded = (written == data.length()) && (fsync(fd) == 0);
+  int err = errno;
+  close(fd);
+
+  if (succeeded && rename(tempPath.c_str(), path_.c_str()) != 0) {
+    succeeded = false;
+    err = errno;
+  }
+
+  if (!succeeded) {
+    LOG_E("Notebook") << "Cannot write " << path_ << ": " << strerror(err)
+                      << std::endl;
+  }
+  return succeeded;
+}
 } // namespace common
@@ -2,20 +2,40 @@
 
 #include <json/json.hpp>
 
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
 
 namespace common {
 
 using json = nlohmann::json;
 
+// How often changes to the notebook are written out
+static const auto kNotebookFlushInterval = std::chrono::seconds(1);
+
+// A JSON document kept on disk across runs, e.g. with the quota each user has
+// used up so far.
+//
+// The in-memory contents are what counts. Changes only mark them as dirty, and
+// a background thread writes them out every kNotebookFlushInterval if so. Each
+// write goes to a temporary file that then replaces the notebook, so that a
+// crash leaves either the old or the new contents behind, never half of each.
 class Notebook {
 public:
   Notebook(std::string path);
+  ~Notebook();
 
   static Notebook& getInstance();
 
-  void save();
-  json& operator[](std::string key);
+  // Runs `change` on the contents, which are written out with the next flush.
+  // The contents mustn't be held on to after `change` returns.
+  void update(std::function<void(json&)> const& change);
+
+  // Blocks until the contents as of now are written out.
+  void flush();
 
 private:
   Notebook(Notebook const& copy) = delete;
@@ -27,6 +47,20 @@ private:
   static Notebook* instance_;
 
   std::string path_;
+
+  // Guards the contents, and whether they changed since the last flush
+  std::mutex mutex_;
   json storage_;
+  bool isDirty_ = false;
+
+  // Keeps flushes in order, for an older one never to overwrite a newer one
+  std::mutex flushMutex_;
+
+  std::condition_variable wakeUp_;
+  bool isStopping_ = false;
+  std::thread writer_;
+
+  void run();
+  bool write(std::string const& content);
 };
 } // namespace common
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <common/Util.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <memory>
+
+namespace common {
+
+// A fixed-capacity byte FIFO. Both the readable bytes and the free space are
+// exposed as (at most two) iovec-s so that they can be handed to writev() and
+// readv() without any copying.
+//
+// Positions are tracked as running totals of bytes pushed and consumed, which
+// never wrap in practice and can be used to refer to a byte in the stream.
+class RingBuffer {
+public:
+  RingBuffer(size_t capacity)
+      : capacity_(capacity), buffer_(new Byte[capacity]) {
+    assertTrue(capacity > 0 && (capacity & (capacity - 1)) == 0,
+               "RingBuffer capacity must be a power of 2.");
+  }
+
+  size_t size() const { return tail_ - head_; }
+  size_t space() const { return capacity_ - size(); }
+  bool empty() const { return head_ == tail_; }
+
+  // Running totals of bytes consumed and pushed respectively
+  uint64_t getHead() const { return head_; }
+  uint64_t getTail() const { return tail_; }
+
+  void push(Byte const* data, size_t size) {
+    assertTrue(size <= space(), "Pushing into a full RingBuffer.");
+
+    size_t offset = tail_ & (capacity_ - 1);
+    size_t first = std::min(size, capacity_ - offset);
+    memcpy(buffer_.get() + offset, data, first);
+    memcpy(buffer_.get(), data + first, size - first);
+    tail_ += size;
+  }
+
+  // Fills `segments` with the readable bytes past the oldest `skip` ones,
+  // oldest first, and returns the number of segments used (0 to 2).
+  int getReadSegments(struct iovec segments[2], size_t skip = 0) const {
+    assertTrue(skip <= size(),
+               "Skipping more than there is in the RingBuffer.");
+
+    size_t readable = size() - skip;
+    size_t offset = (head_ + skip) & (capacity_ - 1);
+    size_t first = std::min(readable, capacity_ - offset);
+    int count = 0;
+
+    if (first > 0) {
+      segments[count++] = {buffer_.get() + offset, first};
+    }
+    if (readable > first) {
+      segments[count++] = {buffer_.get(), readable - first};
+    }
+    return count;
+  }
+
+  // Copies the oldest `size` bytes into `out` without consuming them.
+  void peek(Byte* out, size_t size) const {
+    assertTrue(size <= this->size(),
+               "Peeking more than there is in the RingBuffer.");
+
+    size_t offset = head_ & (capacity_ - 1);
+    size_t first = std::min(size, capacity_ - offset);
+    memcpy(out, buffer_.get() + offset, first);
+    memcpy(out + first, buffer_.get(), size - first);
+  }
+
+  // Fills `segments` with the free space, in the order it will be filled, and
+  // returns the number of segments used (0 to 2). Bytes written there become
+  // readable once commit()-ed.
+  int getWriteSegments(struct iovec segments[2]) {
+    size_t offset = tail_ & (capacity_ - 1);
+    size_t first = std::min(space(), capacity_ - offset);
+    int count = 0;
+
+    if (first > 0) {
+      segments[count++] = {buffer_.get() + offset, first};
+    }
+    if (space() > first) {
+      segments[count++] = {buffer_.get(), space() - first};
+    }
+    return count;
+  }
+
+  void commit(size_t size) {
+    assertTrue(size <= space(), "Committing more than there is room for.");
+    tail_ += size;
+  }
+
+  void consume(size_t size) {
+    assertTrue(size <= this->size(),
+               "Consuming more than there is in the RingBuffer.");
+    head_ += size;
+  }
+
+private:
+  RingBuffer(RingBuffer const& copy) = delete;
+  RingBuffer& operator=(RingBuffer const& copy) = delete;
+
+  size_t capacity_;
+  std::unique_ptr<Byte[]> buffer_;
+
+  uint64_t head_ = 0;
+  uint64_t tail_ = 0;
+};
+} // namespace common
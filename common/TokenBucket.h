@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+namespace common {
+
+// A token bucket refilled at `rate` tokens per second, holding up to `burst`
+// tokens. Consuming is always allowed and may leave the bucket in debt, which
+// later consumers have to wait off. This way a packet never has to be split
+// or held back just because it's bigger than what's left.
+class TokenBucket {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  TokenBucket(double rate, double burst)
+      : rate_(rate), burst_(burst), tokens_(burst), lastRefill_(Clock::now()) {}
+
+  double getRate() const { return rate_; }
+
+  void setRate(double rate, double burst) {
+    refill(Clock::now());
+    rate_ = rate;
+    burst_ = burst;
+    tokens_ = std::min(tokens_, burst_);
+  }
+
+  bool isReady(Clock::time_point now) {
+    refill(now);
+    return tokens_ >= 0;
+  }
+
+  // How long until the bucket is out of debt.
+  Clock::duration getWait(Clock::time_point now) {
+    refill(now);
+    if (tokens_ >= 0 || rate_ <= 0) {
+      return Clock::duration::zero();
+    }
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(-tokens_ / rate_));
+  }
+
+  void consume(double tokens, Clock::time_point now) {
+    refill(now);
+    tokens_ -= tokens;
+  }
+
+private:
+  double rate_;
+  double burst_;
+  double tokens_;
+  Clock::time_point lastRefill_;
+
+  void refill(Clock::time_point now) {
+    if (now <= lastRefill_) {
+      return;
+    }
+
+    double elapsed = std::chrono::duration<double>(now - lastRefill_).count();
+    tokens_ = std::min(burst_, tokens_ + elapsed * rate_);
+    lastRefill_ = now;
+  }
+};
+} // namespace common
@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+
+#include <common/BufferPool.h>
+
+#include <string.h>
+
+#include <algorithm>
+#include <future>
+#include <set>
+#include <thread>
+#include <vector>
+
+using common::BufferPool;
+
+// Blocks moved between a thread cache and the depot at a time, as in
+// BufferPool.cpp
+static const size_t kMagazineSize = 32;
+
+static size_t getInUseBytes() {
+  return BufferPool::getInstance().getUsage().inUseBytes;
+}
+
+TEST(BufferPoolTests, SizeClasses) {
+  auto& pool = BufferPool::getInstance();
+
+  std::vector<std::pair<size_t, size_t>> cases = {
+      {1, 128},       {128, 128},     {129, 512},     {2048, 2048},
+      {4096, 4128},   {4128, 4128},   {4129, 16384},  {65536, 65536},
+      {65537, 65537}, {100000, 100000},
+  };
+
+  for (auto const& sizes : cases) {
+    size_t before = getInUseBytes();
+    void* buffer = pool.allocate(sizes.first);
+    memset(buffer, 0x42, sizes.first);
+    ASSERT_EQ(getInUseBytes() - before, sizes.second)
+        << "Allocating " << sizes.first << " bytes should take up "
+        << sizes.second << ".";
+
+    pool.free(buffer, sizes.first);
+    ASSERT_EQ(getInUseBytes(), before) << "Buffer should be freed.";
+  }
+}
+
+TEST(BufferPoolTests, ReusesFreedBlocks) {
+  auto& pool = BufferPool::getInstance();
+
+  void* buffer = pool.allocate(500);
+  pool.free(buffer, 500);
+  ASSERT_EQ(pool.allocate(300), buffer)
+      << "Same class should reuse the block just freed.";
+  pool.free(buffer, 300);
+}
+
+// Frees enough blocks in one thread for its cache to hand a magazine over to
+// the depot, where another thread picks it up.
+TEST(BufferPoolTests, MagazineExchange) {
+  static const size_t kSize = 16384;
+  auto& pool = BufferPool::getInstance();
+
+  std::vector<void*> freed;
+  std::vector<void*> kept;
+  std::promise<void> didFree;
+  std::promise<void> didTake;
+
+  std::thread first([&]() {
+    for (size_t i = 0; i < 2 * kMagazineSize; i++) {
+      freed.push_back(pool.allocate(kSize));
+    }
+    for (auto buffer : freed) {
+      pool.free(buffer, kSize);
+    }
+    didFree.set_value();
+
+    // What's left in the cache once the other magazine went to the depot
+    didTake.get_future().wait();
+    for (size_t i = 0; i < kMagazineSize; i++) {
+      kept.push_back(pool.allocate(kSize));
+    }
+    for (auto buffer : kept) {
+      pool.free(buffer, kSize);
+    }
+  });
+
+  didFree.get_future().wait();
+
+  std::vector<void*> taken;
+  std::thread second([&]() {
+    for (size_t i = 0; i < kMagazineSize; i++) {
+      taken.push_back(pool.allocate(kSize));
+    }
+    for (auto buffer : taken) {
+      pool.free(buffer, kSize);
+    }
+  });
+  second.join();
+
+  didTake.set_value();
+  first.join();
+
+  // The last ones freed went to the depot, and the first ones stayed
+  std::set<void*> drained(freed.begin() + kMagazineSize, freed.end());
+  std::set<void*> cached(freed.begin(), freed.begin() + kMagazineSize);
+  ASSERT_EQ(std::set<void*>(taken.begin(), taken.end()), drained)
+      << "Other thread should get the magazine from the depot.";
+  ASSERT_EQ(std::set<void*>(kept.begin(), kept.end()), cached)
+      << "Thread should keep a magazine in its cache.";
+}
+
+TEST(BufferPoolTests, CrossThreadFree) {
+  static const size_t kSize = 2000;
+  auto& pool = BufferPool::getInstance();
+  size_t before = getInUseBytes();
+
+  void* buffer = nullptr;
+  std::thread([&]() {
+    buffer = pool.allocate(kSize);
+    memset(buffer, 0x42, kSize);
+  }).join();
+  ASSERT_EQ(getInUseBytes() - before, 2048u)
+      << "Buffer should stay in use after its thread exits.";
+
+  void* reused = nullptr;
+  std::thread([&]() {
+    pool.free(buffer, kSize);
+    reused = pool.allocate(kSize);
+    pool.free(reused, kSize);
+  }).join();
+  ASSERT_EQ(reused, buffer) << "Freeing thread should get to reuse it.";
+  ASSERT_EQ(getInUseBytes(), before) << "Buffer should be freed.";
+}
+
+TEST(BufferPoolTests, Arena) {
+  static const size_t kSize = 65536;
+  auto& pool = BufferPool::getInstance();
+
+  // As with packet_arena_mb = 1, which rounds up to a whole huge page
+  ASSERT_TRUE(pool.reserveArena(1 << 20)) << "Arena should be reserved.";
+  static const size_t kArenaSize = 2 << 20;
+
+  // In a fresh thread, so that the first magazine is carved out of the arena.
+  // No other test lets blocks of this class into the depot.
+  std::vector<void*> buffers;
+  std::thread([&]() {
+    for (size_t i = 0; i <= kArenaSize / kSize; i++) {
+      buffers.push_back(pool.allocate(kSize));
+      memset(buffers.back(), 0x42, kSize);
+    }
+    for (auto buffer : buffers) {
+      pool.free(buffer, kSize);
+    }
+  }).join();
+
+  auto overflow = static_cast<Byte*>(buffers.back());
+  buffers.pop_back();
+  std::sort(buffers.begin(), buffers.end());
+  auto start = static_cast<Byte*>(buffers.front());
+  for (size_t i = 0; i < buffers.size(); i++) {
+    ASSERT_EQ(buffers[i], start + i * kSize)
+        << "Blocks should be carved out of the arena back to back.";
+  }
+
+  ASSERT_TRUE(overflow < start || overflow >= start + kArenaSize)
+      << "Blocks past the end of the arena should come from elsewhere.";
+}
@@ -7,6 +7,9 @@ namespace crypto {
 
 const Byte kAESKeyPaddingByte = 0xFB;
 
+static_assert(AESEncryptor::Overhead == CryptoPP::AES::BLOCKSIZE,
+              "AESEncryptor::Overhead is out of date.");
+
 AESKey::AESKey(Byte* data, size_t size) : key(data, size) {}
 
 AESKey::AESKey(std::string const& key) {
@@ -18,6 +18,9 @@ public:
 
 class AESEncryptor : public Encryptor {
 public:
+  // The IV that goes with each message
+  constexpr static size_t Overhead = 16;
+
   explicit AESEncryptor(AESKey const& key);
 
   virtual size_t encrypt(Byte* data, size_t size, size_t capacity) override;
@@ -6,6 +6,9 @@ static const Byte kPadderPaddingByte = 0xFB;
 
 typedef size_t PadderSizeType;
 
+static_assert(Padder::Overhead == sizeof(PadderSizeType),
+              "Padder::Overhead is out of date.");
+
 Padder::Padder(size_t minSize) : minSize_(minSize) {}
 
 /* virtual */ size_t Padder::encrypt(Byte* data, size_t size,
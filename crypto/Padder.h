@@ -10,6 +10,9 @@ namespace crypto {
 
 class Padder : public Encryptor {
 public:
+  // The size footer, on top of padding up to the minimum size
+  constexpr static size_t Overhead = sizeof(size_t);
+
   Padder(size_t minSize);
 
   virtual size_t encrypt(Byte* data, size_t size, size_t capacity) override;
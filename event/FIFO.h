@@ -2,49 +2,150 @@
 
 #include <event/Condition.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
-#include <queue>
+#include <new>
+#include <stdexcept>
 
 namespace event {
 
+// Keeps the producer's and the consumer's indices on separate cache lines, so
+// that the two threads don't keep stealing the line from each other.
+static const size_t kFIFOCacheLineSize = 64;
+
+// A bounded FIFO backed by a power-of-two ring, which allocates nothing after
+// construction.
+//
+// The single-loop flavour drives canPush() and canPop() as BaseCondition-s.
+// Each push or pop only touches the ones it can actually flip.
+//
+// The SPSC flavour bridges two threads, each running its own EventLoop: one
+// thread may only push, and the other may only pop. The indices are handed
+// over lock-free, and each side's condition is computed off them by its own
+// loop. That means the consumer notices new elements the next time its loop
+// comes around, rather than being woken up.
 template <typename T> class FIFO {
 public:
   FIFO(EventLoop& loop, std::size_t capacity)
-      : capacity_(capacity), queue_(), canPush_(loop.createBaseCondition()),
-        canPop_(loop.createBaseCondition()) {
-    updateConditions();
+      : capacity_(capacity), mask_(getRingSize(capacity) - 1),
+        slots_(new Slot[mask_ + 1]) {
+    auto canPush = loop.createBaseCondition();
+    auto canPop = loop.createBaseCondition();
+    pushable_ = canPush.get();
+    poppable_ = canPop.get();
+    canPush_ = std::move(canPush);
+    canPop_ = std::move(canPop);
+
+    pushable_->set(capacity_ > 0);
+  }
+
+  FIFO(EventLoop& producerLoop, EventLoop& consumerLoop, std::size_t capacity)
+      : capacity_(capacity), mask_(getRingSize(capacity) - 1),
+        slots_(new Slot[mask_ + 1]) {
+    auto canPush = producerLoop.createComputedCondition();
+    canPush->expression = [this]() {
+      return tail_.load(std::memory_order_relaxed) -
+                 head_.load(std::memory_order_acquire) <
+             capacity_;
+    };
+    auto canPop = consumerLoop.createComputedCondition();
+    canPop->expression = [this]() {
+      return tail_.load(std::memory_order_acquire) !=
+             head_.load(std::memory_order_relaxed);
+    };
+    canPush_ = std::move(canPush);
+    canPop_ = std::move(canPop);
+  }
+
+  ~FIFO() {
+    size_t tail = tail_.load(std::memory_order_acquire);
+    for (size_t i = head_.load(std::memory_order_relaxed); i != tail; i++) {
+      at(i).~T();
+    }
   }
 
   Condition* canPush() const { return canPush_.get(); }
 
   Condition* canPop() const { return canPop_.get(); }
 
+  std::size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
   void push(T&& element) {
-    if (queue_.size() >= capacity_) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (!hasRoom(tail, 1)) {
       throw std::runtime_error("Trying to push into a full FIFO.");
     }
 
-    queue_.push(std::move(element));
-    updateConditions();
+    new (&slots_[tail & mask_]) T(std::move(element));
+    tail_.store(tail + 1, std::memory_order_release);
+    didPush(tail + 1);
   }
 
   T pop() {
-    if (queue_.size() == 0) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (!hasElements(head, 1)) {
       throw std::runtime_error("Trying to pop from an empty FIFO.");
     }
 
-    T result(std::move(queue_.front()));
-    queue_.pop();
-    updateConditions();
+    T& element = at(head);
+    T result(std::move(element));
+    element.~T();
+    head_.store(head + 1, std::memory_order_release);
+    didPop(head + 1);
     return result;
   }
 
   T const& front() {
-    if (queue_.size() == 0) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (!hasElements(head, 1)) {
       throw std::runtime_error("Trying to call front() on an empty FIFO.");
     }
 
-    return queue_.front();
+    return at(head);
+  }
+
+  // Moves as many of `elements` in as there's room for, and returns how many
+  // that was.
+  std::size_t pushN(T* elements, std::size_t count) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (!hasRoom(tail, count)) {
+      count = std::min(count, capacity_ - (tail - cachedHead_));
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      new (&slots_[(tail + i) & mask_]) T(std::move(elements[i]));
+    }
+
+    if (count > 0) {
+      tail_.store(tail + count, std::memory_order_release);
+      didPush(tail + count);
+    }
+    return count;
+  }
+
+  // Moves up to `count` elements out into `output`, and returns how many
+  // there were.
+  std::size_t popN(T* output, std::size_t count) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (!hasElements(head, count)) {
+      count = std::min(count, cachedTail_ - head);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      T& element = at(head + i);
+      output[i] = std::move(element);
+      element.~T();
+    }
+
+    if (count > 0) {
+      head_.store(head + count, std::memory_order_release);
+      didPop(head + count);
+    }
+    return count;
   }
 
 private:
@@ -54,15 +155,82 @@ private:
   FIFO(FIFO&& move) = delete;
   FIFO& operator=(FIFO&& move) = delete;
 
+  struct Slot {
+    alignas(T) unsigned char bytes[sizeof(T)];
+  };
+
   std::size_t capacity_;
-  std::queue<T> queue_;
+  std::size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
 
-  std::unique_ptr<BaseCondition> canPush_;
-  std::unique_ptr<BaseCondition> canPop_;
+  std::unique_ptr<Condition> canPush_;
+  std::unique_ptr<Condition> canPop_;
 
-  void updateConditions() {
-    canPush_->set(queue_.size() < capacity_);
-    canPop_->set(queue_.size() > 0);
+  // Only set for the single-loop flavour
+  BaseCondition* pushable_ = nullptr;
+  BaseCondition* poppable_ = nullptr;
+
+  // Written by the consumer only, along with its view of the tail
+  alignas(kFIFOCacheLineSize) std::atomic<size_t> head_{0};
+  size_t cachedTail_ = 0;
+
+  // Written by the producer only, along with its view of the head
+  alignas(kFIFOCacheLineSize) std::atomic<size_t> tail_{0};
+  size_t cachedHead_ = 0;
+
+  static std::size_t getRingSize(std::size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    return size;
+  }
+
+  T& at(size_t index) {
+    return *std::launder(reinterpret_cast<T*>(&slots_[index & mask_]));
+  }
+
+  // Checks whether there are at least `count` elements past `head`, only
+  // going for the producer's index if what we last saw of it isn't enough.
+  bool hasElements(size_t head, size_t count) {
+    if (cachedTail_ - head >= count) {
+      return true;
+    }
+    cachedTail_ = tail_.load(std::memory_order_acquire);
+    return cachedTail_ - head >= count;
+  }
+
+  // Same as hasElements(), for the producer.
+  bool hasRoom(size_t tail, size_t count) {
+    if (capacity_ - (tail - cachedHead_) >= count) {
+      return true;
+    }
+    cachedHead_ = head_.load(std::memory_order_acquire);
+    return capacity_ - (tail - cachedHead_) >= count;
+  }
+
+  // The single-loop flavour is both the producer and the consumer, so it can
+  // read both indices without synchronizing.
+  void didPush(size_t tail) {
+    if (poppable_ == nullptr) {
+      return;
+    }
+
+    poppable_->set(true);
+    if (tail - head_.load(std::memory_order_relaxed) >= capacity_) {
+      pushable_->set(false);
+    }
+  }
+
+  void didPop(size_t head) {
+    if (pushable_ == nullptr) {
+      return;
+    }
+
+    pushable_->set(true);
+    if (head == tail_.load(std::memory_order_relaxed)) {
+      poppable_->set(false);
+    }
   }
 };
 } // namespace event
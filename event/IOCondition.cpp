@@ -1,5 +1,6 @@
 #include "event/IOCondition.h"
 
+#include <common/Util.h>
 #include <event/EventLoop.h>
 
 #include <errno.h>
@@ -20,6 +21,22 @@ const int kReadPollMask = POLLIN | POLLPRI | POLLHUP;
 #endif
 
 const int kWritePollMask = POLLOUT;
+// poll() always reports POLLERR, so there is nothing extra to ask for.
+const int kErrorPollMask = POLLERR;
+
+static int getPollMask(IOType type) {
+  switch (type) {
+  case IOType::Read:
+    return kReadPollMask;
+  case IOType::Write:
+    return kWritePollMask;
+  case IOType::Error:
+    return kErrorPollMask;
+  }
+
+  assertTrue(false, "Unknown IOType encountered.");
+  return 0;
+}
 
 IOConditionManager::IOConditionManager(EventLoop& loop)
     : loop_(loop), conditions_() {
@@ -34,9 +51,14 @@ IOCondition* IOConditionManager::canWrite(int fd) {
   return canDo(fd, IOType::Write);
 }
 
+IOCondition* IOConditionManager::hasError(int fd) {
+  return canDo(fd, IOType::Error);
+}
+
 void IOConditionManager::close(int fd) {
   removeCondition(fd, IOType::Read);
   removeCondition(fd, IOType::Write);
+  removeCondition(fd, IOType::Error);
 }
 
 void IOConditionManager::prepareConditions(
@@ -51,8 +73,7 @@ void IOConditionManager::prepareConditions(
   for (size_t i = 0; i < conditions.size(); i++) {
     IOCondition* condition = static_cast<IOCondition*>(conditions[i]);
     polls[i].fd = condition->fd;
-    polls[i].events =
-        (condition->type == IOType::Read ? kReadPollMask : kWritePollMask);
+    polls[i].events = getPollMask(condition->type);
     polls[i].revents = 0;
   }
   int ret = poll(polls, conditions.size(), kIOPollTimeout);
@@ -77,9 +98,7 @@ void IOConditionManager::prepareConditions(
     }
 
     IOCondition* condition = static_cast<IOCondition*>(conditions[i]);
-    int mask =
-        (condition->type == IOType::Read ? kReadPollMask : kWritePollMask);
-    if (polls[i].revents & mask) {
+    if (polls[i].revents & getPollMask(condition->type)) {
       condition->fire();
     }
   }
@@ -11,6 +11,8 @@ namespace event {
 enum IOType {
   Read,
   Write,
+  // Pending errors, e.g. in a socket's error queue
+  Error,
 };
 
 class IOCondition : public BaseCondition {
@@ -28,6 +30,7 @@ public:
 
   IOCondition* canRead(int fd);
   IOCondition* canWrite(int fd);
+  IOCondition* hasError(int fd);
   void close(int fd);
 
   virtual void
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <event/Condition.h>
+#include <event/FIFO.h>
+#include <event/Timer.h>
+
+#include <stats/AvgStat.h>
+#include <stats/RateStat.h>
+
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace event {
+
+// Depth and sojourn time of one class of a PriorityFIFO, plus how many
+// elements CoDel dropped from it.
+struct PriorityFIFOClassStats {
+  PriorityFIFOClassStats(std::string const& entity, std::string const& prefix,
+                         stats::LabelSet const& labels = stats::LabelSet())
+      : statDepth(entity, prefix + "_depth", labels),
+        statSojourn(entity, prefix + "_sojourn", labels),
+        statDrops(entity, prefix + "_drops", labels) {}
+
+  stats::AvgStat statDepth;
+  stats::AvgStat statSojourn;
+  stats::RateStat statDrops;
+};
+
+// CoDel parameters, as recommended by RFC 8289 for the Internet at large
+static const std::chrono::steady_clock::duration kPriorityFIFOCoDelTarget =
+    std::chrono::milliseconds(5);
+static const std::chrono::steady_clock::duration kPriorityFIFOCoDelInterval =
+    std::chrono::milliseconds(100);
+
+// A bounded FIFO split into classes, with the same interface as FIFO.
+//
+// Strict classes are always popped from first, in order. The remaining
+// classes share what's left by deficit round robin, each getting `quantum`
+// units of cost (e.g. bytes) per round.
+//
+// With CoDel enabled, each class drops from its head once its elements have
+// been sitting in it for longer than kPriorityFIFOCoDelTarget for a whole
+// kPriorityFIFOCoDelInterval, which keeps a standing queue from building up
+// behind a slow consumer. The last element of a class is never dropped, so
+// pop() always has something to return.
+//
+// Built with a single class and without CoDel, it's a plain FIFO underneath,
+// and pays for neither timestamps nor per-element allocations.
+template <typename T> class PriorityFIFO {
+public:
+  struct Class {
+    bool strict;
+    size_t quantum;
+  };
+
+  // A single class without CoDel, which is just a FIFO
+  PriorityFIFO(EventLoop& loop, std::size_t capacity)
+      : capacity_(capacity), defaultClass_(0), codel_(false),
+        plain_(new FIFO<T>(loop, capacity)) {}
+
+  PriorityFIFO(EventLoop& loop, std::size_t capacity,
+               std::vector<Class> const& classes, size_t defaultClass,
+               bool codel)
+      : capacity_(capacity), defaultClass_(defaultClass), codel_(codel),
+        classes_(classes.size()), canPush_(loop.createBaseCondition()),
+        canPop_(loop.createBaseCondition()) {
+    for (size_t i = 0; i < classes.size(); i++) {
+      classes_[i].config = classes[i];
+    }
+    updateConditions();
+  }
+
+  Condition* canPush() const {
+    return (!!plain_ ? plain_->canPush() : canPush_.get());
+  }
+
+  Condition* canPop() const {
+    return (!!plain_ ? plain_->canPop() : canPop_.get());
+  }
+
+  size_t getClassCount() const { return (!!plain_ ? 1 : classes_.size()); }
+
+  size_t getDepth(size_t cls) const {
+    return (!!plain_ ? plain_->size() : classes_[cls].queue.size());
+  }
+
+  // Stats are only kept for queues with more than one class.
+  void setStats(size_t cls, PriorityFIFOClassStats* stats) {
+    if (!plain_) {
+      classes_[cls].stats = stats;
+    }
+  }
+
+  void push(T&& element) { push(std::move(element), defaultClass_, 1); }
+
+  void push(T&& element, size_t cls, size_t cost) {
+    if (!!plain_) {
+      plain_->push(std::move(element));
+      return;
+    }
+
+    if (size_ >= capacity_) {
+      throw std::runtime_error("Trying to push into a full PriorityFIFO.");
+    }
+
+    auto& target = classes_[cls < classes_.size() ? cls : defaultClass_];
+    target.queue.push_back(Entry{std::move(element), Timer::getTime(), cost});
+    size_++;
+
+    if (target.stats != nullptr) {
+      target.stats->statDepth.accumulate(target.queue.size());
+    }
+    updateConditions();
+  }
+
+  T pop() {
+    if (!!plain_) {
+      return plain_->pop();
+    }
+
+    if (size_ == 0) {
+      throw std::runtime_error("Trying to pop from an empty PriorityFIFO.");
+    }
+
+    for (auto& strict : classes_) {
+      if (strict.config.strict && !strict.queue.empty()) {
+        return dequeue(strict);
+      }
+    }
+
+    while (true) {
+      auto& current = classes_[current_];
+
+      if (current.config.strict || current.queue.empty()) {
+        // Idle classes don't get to save up their deficit
+        current.deficit = 0;
+        nextRound();
+        continue;
+      }
+
+      if (!roundStarted_) {
+        current.deficit += current.config.quantum;
+        roundStarted_ = true;
+      }
+
+      if (current.queue.front().cost <= current.deficit) {
+        current.deficit -= current.queue.front().cost;
+        return dequeue(current);
+      }
+
+      nextRound();
+    }
+  }
+
+private:
+  PriorityFIFO(PriorityFIFO const& copy) = delete;
+  PriorityFIFO& operator=(PriorityFIFO const& copy) = delete;
+
+  PriorityFIFO(PriorityFIFO&& move) = delete;
+  PriorityFIFO& operator=(PriorityFIFO&& move) = delete;
+
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    T element;
+    Time enqueuedAt;
+    size_t cost;
+  };
+
+  struct ClassState {
+    Class config;
+    std::deque<Entry> queue;
+    size_t deficit = 0;
+    PriorityFIFOClassStats* stats = nullptr;
+
+    // CoDel states, named after RFC 8289
+    bool dropping = false;
+    std::optional<Time> firstAboveTime;
+    Time dropNext = {};
+    size_t count = 0;
+    size_t lastCount = 0;
+  };
+
+  std::size_t capacity_;
+  std::size_t size_ = 0;
+  size_t defaultClass_;
+  bool codel_;
+
+  std::unique_ptr<FIFO<T>> plain_;
+
+  std::vector<ClassState> classes_;
+  size_t current_ = 0;
+  bool roundStarted_ = false;
+
+  std::unique_ptr<BaseCondition> canPush_;
+  std::unique_ptr<BaseCondition> canPop_;
+
+  void nextRound() {
+    current_ = (current_ + 1) % classes_.size();
+    roundStarted_ = false;
+  }
+
+  T dequeue(ClassState& cls) {
+    auto now = Timer::getTime();
+
+    if (codel_) {
+      runCoDel(cls, now);
+    }
+
+    Entry entry = std::move(cls.queue.front());
+    cls.queue.pop_front();
+    size_--;
+
+    if (cls.stats != nullptr) {
+      cls.stats->statSojourn.accumulate(
+          std::chrono::duration<double, std::milli>(now - entry.enqueuedAt)
+              .count());
+    }
+    updateConditions();
+    return std::move(entry.element);
+  }
+
+  // Whether the head of `cls` has been above the target for long enough.
+  bool isAboveTarget(ClassState& cls, Time now) {
+    if (now - cls.queue.front().enqueuedAt < kPriorityFIFOCoDelTarget ||
+        cls.queue.size() <= 1) {
+      cls.firstAboveTime.reset();
+      return false;
+    }
+
+    if (!cls.firstAboveTime) {
+      cls.firstAboveTime = now + kPriorityFIFOCoDelInterval;
+      return false;
+    }
+
+    return now >= *cls.firstAboveTime;
+  }
+
+  static Time getNextDropTime(Time from, size_t count) {
+    return from + std::chrono::duration_cast<Clock::duration>(
+                      kPriorityFIFOCoDelInterval / std::sqrt(count));
+  }
+
+  void drop(ClassState& cls) {
+    cls.queue.pop_front();
+    size_--;
+
+    if (cls.stats != nullptr) {
+      cls.stats->statDrops.accumulate(1);
+    }
+  }
+
+  // Drops from the head of `cls` as CoDel sees fit, leaving the element to
+  // be dequeued at the head.
+  void runCoDel(ClassState& cls, Time now) {
+    bool aboveTarget = isAboveTarget(cls, now);
+
+    if (cls.dropping) {
+      if (!aboveTarget) {
+        cls.dropping = false;
+        return;
+      }
+
+      while (now >= cls.dropNext && cls.dropping) {
+        drop(cls);
+        cls.count++;
+        if (!isAboveTarget(cls, now)) {
+          cls.dropping = false;
+        } else {
+          cls.dropNext = getNextDropTime(cls.dropNext, cls.count);
+        }
+      }
+      return;
+    }
+
+    if (!aboveTarget) {
+      return;
+    }
+
+    drop(cls);
+    isAboveTarget(cls, now);
+    cls.dropping = true;
+
+    // Picks up where the last dropping state left off, if it was recent
+    size_t delta = cls.count - cls.lastCount;
+    if (delta > 1 && now - cls.dropNext < 16 * kPriorityFIFOCoDelInterval) {
+      cls.count = delta;
+    } else {
+      cls.count = 1;
+    }
+    cls.dropNext = getNextDropTime(now, cls.count);
+    cls.lastCount = cls.count;
+  }
+
+  void updateConditions() {
+    canPush_->set(size_ < capacity_);
+    canPop_->set(size_ > 0);
+  }
+};
+} // namespace event
@@ -15,9 +15,10 @@ namespace event {
 using namespace std::chrono_literals;
 
 TimerManager::Core::Core()
-    : statMinRemainingTimeUSec_{"Timer", "min_remaining_time_usec"},
-      statTimesWaited_{"Timer", "times_waited"}, statTimesStopped_{
-                                                     "Timer", "times_stopped"} {
+    : statRemainingTimeUSec_{"Timer", "remaining_time_usec"},
+      statTimesWaited_{"Timer", "times_waited"},
+      statTimesStopped_{"Timer", "times_stopped"},
+      statSlackUSec_{"Timer", "slack_usec"} {
   struct sigaction sa;
   sa.sa_flags = SA_SIGINFO;
   sa.sa_sigaction = &TimerManager::Core::handleSignal;
@@ -103,7 +104,7 @@ void TimerManager::Core::requestTimeout(Time target) {
       statTimesStopped_.accumulate();
     }
 
-    statMinRemainingTimeUSec_.accumulate(
+    statRemainingTimeUSec_.accumulate(
         std::chrono::duration_cast<std::chrono::microseconds>(remainingTime)
             .count());
   }
@@ -173,15 +174,21 @@ TimerManager::TimerManager(EventLoop& loop) : loop_(loop) {
 
 /* virtual */ void
 TimerManager::prepareConditions(std::vector<Condition*> const& conditions) {
-  TimerManager::Core::getInstance().maskSignal();
+  auto& core = TimerManager::Core::getInstance();
+  core.maskSignal();
 
+  Time now = Timer::getTime();
   while (!targets_.empty() && targets_.back().first <= clock_) {
     TimeoutTrigger fired = targets_.back();
     targets_.pop_back();
     fired.second->fire();
+
+    core.statSlackUSec_.accumulate(
+        std::chrono::duration_cast<std::chrono::microseconds>(now - fired.first)
+            .count());
   }
 
-  TimerManager::Core::getInstance().unmaskSignal();
+  core.unmaskSignal();
 
   updateTimer();
 }
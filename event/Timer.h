@@ -5,7 +5,7 @@
 #include <event/Condition.h>
 
 #include <stats/CountStat.h>
-#include <stats/MinStat.h>
+#include <stats/HistogramStat.h>
 
 #include <signal.h>
 #include <stdint.h>
@@ -53,9 +53,13 @@ private:
     Time masterClock_ = std::numeric_limits<Time>::min();
     Time currentTarget_;
 
-    stats::MinStat<uint64_t> statMinRemainingTimeUSec_;
+    stats::HistogramStat statRemainingTimeUSec_;
     stats::CountStat statTimesWaited_;
     stats::CountStat statTimesStopped_;
+    // How late timers fire past their targets
+    stats::HistogramStat statSlackUSec_;
+
+    friend class TimerManager;
   };
 
   void handleTimeout(Time target);
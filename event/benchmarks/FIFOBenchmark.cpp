@@ -0,0 +1,185 @@
+#include <event/EventLoop.h>
+#include <event/FIFO.h>
+
+#include <common/Util.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <thread>
+
+static const size_t kBenchmarkCapacity = 256;
+static const size_t kBenchmarkCount = 10000000;
+static const size_t kBenchmarkBatchSize = 32;
+
+// What event::FIFO used to be, kept around to compare against
+template <typename T> class DequeFIFO {
+public:
+  DequeFIFO(event::EventLoop& loop, std::size_t capacity)
+      : capacity_(capacity), canPush_(loop.createBaseCondition()),
+        canPop_(loop.createBaseCondition()) {
+    updateConditions();
+  }
+
+  event::Condition* canPush() const { return canPush_.get(); }
+  event::Condition* canPop() const { return canPop_.get(); }
+
+  void push(T&& element) {
+    if (queue_.size() >= capacity_) {
+      throw std::runtime_error("Trying to push into a full FIFO.");
+    }
+
+    queue_.push(std::move(element));
+    updateConditions();
+  }
+
+  T pop() {
+    if (queue_.size() == 0) {
+      throw std::runtime_error("Trying to pop from an empty FIFO.");
+    }
+
+    T result(std::move(queue_.front()));
+    queue_.pop();
+    updateConditions();
+    return result;
+  }
+
+private:
+  std::size_t capacity_;
+  std::queue<T> queue_;
+
+  std::unique_ptr<event::BaseCondition> canPush_;
+  std::unique_ptr<event::BaseCondition> canPop_;
+
+  void updateConditions() {
+    canPush_->set(queue_.size() < capacity_);
+    canPop_->set(queue_.size() > 0);
+  }
+};
+
+// Roughly the size of what goes through the DataPipe FIFOs
+struct Element {
+  Element() = default;
+  Element(size_t value) : value(value) {}
+
+  size_t value = 0;
+  void* data = nullptr;
+  size_t capacity = 0;
+  size_t size = 0;
+};
+
+static double getMillionsPerSecond(std::chrono::steady_clock::duration time) {
+  return kBenchmarkCount / std::chrono::duration<double>(time).count() / 1e6;
+}
+
+static void report(char const* name, std::chrono::steady_clock::duration time,
+                   size_t checksum) {
+  std::cout << std::setw(24) << name << std::setw(12)
+            << getMillionsPerSecond(time) << std::setw(24) << checksum
+            << std::endl;
+}
+
+// Fills the FIFO up halfway and then drains it, over and over, as the
+// DataPipe-s do within one event loop iteration.
+template <typename F> static void benchmarkSingle(char const* name) {
+  event::EventLoop loop;
+  F fifo(loop, kBenchmarkCapacity);
+
+  size_t checksum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < kBenchmarkCount; i += kBenchmarkCapacity / 2) {
+    for (size_t j = 0; j < kBenchmarkCapacity / 2; j++) {
+      fifo.push(Element{i + j});
+    }
+    while (fifo.canPop()->eval()) {
+      checksum += fifo.pop().value;
+    }
+  }
+  report(name, std::chrono::steady_clock::now() - start, checksum);
+}
+
+static void benchmarkBatched() {
+  event::EventLoop loop;
+  event::FIFO<Element> fifo(loop, kBenchmarkCapacity);
+
+  Element input[kBenchmarkBatchSize];
+  Element output[kBenchmarkBatchSize];
+
+  size_t checksum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < kBenchmarkCount; i += kBenchmarkBatchSize) {
+    for (size_t j = 0; j < kBenchmarkBatchSize; j++) {
+      input[j].value = i + j;
+    }
+    fifo.pushN(input, kBenchmarkBatchSize);
+
+    size_t count = fifo.popN(output, kBenchmarkBatchSize);
+    for (size_t j = 0; j < count; j++) {
+      checksum += output[j].value;
+    }
+  }
+  report("FIFO (pushN/popN)", std::chrono::steady_clock::now() - start,
+         checksum);
+}
+
+// Hands elements over from one thread to another, both polling the FIFO
+// directly instead of going through their event loops.
+static void benchmarkSPSC() {
+  event::EventLoop producerLoop;
+  event::EventLoop consumerLoop;
+  event::FIFO<Element> fifo(producerLoop, consumerLoop, kBenchmarkCapacity);
+
+  auto start = std::chrono::steady_clock::now();
+  auto producer = std::thread([&fifo]() {
+    Element batch[kBenchmarkBatchSize];
+    size_t next = 0;
+    while (next < kBenchmarkCount) {
+      size_t count = std::min(kBenchmarkBatchSize, kBenchmarkCount - next);
+      for (size_t j = 0; j < count; j++) {
+        batch[j].value = next + j;
+      }
+      size_t pushed = fifo.pushN(batch, count);
+      if (pushed == 0) {
+        std::this_thread::yield();
+      }
+      next += pushed;
+    }
+  });
+
+  Element batch[kBenchmarkBatchSize];
+  size_t received = 0;
+  size_t checksum = 0;
+  while (received < kBenchmarkCount) {
+    size_t count = fifo.popN(batch, kBenchmarkBatchSize);
+    if (count == 0) {
+      std::this_thread::yield();
+    }
+    for (size_t j = 0; j < count; j++) {
+      checksum += batch[j].value;
+    }
+    received += count;
+  }
+  producer.join();
+
+  report("FIFO (SPSC, 2 threads)", std::chrono::steady_clock::now() - start,
+         checksum);
+}
+
+int main(int argc, char* argv[]) {
+  common::Logger::getDefault().setLoggingThreshold(common::LogLevel::ERROR);
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << kBenchmarkCount << " elements through a FIFO of "
+            << kBenchmarkCapacity << std::endl;
+  std::cout << std::setw(24) << "" << std::setw(12) << "M/s" << std::setw(24)
+            << "checksum" << std::endl;
+
+  benchmarkSingle<DequeFIFO<Element>>("std::queue (old)");
+  benchmarkSingle<event::FIFO<Element>>("FIFO");
+  benchmarkBatched();
+  benchmarkSPSC();
+
+  return 0;
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+
+#include "TestUtils.h"
+
+#include <event/Action.h>
+#include <event/EventLoop.h>
+#include <event/FIFO.h>
+
+#include <memory>
+#include <thread>
+
+TEST(FIFOTests, PushPopInOrder) {
+  event::EventLoop loop;
+  event::FIFO<int> fifo(loop, 3);
+
+  ASSERT_TRUE(fifo.canPush()->eval()) << "Empty FIFO should accept pushes.";
+  ASSERT_FALSE(fifo.canPop()->eval()) << "Empty FIFO should not be poppable.";
+
+  // Goes around the ring a few times
+  for (int i = 0; i < 10; i++) {
+    fifo.push(2 * i);
+    fifo.push(2 * i + 1);
+    ASSERT_TRUE(fifo.canPop()->eval()) << "FIFO should be poppable.";
+    ASSERT_EQ(fifo.front(), 2 * i);
+    ASSERT_EQ(fifo.pop(), 2 * i);
+    ASSERT_EQ(fifo.pop(), 2 * i + 1);
+    ASSERT_FALSE(fifo.canPop()->eval()) << "FIFO should be empty again.";
+  }
+}
+
+TEST(FIFOTests, Capacity) {
+  event::EventLoop loop;
+  // Not a power of two, which the ring rounds up to internally
+  event::FIFO<int> fifo(loop, 3);
+
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(fifo.canPush()->eval()) << "FIFO should not be full yet.";
+    fifo.push(int(i));
+  }
+  ASSERT_FALSE(fifo.canPush()->eval()) << "FIFO should be full.";
+  ASSERT_THROW(fifo.push(3), std::runtime_error);
+
+  fifo.pop();
+  ASSERT_TRUE(fifo.canPush()->eval()) << "FIFO should have room again.";
+}
+
+TEST(FIFOTests, PushNPopN) {
+  event::EventLoop loop;
+  event::FIFO<std::unique_ptr<int>> fifo(loop, 4);
+
+  std::unique_ptr<int> input[6];
+  for (int i = 0; i < 6; i++) {
+    input[i].reset(new int(i));
+  }
+
+  ASSERT_EQ(fifo.pushN(input, 6), 4) << "Only 4 should fit.";
+  ASSERT_FALSE(fifo.canPush()->eval()) << "FIFO should be full.";
+
+  std::unique_ptr<int> output[6];
+  ASSERT_EQ(fifo.popN(output, 3), 3);
+  ASSERT_EQ(fifo.pushN(input + 4, 2), 2);
+  ASSERT_EQ(fifo.popN(output + 3, 6), 3) << "Only 3 should be left.";
+  ASSERT_FALSE(fifo.canPop()->eval()) << "FIFO should be empty.";
+
+  for (int i = 0; i < 6; i++) {
+    ASSERT_EQ(*output[i], i);
+  }
+}
+
+TEST(FIFOTests, DestroysLeftovers) {
+  auto counter = std::make_shared<int>(0);
+
+  {
+    event::EventLoop loop;
+    event::FIFO<std::shared_ptr<int>> fifo(loop, 8);
+    for (int i = 0; i < 5; i++) {
+      fifo.push(std::shared_ptr<int>(counter));
+    }
+    fifo.pop();
+    ASSERT_EQ(counter.use_count(), 5);
+  }
+
+  ASSERT_EQ(counter.use_count(), 1) << "Elements left should be destroyed.";
+}
+
+// Moves numbers from a producer thread to a consumer thread, each running its
+// own EventLoop.
+TEST(FIFOTests, SPSCAcrossThreads) {
+  static const int kCount = 10000;
+
+  event::EventLoop producerLoop;
+  event::EventLoop consumerLoop;
+  event::FIFO<int> fifo(producerLoop, consumerLoop, 256);
+
+  int next = 0;
+  auto producer = producerLoop.createAction("", {fifo.canPush()});
+  producer->callback = [&fifo, &next]() {
+    while (next < kCount && fifo.canPush()->eval()) {
+      int batch[16];
+      int count = 0;
+      while (count < 16 && next + count < kCount) {
+        batch[count] = next + count;
+        count++;
+      }
+      next += fifo.pushN(batch, count);
+    }
+  };
+
+  auto producerThread = std::thread([&producerLoop, &next]() {
+    while (next < kCount) {
+      producerLoop.runOnce();
+    }
+  });
+
+  int expected = 0;
+  bool inOrder = true;
+  auto consumer = consumerLoop.createAction("", {fifo.canPop()});
+  consumer->callback = [&fifo, &expected, &inOrder]() {
+    while (fifo.canPop()->eval()) {
+      inOrder = inOrder && (fifo.pop() == expected++);
+    }
+  };
+
+  while (expected < kCount) {
+    consumerLoop.runOnce();
+  }
+  producerThread.join();
+
+  ASSERT_TRUE(inOrder) << "Elements should arrive in order.";
+  ASSERT_EQ(fifo.size(), 0);
+}
@@ -0,0 +1,163 @@
+#include <gtest/gtest.h>
+
+#include "TestUtils.h"
+
+#include <event/EventLoop.h>
+#include <event/PriorityFIFO.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using Class = event::PriorityFIFO<int>::Class;
+
+TEST(PriorityFIFOTests, StrictPriority) {
+  event::EventLoop loop;
+  event::PriorityFIFO<int> fifo(
+      loop, 16, {Class{true, 1}, Class{true, 1}, Class{false, 1}}, 2, false);
+
+  fifo.push(20, 2, 1);
+  fifo.push(10, 1, 1);
+  fifo.push(0, 0, 1);
+  fifo.push(21);
+  fifo.push(11, 1, 1);
+  fifo.push(1, 0, 1);
+  // Out of range, so goes to the default class
+  fifo.push(22, 7, 1);
+
+  ASSERT_EQ(fifo.getDepth(0), 2u);
+  ASSERT_EQ(fifo.getDepth(1), 2u);
+  ASSERT_EQ(fifo.getDepth(2), 3u);
+
+  // Strict classes go first, in order, and each class is a FIFO
+  for (int expected : {0, 1, 10, 11, 20, 21, 22}) {
+    ASSERT_TRUE(fifo.canPop()->eval()) << "PriorityFIFO should be poppable.";
+    ASSERT_EQ(fifo.pop(), expected);
+  }
+  ASSERT_FALSE(fifo.canPop()->eval()) << "PriorityFIFO should be empty.";
+}
+
+TEST(PriorityFIFOTests, Capacity) {
+  event::EventLoop loop;
+  event::PriorityFIFO<int> fifo(loop, 3, {Class{true, 1}, Class{false, 1}}, 1,
+                                false);
+
+  // Shared between the classes
+  fifo.push(0, 0, 1);
+  fifo.push(1, 1, 1);
+  fifo.push(2, 1, 1);
+  ASSERT_FALSE(fifo.canPush()->eval()) << "PriorityFIFO should be full.";
+  ASSERT_THROW(fifo.push(3, 0, 1), std::runtime_error);
+
+  fifo.pop();
+  ASSERT_TRUE(fifo.canPush()->eval()) << "PriorityFIFO should have room.";
+}
+
+TEST(PriorityFIFOTests, DeficitRoundRobin) {
+  event::EventLoop loop;
+  event::PriorityFIFO<int> fifo(loop, 32, {Class{false, 300}, Class{false, 100}},
+                                0, false);
+
+  for (int i = 0; i < 8; i++) {
+    fifo.push(int(i), 0, 100);
+    fifo.push(100 + i, 1, 100);
+  }
+
+  // Class 0 gets three times the share of class 1
+  std::vector<int> expected = {0, 1, 2, 100, 3, 4, 5, 101, 6, 7, 102};
+  for (int element : expected) {
+    ASSERT_EQ(fifo.pop(), element);
+  }
+
+  // Once class 0 runs dry, class 1 gets everything
+  for (int i = 3; i < 8; i++) {
+    ASSERT_EQ(fifo.pop(), 100 + i);
+  }
+  ASSERT_FALSE(fifo.canPop()->eval()) << "PriorityFIFO should be empty.";
+}
+
+TEST(PriorityFIFOTests, DeficitCarriesOver) {
+  event::EventLoop loop;
+  event::PriorityFIFO<int> fifo(loop, 32, {Class{false, 100}, Class{false, 100}},
+                                0, false);
+
+  // Too big for a single round, so class 0 has to save up for it
+  fifo.push(0, 0, 250);
+  for (int i = 0; i < 4; i++) {
+    fifo.push(100 + i, 1, 100);
+  }
+
+  std::vector<int> expected = {100, 101, 0, 102, 103};
+  for (int element : expected) {
+    ASSERT_EQ(fifo.pop(), element);
+  }
+}
+
+TEST(PriorityFIFOTests, CoDelDrops) {
+  event::EventLoop loop;
+  event::PriorityFIFO<int> fifo(loop, 16, {Class{false, 1}}, 0, true);
+
+  for (int i = 0; i < 10; i++) {
+    fifo.push(int(i));
+  }
+
+  // Above the target, but not for a whole interval yet
+  std::this_thread::sleep_for(2 * event::kPriorityFIFOCoDelTarget);
+  ASSERT_EQ(fifo.pop(), 0) << "Nothing should be dropped yet.";
+
+  std::this_thread::sleep_for(event::kPriorityFIFOCoDelInterval +
+                              event::kPriorityFIFOCoDelTarget);
+  ASSERT_EQ(fifo.pop(), 2) << "Head should be dropped.";
+  ASSERT_EQ(fifo.getDepth(0), 7u);
+
+  // Drops faster and faster while the queue stays, but never the last one
+  std::this_thread::sleep_for(5 * event::kPriorityFIFOCoDelInterval);
+  ASSERT_EQ(fifo.pop(), 9) << "All but the last should be dropped.";
+  ASSERT_FALSE(fifo.canPop()->eval()) << "PriorityFIFO should be empty.";
+}
+
+TEST(PriorityFIFOTests, CoDelKeepsLastElement) {
+  event::EventLoop loop;
+  event::PriorityFIFO<int> fifo(loop, 16, {Class{false, 1}}, 0, true);
+
+  fifo.push(0);
+  std::this_thread::sleep_for(event::kPriorityFIFOCoDelInterval +
+                              2 * event::kPriorityFIFOCoDelTarget);
+  ASSERT_EQ(fifo.pop(), 0) << "Last element should never be dropped.";
+}
+
+TEST(PriorityFIFOTests, NoCoDel) {
+  event::EventLoop loop;
+  event::PriorityFIFO<int> fifo(loop, 16, {Class{false, 1}}, 0, false);
+
+  for (int i = 0; i < 3; i++) {
+    fifo.push(int(i));
+  }
+
+  std::this_thread::sleep_for(event::kPriorityFIFOCoDelInterval +
+                              2 * event::kPriorityFIFOCoDelTarget);
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(fifo.pop(), i) << "Nothing should be dropped without CoDel.";
+  }
+}
+
+TEST(PriorityFIFOTests, SingleClass) {
+  event::EventLoop loop;
+  event::PriorityFIFO<int> fifo(loop, 3);
+
+  ASSERT_EQ(fifo.getClassCount(), 1u);
+  ASSERT_FALSE(fifo.canPop()->eval()) << "Empty FIFO should not be poppable.";
+
+  // Classes and costs are ignored
+  fifo.push(0, 2, 100);
+  fifo.push(1);
+  fifo.push(2, 0, 1);
+  ASSERT_EQ(fifo.getDepth(0), 3u);
+  ASSERT_FALSE(fifo.canPush()->eval()) << "FIFO should be full.";
+  ASSERT_THROW(fifo.push(3), std::runtime_error);
+
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(fifo.pop(), i);
+  }
+  ASSERT_FALSE(fifo.canPop()->eval()) << "FIFO should be empty again.";
+}
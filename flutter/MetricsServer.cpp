@@ -0,0 +1,420 @@
+#include "flutter/MetricsServer.h"
+
+#include <common/Logger.h>
+#include <common/Util.h>
+#include <event/Trigger.h>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <map>
+#include <string_view>
+
+namespace flutter {
+
+using namespace std::chrono_literals;
+
+// How much of the body is rendered ahead of each write
+static const size_t kMetricsServerChunkSize = 16 * 1024;
+// Requests (up to the end of the headers) longer than this are turned down
+static const size_t kMetricsServerMaxRequestSize = 4096;
+// Sessions that neither send nor take any bytes for this long are closed
+static const event::Duration kMetricsServerIdleTimeout = 10s;
+
+static const char* kMetricsServerContentType =
+    "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+struct MetricsServer::Exposition {
+  struct Series {
+    // The "# TYPE" line for the first series of each family, empty otherwise
+    std::string header;
+    // Everything up to the value, e.g. `stun_connection_rtt{quantile="0.5"} `
+    std::string prefix;
+    // Where the value is in the collected data
+    size_t index;
+  };
+
+  uint64_t generation;
+  std::vector<stats::StatKey> keys;
+  std::vector<Series> series;
+};
+
+// Names may only have letters, digits and underscores, and go by snake case.
+static std::string sanitizeName(std::string name) {
+  for (auto& c : name) {
+    c = (std::isalnum(static_cast<unsigned char>(c)) ? std::tolower(c) : '_');
+  }
+  return name;
+}
+
+static void appendLabel(std::string& output, std::string const& name,
+                        std::string const& value) {
+  output += sanitizeName(name);
+  output += "=\"";
+  for (char c : value) {
+    switch (c) {
+    case '\\':
+      output += "\\\\";
+      break;
+    case '"':
+      output += "\\\"";
+      break;
+    case '\n':
+      output += "\\n";
+      break;
+    default:
+      output += c;
+    }
+  }
+  output += "\"";
+}
+
+static void appendValue(std::string& output, double value) {
+  if (std::isnan(value)) {
+    output += "NaN";
+  } else if (std::isinf(value)) {
+    output += (value > 0 ? "+Inf" : "-Inf");
+  } else {
+    char buffer[32];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    output.append(buffer, result.ptr);
+  }
+}
+
+// `quantile` is null for series outside of a summary.
+static std::string formatSeries(std::string const& name,
+                                stats::Labels const& labels,
+                                double const* quantile) {
+  std::string series = name;
+
+  if (!labels.empty() || quantile != nullptr) {
+    series += "{";
+    for (size_t i = 0; i < labels.size(); i++) {
+      if (i != 0) {
+        series += ",";
+      }
+      appendLabel(series, labels[i].first, labels[i].second);
+    }
+    if (quantile != nullptr) {
+      if (!labels.empty()) {
+        series += ",";
+      }
+      std::string value;
+      appendValue(value, *quantile);
+      appendLabel(series, "quantile", value);
+    }
+    series += "}";
+  }
+
+  series += " ";
+  return series;
+}
+
+class MetricsServer::Session {
+public:
+  Session(event::EventLoop& loop, std::unique_ptr<networking::TCPSocket> client,
+          MetricsServer* server)
+      : server_(server), socket_(std::move(client)),
+        isReading_(loop.createBaseCondition()),
+        isWriting_(loop.createBaseCondition()),
+        didEnd_(loop.createBaseCondition()) {
+    reader_ = loop.createAction("flutter::MetricsServer::Session::reader_",
+                                {socket_->canRead(), isReading_.get()});
+    reader_->callback.setMethod<Session, &Session::doRead>(this);
+    writer_ = loop.createAction("flutter::MetricsServer::Session::writer_",
+                                {socket_->canWrite(), isWriting_.get()});
+    writer_->callback.setMethod<Session, &Session::doWrite>(this);
+
+    idleTimer_ = loop.createTimer(kMetricsServerIdleTimeout);
+    idleKiller_ = loop.createAction(
+        "flutter::MetricsServer::Session::idleKiller_", {idleTimer_->didFire()});
+    idleKiller_->callback.setMethod<Session, &Session::doTimeout>(this);
+
+    output_.reserve(2 * kMetricsServerChunkSize);
+    isReading_->fire();
+  }
+
+  event::Condition* didEnd() const { return didEnd_.get(); }
+
+private:
+  MetricsServer* server_;
+
+  std::unique_ptr<networking::TCPSocket> socket_;
+  std::unique_ptr<event::BaseCondition> isReading_;
+  std::unique_ptr<event::BaseCondition> isWriting_;
+  std::unique_ptr<event::BaseCondition> didEnd_;
+  std::unique_ptr<event::Action> reader_;
+  std::unique_ptr<event::Action> writer_;
+  std::unique_ptr<event::Timer> idleTimer_;
+  std::unique_ptr<event::Action> idleKiller_;
+
+  Byte request_[kMetricsServerMaxRequestSize];
+  size_t requestSize_ = 0;
+
+  // What this scrape renders, as of when it started
+  std::shared_ptr<Exposition const> exposition_;
+  std::shared_ptr<std::vector<double> const> values_;
+  size_t nextSeries_ = 0;
+  bool isComplete_ = false;
+
+  // The chunk being written, and how much of it is written already
+  std::string output_;
+  size_t written_ = 0;
+
+  void doRead() {
+    size_t bytesRead;
+    try {
+      bytesRead = socket_->read(request_ + requestSize_,
+                                kMetricsServerMaxRequestSize - requestSize_);
+    } catch (networking::SocketClosedException const& ex) {
+      LOG_V("Metrics") << "While reading: " << ex.what() << std::endl;
+      end();
+      return;
+    }
+
+    if (bytesRead == 0) {
+      return;
+    }
+    requestSize_ += bytesRead;
+    idleTimer_->reset(kMetricsServerIdleTimeout);
+
+    auto request =
+        std::string_view(reinterpret_cast<char*>(request_), requestSize_);
+    if (request.find("\r\n\r\n") == std::string_view::npos) {
+      if (requestSize_ == kMetricsServerMaxRequestSize) {
+        respond("400 Bad Request");
+      }
+      return;
+    }
+
+    // Only the request line matters, e.g. "GET /metrics HTTP/1.1"
+    auto line = request.substr(0, request.find("\r\n"));
+    auto methodEnd = line.find(' ');
+    auto targetEnd = line.find(' ', methodEnd + 1);
+    if (methodEnd == std::string_view::npos ||
+        targetEnd == std::string_view::npos) {
+      respond("400 Bad Request");
+      return;
+    }
+
+    auto method = line.substr(0, methodEnd);
+    auto target = line.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+    auto path = target.substr(0, target.find('?'));
+
+    LOG_V("Metrics") << "Serving " << method << " " << target << std::endl;
+
+    if (method != "GET") {
+      respond("405 Method Not Allowed");
+    } else if (path != "/metrics") {
+      respond("404 Not Found");
+    } else {
+      exposition_ = server_->exposition_;
+      values_ = server_->values_;
+      respond("200 OK", kMetricsServerContentType);
+    }
+  }
+
+  // Starts writing the response with the given status. With a content type,
+  // the exposition follows as its body, rendered as the headers get written.
+  void respond(std::string const& status, char const* contentType = nullptr) {
+    output_ = "HTTP/1.1 " + status + "\r\nConnection: close\r\n";
+    output_ += (contentType == nullptr
+                    ? std::string("Content-Length: 0\r\n")
+                    : std::string("Content-Type: ") + contentType + "\r\n");
+    output_ += "\r\n";
+    written_ = 0;
+    isComplete_ = (contentType == nullptr);
+
+    isReading_->arm();
+    isWriting_->fire();
+  }
+
+  // Renders the next chunk of series into output_, and the end of the body
+  // after the last one. Leaves output_ empty once there's nothing left.
+  void render() {
+    output_.clear();
+    written_ = 0;
+
+    if (isComplete_) {
+      return;
+    }
+
+    if (!!exposition_) {
+      auto const& series = exposition_->series;
+      auto const& values = *values_;
+
+      while (nextSeries_ < series.size() &&
+             output_.size() < kMetricsServerChunkSize) {
+        auto const& next = series[nextSeries_++];
+        output_ += next.header;
+        output_ += next.prefix;
+        appendValue(output_, values[next.index]);
+        output_ += "\n";
+      }
+
+      if (nextSeries_ < series.size()) {
+        return;
+      }
+    }
+
+    output_ += "# EOF\n";
+    isComplete_ = true;
+  }
+
+  void doWrite() {
+    if (written_ == output_.size()) {
+      render();
+      if (output_.empty()) {
+        end();
+        return;
+      }
+    }
+
+    size_t bytesWritten;
+    try {
+      bytesWritten =
+          socket_->write(reinterpret_cast<Byte*>(&output_[written_]),
+                         output_.size() - written_);
+    } catch (networking::SocketClosedException const& ex) {
+      LOG_V("Metrics") << "While writing: " << ex.what() << std::endl;
+      end();
+      return;
+    }
+
+    if (bytesWritten > 0) {
+      written_ += bytesWritten;
+      idleTimer_->reset(kMetricsServerIdleTimeout);
+    }
+  }
+
+  void doTimeout() {
+    LOG_V("Metrics") << "Closing an idle session." << std::endl;
+    idleTimer_->reset();
+    end();
+  }
+
+  void end() {
+    isReading_->arm();
+    isWriting_->arm();
+    didEnd_->fire();
+  }
+
+private:
+  Session(Session const& copy) = delete;
+  Session& operator=(Session const& copy) = delete;
+
+  Session(Session&& move) = delete;
+  Session& operator=(Session&& move) = delete;
+};
+
+/* static */ std::shared_ptr<MetricsServer::Exposition const>
+MetricsServer::buildExposition(stats::StatsManager::SubscribeData const& data,
+                               uint64_t generation) {
+  struct Family {
+    bool isSummary;
+    std::vector<Exposition::Series> series;
+  };
+
+  auto exposition = std::make_shared<Exposition>();
+  exposition->generation = generation;
+  exposition->keys.reserve(data.size());
+
+  std::map<std::string, Family> families;
+
+  for (size_t i = 0; i < data.size(); i++) {
+    exposition->keys.push_back(data[i].first);
+
+    auto info = stats::StatsManager::describe(data[i].first);
+    if (info.metric.empty()) {
+      // Its labels went away since the collection.
+      continue;
+    }
+
+    auto name = sanitizeName(
+        "stun_" + info.entity + "_" +
+        (!info.quantile ? info.metric : info.quantile->first));
+    auto quantile = (!info.quantile ? nullptr : &info.quantile->second);
+
+    auto& family = families[name];
+    family.isSummary = !!info.quantile;
+    family.series.push_back(Exposition::Series{
+        "", formatSeries(name, info.labels, quantile), i});
+  }
+
+  exposition->series.reserve(data.size());
+  for (auto& family : families) {
+    auto& series = family.second.series;
+
+    // Keeps the quantiles of each summary together, as they only differ in
+    // the label that comes last.
+    std::sort(series.begin(), series.end(), [](auto const& a, auto const& b) {
+      return a.prefix < b.prefix;
+    });
+    auto type = (family.second.isSummary ? "summary" : "gauge");
+    series.front().header = "# TYPE " + family.first + " " + type + "\n";
+
+    std::move(series.begin(), series.end(),
+              std::back_inserter(exposition->series));
+  }
+
+  return exposition;
+}
+
+MetricsServer::MetricsServer(event::EventLoop& loop, MetricsServerConfig config)
+    : loop_(loop) {
+  socket_.reset(new networking::TCPServer(loop, networking::NetworkType::IPv4));
+  socket_->bind(config.port);
+
+  acceptor_ = loop.createAction("flutter::MetricsServer::acceptor_",
+                                {socket_->canAccept()});
+  acceptor_->callback.setMethod<MetricsServer, &MetricsServer::doAccept>(this);
+
+  stats::StatsManager::subscribe([this](auto const& data) { update(data); });
+
+  LOG_I("Metrics") << "Metrics server listening on port " << config.port
+                   << std::endl;
+}
+
+MetricsServer::~MetricsServer() = default;
+
+void MetricsServer::update(stats::StatsManager::SubscribeData const& data) {
+  auto generation = stats::StatsManager::getGeneration();
+
+  bool isStale = !exposition_ || exposition_->generation != generation ||
+                 !std::equal(exposition_->keys.begin(), exposition_->keys.end(),
+                             data.begin(), data.end(),
+                             [](stats::StatKey key, auto const& entry) {
+                               return key == entry.first;
+                             });
+  if (isStale) {
+    exposition_ = buildExposition(data, generation);
+  }
+
+  // Scrapes in progress keep the values they started with.
+  if (!values_ || values_.use_count() > 1) {
+    values_ = std::make_shared<std::vector<double>>();
+  }
+  values_->resize(data.size());
+  for (size_t i = 0; i < data.size(); i++) {
+    (*values_)[i] = data[i].second;
+  }
+}
+
+void MetricsServer::doAccept() {
+  auto client = std::make_unique<networking::TCPSocket>(socket_->accept());
+  sessions_.emplace_back(new Session(loop_, std::move(client), this));
+
+  loop_.arm("flutter::MetricsServer::removeSessionTrigger",
+            {sessions_.back()->didEnd()},
+            [session = sessions_.back().get(), this]() {
+              auto it = std::find_if(
+                  sessions_.begin(), sessions_.end(),
+                  [session](auto const& ptr) { return ptr.get() == session; });
+
+              assertTrue(it != sessions_.end(),
+                         "Cannot find metrics server session to remove.");
+              sessions_.erase(it);
+            });
+}
+} // namespace flutter
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <event/Action.h>
+#include <networking/TCPServer.h>
+#include <stats/StatsManager.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace flutter {
+
+struct MetricsServerConfig {
+public:
+  int port;
+};
+
+// Serves the most recently collected stats over HTTP in the OpenMetrics text
+// format, for e.g. Prometheus to scrape from GET /metrics.
+//
+// The names of the series are rendered once per change in the set of keys,
+// and each scrape renders its values a chunk at a time as the socket becomes
+// writable, so that a large scrape doesn't hold up the rest of the event loop.
+class MetricsServer {
+public:
+  MetricsServer(event::EventLoop& loop, MetricsServerConfig config);
+  ~MetricsServer();
+
+private:
+  event::EventLoop& loop_;
+
+  std::unique_ptr<networking::TCPServer> socket_;
+  std::unique_ptr<event::Action> acceptor_;
+
+  // The series of the last collection, grouped into families
+  struct Exposition;
+  std::shared_ptr<Exposition const> exposition_;
+  // Values of the last collection, in the order of the collected data. Scrapes
+  // in progress hold on to the ones they started with.
+  std::shared_ptr<std::vector<double>> values_;
+
+  class Session;
+  std::vector<std::unique_ptr<Session>> sessions_;
+
+  // Groups the collected keys into families: the percentiles of each
+  // histogram become a summary, and everything else a gauge of its own.
+  static std::shared_ptr<Exposition const>
+  buildExposition(stats::StatsManager::SubscribeData const& data,
+                  uint64_t generation);
+
+  void doAccept();
+  void update(stats::StatsManager::SubscribeData const& data);
+
+private:
+  MetricsServer(MetricsServer const& copy) = delete;
+  MetricsServer& operator=(MetricsServer const& copy) = delete;
+
+  MetricsServer(MetricsServer&& move) = delete;
+  MetricsServer& operator=(MetricsServer&& move) = delete;
+};
+} // namespace flutter
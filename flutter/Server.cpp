@@ -4,7 +4,7 @@
 
 #include <common/Logger.h>
 #include <event/Trigger.h>
-#include <networking/Messenger.h>
+#include <flutter/StatsStream.h>
 #include <stats/StatsManager.h>
 
 #include <algorithm>
@@ -13,13 +13,38 @@ namespace flutter {
 
 using json = nlohmann::json;
 
+// Parses e.g. {"filter": {"user": "alice"}, "group_by": ["session"]}, where
+// both are optional.
+static stats::LabelQuery parseLabelQuery(json const& body) {
+  auto query = stats::LabelQuery{};
+
+  if (body.find("filter") != body.end()) {
+    for (auto const& label : body["filter"].items()) {
+      query.filter.emplace_back(label.key(),
+                                label.value().get<std::string>());
+    }
+  }
+  if (body.find("group_by") != body.end()) {
+    query.groupBy = body["group_by"].get<std::vector<std::string>>();
+  }
+
+  return query;
+}
+
+// How much a client may fall behind before intervals get skipped for it
+static const size_t kFlutterServerMaxBacklog = 256 * 1024;
+
 class Server::Session {
 public:
   Session(event::EventLoop& loop, std::unique_ptr<networking::TCPSocket> client)
-      : messenger_(new networking::Messenger(loop, std::move(client))),
+      : socket_(std::move(client)), hasOutput_(loop.createBaseCondition()),
         didEnd_(loop.createBaseCondition()) {
-    loop.arm("flutter::Server::Session::messengerDisconnectedTrigger",
-             {messenger_->didDisconnect()}, [this]() { didEnd_->fire(); });
+    reader_ = loop.createAction("flutter::Server::Session::reader_",
+                                {socket_->canRead()});
+    reader_->callback.setMethod<Session, &Session::doRead>(this);
+    writer_ = loop.createAction("flutter::Server::Session::writer_",
+                                {socket_->canWrite(), hasOutput_.get()});
+    writer_->callback.setMethod<Session, &Session::doWrite>(this);
   }
 
   void publish(stats::StatsManager::SubscribeData const& data) {
@@ -27,30 +52,129 @@ public:
       return;
     }
 
-    if (!messenger_->outboundQ->canPush()->eval()) {
-      LOG_I("Flutter") << "Dropping a data message due to full Messenger queue."
+    // Values go out as changes since the ones sent before, so skipping an
+    // interval as a whole doesn't throw the client off.
+    if (output_.size() - written_ > kFlutterServerMaxBacklog) {
+      LOG_I("Flutter") << "Skipping an interval for a client that is behind."
                        << std::endl;
       return;
     }
 
-    json payload = json::array();
+    output_.erase(0, written_);
+    written_ = 0;
 
-    for (auto const& entry : data) {
-      payload.push_back({
-          {"entity", entry.first.first},
-          {"metric", entry.first.second},
-          {"value", entry.second},
-      });
-    }
-
-    messenger_->outboundQ->push(networking::Message("data", payload));
+    encoder_.encode(data, output_);
+    hasOutput_->fire();
   }
 
   event::Condition* didEnd() const { return didEnd_.get(); }
 
 private:
-  std::unique_ptr<networking::Messenger> messenger_;
+  std::unique_ptr<networking::TCPSocket> socket_;
+  std::unique_ptr<event::BaseCondition> hasOutput_;
   std::unique_ptr<event::BaseCondition> didEnd_;
+  std::unique_ptr<event::Action> reader_;
+  std::unique_ptr<event::Action> writer_;
+
+  StatsStreamEncoder encoder_;
+
+  // Frames received, up to the last one that's complete
+  std::string input_;
+  // Frames to send, and how much of them is sent already
+  std::string output_;
+  size_t written_ = 0;
+
+  void doRead() {
+    Byte buffer[kStatsStreamMaxClientFrameSize];
+
+    try {
+      size_t read = socket_->read(buffer, sizeof(buffer));
+      input_.append(reinterpret_cast<char*>(buffer), read);
+    } catch (networking::SocketClosedException const& ex) {
+      LOG_I("Flutter") << "While receiving: " << ex.what() << std::endl;
+      end();
+      return;
+    }
+
+    size_t consumed = 0;
+    while (consumed < input_.length()) {
+      size_t offset = consumed + 1;
+      std::optional<uint64_t> length;
+      try {
+        length = readVarint(input_, offset);
+      } catch (std::runtime_error const& ex) {
+        LOG_I("Flutter") << "Disconnected due to a malformed frame: "
+                         << ex.what() << std::endl;
+        end();
+        return;
+      }
+      if (!length) {
+        break;
+      }
+
+      if (*length > kStatsStreamMaxClientFrameSize) {
+        LOG_I("Flutter") << "Disconnected due to an oversized frame."
+                         << std::endl;
+        end();
+        return;
+      }
+
+      if (input_.length() - offset < *length) {
+        break;
+      }
+
+      auto type = static_cast<FrameType>(input_[consumed]);
+      if (!handleFrame(type, input_.substr(offset, *length))) {
+        end();
+        return;
+      }
+      consumed = offset + *length;
+    }
+
+    input_.erase(0, consumed);
+  }
+
+  // Returns false if the client should be disconnected.
+  bool handleFrame(FrameType type, std::string const& payload) {
+    if (type != FrameType::Query) {
+      // Possibly from a newer client
+      LOG_V("Flutter") << "Ignoring a frame of type " << static_cast<int>(type)
+                       << std::endl;
+      return true;
+    }
+
+    try {
+      encoder_.setQuery(parseLabelQuery(json::parse(payload)));
+    } catch (std::exception const& ex) {
+      LOG_I("Flutter") << "Disconnected due to an invalid query: " << ex.what()
+                       << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  void doWrite() {
+    try {
+      written_ += socket_->write(reinterpret_cast<Byte*>(&output_[written_]),
+                                 output_.size() - written_);
+    } catch (networking::SocketClosedException const& ex) {
+      LOG_I("Flutter") << "While sending: " << ex.what() << std::endl;
+      end();
+      return;
+    }
+
+    if (written_ == output_.size()) {
+      output_.clear();
+      written_ = 0;
+      hasOutput_->arm();
+    }
+  }
+
+  void end() {
+    hasOutput_->arm();
+    didEnd_->fire();
+  }
 
 private:
   Session(Session const& copy) = delete;
@@ -0,0 +1,132 @@
+#include "flutter/StatsStream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace flutter {
+
+// Integers beyond this may not survive the trip through a double
+static const double kStatsStreamMaxExactInteger = 9007199254740992.0; // 2^53
+
+void appendVarint(std::string& output, uint64_t value) {
+  while (value >= 0x80) {
+    output += static_cast<char>((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  output += static_cast<char>(value);
+}
+
+void appendString(std::string& output, std::string const& value) {
+  appendVarint(output, value.length());
+  output += value;
+}
+
+std::optional<uint64_t> readVarint(std::string const& input, size_t& offset) {
+  uint64_t value = 0;
+
+  for (size_t shift = 0; shift < 64; shift += 7) {
+    if (offset >= input.length()) {
+      return std::nullopt;
+    }
+
+    auto byte = static_cast<uint8_t>(input[offset++]);
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+
+  throw std::runtime_error("Varint is longer than 64 bits.");
+}
+
+static bool isExactInteger(double value) {
+  return std::trunc(value) == value &&
+         std::abs(value) < kStatsStreamMaxExactInteger;
+}
+
+void StatsStreamEncoder::setQuery(stats::LabelQuery query) {
+  query_ = std::move(query);
+  generation_ = std::nullopt;
+}
+
+bool StatsStreamEncoder::isSchemaStale(
+    stats::StatsManager::SubscribeData const& data, uint64_t generation) const {
+  return !generation_ || *generation_ != generation ||
+         !std::equal(keys_.begin(), keys_.end(), data.begin(), data.end(),
+                     [](stats::StatKey key, auto const& entry) {
+                       return key == entry.first;
+                     });
+}
+
+void StatsStreamEncoder::encode(stats::StatsManager::SubscribeData const& data,
+                                std::string& output) {
+  auto generation = stats::StatsManager::getGeneration();
+
+  if (isSchemaStale(data, generation)) {
+    generation_ = generation;
+    keys_.resize(data.size());
+    for (size_t i = 0; i < data.size(); i++) {
+      keys_[i] = data[i].first;
+    }
+
+    auto series = stats::StatsManager::group(data, query_, seriesOf_);
+
+    payload_.clear();
+    appendVarint(payload_, series.size());
+    for (auto const& sample : series) {
+      appendString(payload_, sample.entity);
+      appendString(payload_, sample.metric);
+      appendVarint(payload_, sample.labels.size());
+      for (auto const& label : sample.labels) {
+        appendString(payload_, label.first);
+        appendString(payload_, label.second);
+      }
+    }
+    appendFrame(output, FrameType::Schema);
+
+    sent_.assign(series.size(), 0.0);
+  }
+
+  values_.assign(sent_.size(), 0.0);
+  for (size_t i = 0; i < data.size(); i++) {
+    if (!!seriesOf_[i]) {
+      values_[*seriesOf_[i]] += data[i].second;
+    }
+  }
+
+  payload_.clear();
+  appendVarint(payload_, values_.size());
+  for (size_t i = 0; i < values_.size(); i++) {
+    appendValue(sent_[i], values_[i]);
+  }
+  appendFrame(output, FrameType::Data);
+
+  std::swap(sent_, values_);
+}
+
+void StatsStreamEncoder::appendFrame(std::string& output, FrameType type) {
+  output += static_cast<char>(type);
+  appendVarint(output, payload_.length());
+  output += payload_;
+}
+
+void StatsStreamEncoder::appendValue(double previous, double value) {
+  if (isExactInteger(previous) && isExactInteger(value)) {
+    auto delta = static_cast<int64_t>(value) - static_cast<int64_t>(previous);
+    auto zigzag = (static_cast<uint64_t>(delta) << 1) ^
+                  static_cast<uint64_t>(delta >> 63);
+    appendVarint(payload_, zigzag << 1);
+    return;
+  }
+
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  appendVarint(payload_, 1);
+  for (size_t i = 0; i < sizeof(bits); i++) {
+    payload_ += static_cast<char>((bits >> (8 * i)) & 0xFF);
+  }
+}
+} // namespace flutter
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stats/StatsManager.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace flutter {
+
+// The flutter wire format. Both ways, a connection is a sequence of frames,
+// each of which is a one-byte FrameType, the varint length of its payload and
+// then the payload. Varints are unsigned LEB128, and strings are a varint
+// length followed by that many bytes.
+//
+// The server sends:
+//
+//   Schema: the varint number of series, then for each its entity, metric,
+//           varint number of labels, and the name and value of each label.
+//           Every value the client has is reset to 0.
+//   Data:   the varint number of series, then for each the change since the
+//           previous Data (or Schema) as a varint V. With the lowest bit of V
+//           clear, the value is an integer that changed by the zigzag-decoded
+//           V >> 1. With it set, the value is the little-endian IEEE 754
+//           double in the 8 bytes that follow.
+//
+// The client may send:
+//
+//   Query:  a JSON object like {"filter": {"user": "alice"}, "group_by":
+//           ["session"]}, both of which are optional (see stats::LabelQuery).
+//           A new Schema follows with the next Data.
+enum class FrameType : uint8_t {
+  Schema = 1,
+  Data = 2,
+  Query = 3,
+};
+
+// Frames longer than this that a client sends are taken as garbage
+static const size_t kStatsStreamMaxClientFrameSize = 4096;
+
+void appendVarint(std::string& output, uint64_t value);
+void appendString(std::string& output, std::string const& value);
+
+// Reads a varint from `input` at `offset`, and moves `offset` past it. Returns
+// std::nullopt if `input` ends before the varint does, and throws
+// std::runtime_error if the varint runs past 64 bits, in which case no more
+// input can complete it.
+std::optional<uint64_t> readVarint(std::string const& input, size_t& offset);
+
+// Encodes collected stats into the Schema and Data frames of one connection.
+//
+// The schema only goes out when the set of series changes. Otherwise, each
+// collection costs a few bytes per series, and for the ones that didn't
+// change (or changed by less than 64), a single byte.
+class StatsStreamEncoder {
+public:
+  StatsStreamEncoder() = default;
+
+  void setQuery(stats::LabelQuery query);
+
+  // Appends the frames for `data` to `output`.
+  void encode(stats::StatsManager::SubscribeData const& data,
+              std::string& output);
+
+private:
+  stats::LabelQuery query_;
+
+  // What the schema was worked out from, to tell when it has to be redone
+  std::optional<uint64_t> generation_;
+  std::vector<stats::StatKey> keys_;
+  // The series each of the collected keys go into
+  std::vector<std::optional<size_t>> seriesOf_;
+
+  // The last values sent, and the ones being encoded, by series
+  std::vector<double> sent_;
+  std::vector<double> values_;
+
+  std::string payload_;
+
+  bool isSchemaStale(stats::StatsManager::SubscribeData const& data,
+                     uint64_t generation) const;
+  void appendFrame(std::string& output, FrameType type);
+  void appendValue(double previous, double value);
+
+private:
+  StatsStreamEncoder(StatsStreamEncoder const& copy) = delete;
+  StatsStreamEncoder& operator=(StatsStreamEncoder const& copy) = delete;
+
+  StatsStreamEncoder(StatsStreamEncoder&& move) = delete;
+  StatsStreamEncoder& operator=(StatsStreamEncoder&& move) = delete;
+};
+} // namespace flutter
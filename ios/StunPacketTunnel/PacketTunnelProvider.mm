@@ -39,11 +39,11 @@ using namespace std::chrono_literals;
 - (void)doStunEventLoop {
   self.stopped = NO;
 
-  common::Logger::getDefault("").tee = ^(std::string message) {
+  common::Logger::getDefault().tee = ^(std::string message) {
     NSLog(@"%@", @(message.c_str()));
   };
 
-  common::Logger::getDefault("").setLoggingThreshold(common::LogLevel::VERBOSE);
+  common::Logger::getDefault().setLoggingThreshold(common::LogLevel::VERBOSE);
   LOG_I("Loop") << "Starting the stun event loop" << std::endl;
 
   try {
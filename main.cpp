@@ -15,12 +15,14 @@ const bool kGitDirtyStatus = false;
 
 #endif
 
+#include <common/BufferPool.h>
 #include <common/Configerator.h>
 #include <common/Notebook.h>
 #include <common/Util.h>
 #include <event/EventLoop.h>
 #include <event/Timer.h>
 #include <event/Trigger.h>
+#include <flutter/MetricsServer.h>
 #include <flutter/Server.h>
 #include <networking/IPTables.h>
 #include <networking/InterfaceConfig.h>
@@ -151,6 +153,10 @@ cxxopts::ParseResult setupAndParseOptions(int argc, char* argv[]) {
   options.add_option("", "f", "flutter",
                      "Starts a flutter server on given port to export stats.",
                      cxxopts::value<int>()->implicit_value("4999"), "");
+  options.add_option(
+      "", "m", "metrics",
+      "Starts an HTTP server on given port to export stats as OpenMetrics.",
+      cxxopts::value<int>()->implicit_value("5000"), "");
   options.add_option(
       "", "s", "stats",
       "Enable connection stats logging. You "
@@ -180,13 +186,12 @@ cxxopts::ParseResult setupAndParseOptions(int argc, char* argv[]) {
   }
 
   if (arguments.count("very-verbose")) {
-    common::Logger::getDefault("").setLoggingThreshold(
+    common::Logger::getDefault().setLoggingThreshold(
         common::LogLevel::VERY_VERBOSE);
   } else if (arguments.count("verbose")) {
-    common::Logger::getDefault("").setLoggingThreshold(
-        common::LogLevel::VERBOSE);
+    common::Logger::getDefault().setLoggingThreshold(common::LogLevel::VERBOSE);
   } else {
-    common::Logger::getDefault("").setLoggingThreshold(common::LogLevel::INFO);
+    common::Logger::getDefault().setLoggingThreshold(common::LogLevel::INFO);
   }
 
   return arguments;
@@ -227,6 +232,60 @@ std::map<std::string, size_t> parseQuotaTable() {
   return raw;
 }
 
+stun::RateLimiter::Config parseRateLimits() {
+  auto raw = common::Configerator::get<std::map<std::string, double>>(
+      "rate_limits", {});
+  auto userRates = std::map<std::string, size_t>{};
+  for (auto it = raw.begin(); it != raw.end(); it++) {
+    userRates[it->first] =
+        static_cast<size_t>(it->second * 1000 * 1000 / 8 /* Mbps -> B/s */);
+  }
+
+  auto totalRate =
+      common::Configerator::get<double>("total_rate_limit", 0) * 1000 * 1000 /
+      8 /* Mbps -> B/s */;
+
+  return stun::RateLimiter::Config{
+      userRates, static_cast<size_t>(totalRate),
+      std::chrono::milliseconds(
+          common::Configerator::get<size_t>("rate_limit_burst_ms", 100))};
+}
+
+stats::LabelQuery parseStatsQuery() {
+  auto filter = common::Configerator::get<std::map<std::string, std::string>>(
+      "stats_filter", {});
+  auto query =
+      stats::LabelQuery{stats::Labels(filter.begin(), filter.end()), {}};
+
+  if (common::Configerator::hasKey("stats_group_by")) {
+    query.groupBy =
+        common::Configerator::get<std::vector<std::string>>("stats_group_by");
+  }
+  return query;
+}
+
+stun::TCPCoreDataPipe::SocketOptions parseTCPOptions() {
+  return stun::TCPCoreDataPipe::SocketOptions{
+      common::Configerator::get<bool>("tcp_zero_copy", false),
+      common::Configerator::get<size_t>("tcp_send_buffer", 0),
+      common::Configerator::get<size_t>("tcp_receive_buffer", 0),
+      common::Configerator::get<size_t>("tcp_notsent_lowat", 0)};
+}
+
+size_t getCoalescingSize() {
+  auto coalescingSize = common::Configerator::get<size_t>("coalesce_to", 0);
+
+  // Each data pipe further trims this down to what's left after its own
+  // overheads.
+  if (coalescingSize > stun::DataPacket::Size) {
+    throw std::runtime_error("coalesce_to must be at most " +
+                             std::to_string(stun::DataPacket::Size) +
+                             " bytes");
+  }
+
+  return coalescingSize;
+}
+
 std::unique_ptr<stun::Server> setupServer(event::EventLoop& loop,
                                           std::string getServerConfigID) {
   auto config = Server::Config{
@@ -244,7 +303,21 @@ std::unique_ptr<stun::Server> setupServer(event::EventLoop& loop,
       common::Configerator::get<bool>("authentication", false),
       common::Configerator::get<size_t>("mtu",
                                         networking::kTunnelEthernetDefaultMTU),
+      common::Configerator::get<bool>("flow_pinning", false),
+      common::Configerator::get<bool>("header_compression", false),
+      common::Configerator::get<bool>("sequencing", false),
+      std::chrono::milliseconds(
+          common::Configerator::get<size_t>("reorder_budget_ms", 0)),
+      common::Configerator::get<size_t>("fec_group_size", 0),
+      getCoalescingSize(),
+      std::chrono::milliseconds(
+          common::Configerator::get<size_t>("coalesce_delay_ms", 0)),
+      common::Configerator::get<bool>("pacing", false),
+      common::Configerator::get<bool>("priority_queuing", false),
+      common::Configerator::get<size_t>("trace_sample_interval", 0),
+      parseTCPOptions(),
       parseQuotaTable(),
+      parseRateLimits(),
       parseStaticHosts(),
       common::Configerator::get<std::vector<networking::IPAddress>>(
           "dns_pushes", {}),
@@ -283,6 +356,14 @@ std::unique_ptr<stun::Client> setupClient(event::EventLoop& loop) {
       common::Configerator::get<size_t>("mtu",
                                         networking::kTunnelEthernetDefaultMTU),
       common::Configerator::get<bool>("accept_dns_pushes", false),
+      common::Configerator::get<bool>("flow_pinning", false),
+      std::chrono::milliseconds(
+          common::Configerator::get<size_t>("reorder_budget_ms", 0)),
+      std::chrono::milliseconds(
+          common::Configerator::get<size_t>("coalesce_delay_ms", 0)),
+      common::Configerator::get<bool>("priority_queuing", false),
+      common::Configerator::get<size_t>("trace_sample_interval", 0),
+      parseTCPOptions(),
       parseSubnets("forward_subnets"),
       parseSubnets("excluded_subnets"),
       parseSubnets("provided_subnets")};
@@ -303,6 +384,19 @@ setupFlutterServer(event::EventLoop& loop,
   return std::make_unique<flutter::Server>(loop, flutterServerConfig);
 }
 
+std::unique_ptr<flutter::MetricsServer>
+setupMetricsServer(event::EventLoop& loop,
+                   cxxopts::ParseResult const& arguments) {
+  if (arguments.count("metrics") == 0) {
+    return nullptr;
+  }
+
+  auto port = arguments["metrics"].as<int>();
+  auto metricsServerConfig = flutter::MetricsServerConfig{port};
+
+  return std::make_unique<flutter::MetricsServer>(loop, metricsServerConfig);
+}
+
 std::string getServerConfigID(std::string const& configPath) {
   unsigned long hash = 5381;
   for (size_t i = 0; i < configPath.length(); i++) {
@@ -362,16 +456,27 @@ int main(int argc, char* argv[]) {
     statsTimer->extend(statsDumpInerval);
   };
 
-  stats::StatsManager::subscribe([](auto const& data) {
-    stats::StatsManager::dump(LOG_V("Stats"), data);
+  auto statsQuery = parseStatsQuery();
+  stats::StatsManager::subscribe([statsQuery](auto const& data) {
+    if (common::Logger::isEnabled(common::LogLevel::VERBOSE)) {
+      stats::StatsManager::dump(
+          common::Logger::getLine("Stats", common::LogLevel::VERBOSE), data,
+          statsQuery);
+    }
   });
 
   auto flutterServer = setupFlutterServer(loop, arguments);
+  auto metricsServer = setupMetricsServer(loop, arguments);
 
   std::string role = common::Configerator::getString("role");
 
   LOG_I("Main") << "Running as " << role << std::endl;
 
+  auto packetArenaMB = common::Configerator::get<size_t>("packet_arena_mb", 0);
+  if (packetArenaMB != 0) {
+    common::BufferPool::getInstance().reserveArena(packetArenaMB << 20);
+  }
+
   std::unique_ptr<stun::Server> server;
   std::unique_ptr<stun::Client> client;
 
@@ -0,0 +1,69 @@
+#include "networking/FlowKey.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+
+namespace networking {
+
+static const size_t kFlowKeyMinIPv4HeaderSize = 20;
+static const size_t kFlowKeyPortsSize = 4;
+static const uint16_t kFlowKeyFragmentMask = 0x3fff; // MF flag and offset
+
+static uint16_t readUInt16(Byte const* data) {
+  uint16_t value;
+  memcpy(&value, data, sizeof(value));
+  return ntohs(value);
+}
+
+static uint32_t readUInt32(Byte const* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return ntohl(value);
+}
+
+/* static */ std::optional<FlowKey> FlowKey::parse(Byte const* data,
+                                                   size_t size) {
+  if (size < kFlowKeyMinIPv4HeaderSize || (data[0] >> 4) != 4) {
+    return std::nullopt;
+  }
+
+  size_t headerSize = 4 * (data[0] & 0x0f);
+  if (headerSize < kFlowKeyMinIPv4HeaderSize || headerSize > size) {
+    return std::nullopt;
+  }
+
+  FlowKey key;
+  key.protocol = data[9];
+  key.srcAddr = readUInt32(data + 12);
+  key.dstAddr = readUInt32(data + 16);
+  key.srcPort = 0;
+  key.dstPort = 0;
+
+  bool isFragment = (readUInt16(data + 6) & kFlowKeyFragmentMask) != 0;
+  bool hasPorts = (key.protocol == IPPROTO_TCP || key.protocol == IPPROTO_UDP);
+
+  if (hasPorts && !isFragment && size >= headerSize + kFlowKeyPortsSize) {
+    key.srcPort = readUInt16(data + headerSize);
+    key.dstPort = readUInt16(data + headerSize + 2);
+  }
+
+  return key;
+}
+
+uint32_t FlowKey::hash() const {
+  uint32_t result = mix(srcAddr);
+  result = mix(result ^ dstAddr);
+  result = mix(result ^ ((uint32_t{srcPort} << 16) | dstPort));
+  return mix(result ^ protocol);
+}
+
+/* static */ uint32_t FlowKey::mix(uint32_t value) {
+  value ^= value >> 16;
+  value *= 0x85ebca6b;
+  value ^= value >> 13;
+  value *= 0xc2b2ae35;
+  value ^= value >> 16;
+  return value;
+}
+} // namespace networking
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <common/Util.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <optional>
+
+namespace networking {
+
+// Identifies the transport-level flow an IPv4 packet belongs to, using the
+// classic (src addr, dst addr, protocol, src port, dst port) 5-tuple.
+struct FlowKey {
+public:
+  uint32_t srcAddr;
+  uint32_t dstAddr;
+  uint16_t srcPort;
+  uint16_t dstPort;
+  uint8_t protocol;
+
+  // Parses the 5-tuple out of a raw IPv4 packet. Ports are only filled in for
+  // unfragmented TCP and UDP packets, so that all fragments of the same packet
+  // map to the same FlowKey. Returns std::nullopt for non-IPv4 or truncated
+  // packets.
+  static std::optional<FlowKey> parse(Byte const* data, size_t size);
+
+  uint32_t hash() const;
+
+  bool operator==(FlowKey const& other) const {
+    return srcAddr == other.srcAddr && dstAddr == other.dstAddr &&
+           srcPort == other.srcPort && dstPort == other.dstPort &&
+           protocol == other.protocol;
+  }
+
+  // A cheap avalanching 32-bit mixer (the murmur3 finalizer).
+  static uint32_t mix(uint32_t value);
+};
+} // namespace networking
@@ -1,15 +1,16 @@
 #include "networking/IPAddressPool.h"
 
+#include <common/Notebook.h>
 #include <common/Util.h>
 
 #include <arpa/inet.h>
 #include <sys/socket.h>
 
+#include <algorithm>
+
 namespace networking {
 
-IPAddress::IPAddress() {
-  octets[0] = octets[1] = octets[2] = octets[3] = octets[4] = octets[5] = 0;
-}
+IPAddress::IPAddress() {}
 
 /* explicit */ IPAddress::IPAddress(in_addr addr) {
   this->type = NetworkType::IPv4;
@@ -159,52 +160,167 @@ void from_json(json const& j, SubnetAddress& addr) {
   addr = SubnetAddress(j.get<std::string>());
 }
 
-IPAddressPool::IPAddressPool(SubnetAddress const& subnet) : subnet_(subnet) {
-  nextAddr_ = subnet_.firstHostAddress();
+IPAddressPool::IPAddressPool(SubnetAddress const& subnet)
+    : subnet_(subnet), base_(subnet.firstHostAddress().toNumerical() - 1),
+      size_(1ULL << (32 - subnet.prefixLen)) {
+  assertTrue(subnet_.prefixLen >= 8,
+             "Address pool too large: " + subnet_.toString());
+
+  size_t words = (size_ + kBitsPerWord - 1) / kBitsPerWord;
+  used_.assign(words, 0);
+  reserved_.assign(words, 0);
+  stale_.assign(words, 0);
+
+  // The network and broadcast addresses, and whatever is past the end of the
+  // subnet in the last word
+  set(used_, 0, true);
+  set(used_, size_ - 1, true);
+  for (size_t offset = size_; offset < words * kBitsPerWord; offset++) {
+    set(used_, offset, true);
+  }
 }
 
 IPAddress IPAddressPool::acquire() {
-  if (!reusables_.empty()) {
-    auto addr = reusables_.front();
-    reusables_.pop();
+  releaseStaleLeases();
 
-    LOG_V("Address") << "Reusing " << addr << " from the address pool"
-                     << std::endl;
+  for (size_t word = firstFreeWord_; word < used_.size(); word++) {
+    if (used_[word] == ~Word(0)) {
+      continue;
+    }
 
-    return addr;
-  }
+    firstFreeWord_ = word;
 
-  auto addr = IPAddress{};
+    size_t offset = word * kBitsPerWord + __builtin_ctzll(~used_[word]);
+    set(used_, offset, true);
 
-  do {
-    addr = nextAddr_;
-    nextAddr_ = nextAddr_.next();
-  } while (addr != subnet_.broadcastAddress() && (reserved_.count(addr) > 0));
+    auto addr = IPAddress(base_ + offset, IPv4);
+    saveLease(addr, true);
 
-  assertTrue(addr != subnet_.broadcastAddress(), "Ran out of addresses.");
+    LOG_V("Address") << "Using " << addr << " from the address pool"
+                     << std::endl;
 
-  LOG_V("Address") << "Using new address " << addr << " from the address pool"
-                   << std::endl;
+    return addr;
+  }
 
-  return addr;
+  firstFreeWord_ = used_.size();
+  assertTrue(false, "Ran out of addresses.");
+  return IPAddress{};
 }
 
 void IPAddressPool::release(IPAddress const& addr) {
-  auto found = reserved_.find(addr);
-  assertTrue(found == reserved_.end(), "Reserved address " + addr.toString() +
+  auto offset = offsetOf(addr);
+  assertTrue(!test(reserved_, offset), "Reserved address " + addr.toString() +
                                            " released to IPAddressPool.");
+  assertTrue(test(used_, offset),
+             "Address released more than once: " + addr.toString());
 
   LOG_V("Address") << "Releasing " << addr << " to the address pool"
                    << std::endl;
 
-  reusables_.push(addr);
+  set(used_, offset, false);
+  if (test(stale_, offset)) {
+    set(stale_, offset, false);
+    staleCount_--;
+  }
+  firstFreeWord_ = std::min(firstFreeWord_, offset / kBitsPerWord);
+  saveLease(addr, false);
 }
 
 void IPAddressPool::reserve(IPAddress const& addr) {
   assertTrue(subnet_.contains(addr),
              "Trying to reserve out-of-pool address: " + addr.toString());
 
-  auto inserted = reserved_.insert(addr).second;
-  assertTrue(inserted, "Address reserved more than once: " + addr.toString());
+  auto offset = offsetOf(addr);
+  assertTrue(!test(reserved_, offset),
+             "Address reserved more than once: " + addr.toString());
+
+  set(reserved_, offset, true);
+  set(used_, offset, true);
+}
+
+void IPAddressPool::persistLeases(
+    std::string const& key,
+    std::chrono::steady_clock::duration
+        holdFor /* = kIPAddressPoolStaleLeaseTimeout */) {
+  leasesKey_ = key;
+
+  common::Notebook::getInstance().update([this](json& notes) {
+    auto& leases = notes["addressLeases"][leasesKey_];
+    if (!leases.is_object()) {
+      leases = json::object();
+    }
+
+    for (auto const& lease : leases.items()) {
+      auto addr = IPAddress(lease.key(), IPv4);
+      if (!subnet_.contains(addr)) {
+        continue;
+      }
+
+      auto offset = offsetOf(addr);
+      if (test(used_, offset)) {
+        continue;
+      }
+      set(used_, offset, true);
+      set(stale_, offset, true);
+      staleCount_++;
+    }
+  });
+
+  staleDeadline_ = std::chrono::steady_clock::now() + holdFor;
+
+  LOG_I("Address") << "Holding on to " << staleCount_
+                   << " addresses leased before the restart." << std::endl;
+}
+
+size_t IPAddressPool::offsetOf(IPAddress const& addr) const {
+  assertTrue(subnet_.contains(addr),
+             "Out-of-pool address: " + addr.toString());
+  return addr.toNumerical() - base_;
+}
+
+/* static */ bool IPAddressPool::test(std::vector<Word> const& bits,
+                                      size_t offset) {
+  return (bits[offset / kBitsPerWord] >> (offset % kBitsPerWord)) & 1;
+}
+
+/* static */ void IPAddressPool::set(std::vector<Word>& bits, size_t offset,
+                                     bool value) {
+  auto mask = Word(1) << (offset % kBitsPerWord);
+  if (value) {
+    bits[offset / kBitsPerWord] |= mask;
+  } else {
+    bits[offset / kBitsPerWord] &= ~mask;
+  }
+}
+
+void IPAddressPool::saveLease(IPAddress const& addr, bool isLeased) {
+  if (leasesKey_.empty()) {
+    return;
+  }
+
+  common::Notebook::getInstance().update([this, &addr, isLeased](json& notes) {
+    auto& leases = notes["addressLeases"][leasesKey_];
+    if (isLeased) {
+      leases[addr.toString()] = true;
+    } else {
+      leases.erase(addr.toString());
+    }
+  });
+}
+
+void IPAddressPool::releaseStaleLeases() {
+  if (staleCount_ == 0 || std::chrono::steady_clock::now() < staleDeadline_) {
+    return;
+  }
+
+  LOG_I("Address") << "Releasing " << staleCount_
+                   << " addresses leased before the restart." << std::endl;
+
+  for (size_t word = 0; word < stale_.size(); word++) {
+    while (stale_[word] != 0) {
+      size_t offset = word * kBitsPerWord + __builtin_ctzll(stale_[word]);
+      release(IPAddress(base_ + offset, IPv4));
+    }
+  }
 }
 } // namespace networking
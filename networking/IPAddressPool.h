@@ -10,10 +10,10 @@
 #include <netinet/in.h>
 
 #include <array>
+#include <chrono>
 #include <iostream>
-#include <queue>
-#include <set>
 #include <string>
+#include <vector>
 
 namespace networking {
 
@@ -30,7 +30,7 @@ public:
   IPAddress(uint32_t numerical, NetworkType type);
 
   NetworkType type;
-  std::array<Byte, 16> octets;
+  std::array<Byte, 16> octets = {};
 
   std::string toString() const;
   uint32_t toNumerical() const;
@@ -71,6 +71,13 @@ private:
 void to_json(json& j, SubnetAddress const& addr);
 void from_json(json const& j, SubnetAddress& addr);
 
+// Leases saved by a previous run are held for this long after a restart, for
+// the clients that had them to reconnect, and then released.
+static const auto kIPAddressPoolStaleLeaseTimeout = std::chrono::minutes(5);
+
+// Hands out the host addresses of a subnet, keeping track of which are in use
+// with a bitmap. Acquiring scans for the first free address a word at a time,
+// while releasing and reserving are O(1).
 class IPAddressPool {
 public:
   IPAddressPool(SubnetAddress const& subnet);
@@ -79,11 +86,46 @@ public:
   void release(IPAddress const& addr);
   void reserve(IPAddress const& addr);
 
+  // Keeps the addresses in use in the Notebook under `key`, and takes over the
+  // ones saved there by a previous run, holding on to them for `holdFor`.
+  // Should be called after all the reserve()-s.
+  void persistLeases(std::string const& key,
+                     std::chrono::steady_clock::duration holdFor =
+                         kIPAddressPoolStaleLeaseTimeout);
+
 private:
+  using Word = uint64_t;
+  static const size_t kBitsPerWord = 64;
+
   SubnetAddress subnet_;
-  IPAddress nextAddr_;
+  uint32_t base_;
+  size_t size_;
+
+  // One bit for each address in the subnet, set if it's in use (which the
+  // network and broadcast addresses always are), or reserved
+  std::vector<Word> used_;
+  std::vector<Word> reserved_;
+  // No free address comes before this word
+  size_t firstFreeWord_ = 0;
+
+  std::string leasesKey_;
+  // Addresses leased before a restart, and not released since
+  std::vector<Word> stale_;
+  size_t staleCount_ = 0;
+  std::chrono::steady_clock::time_point staleDeadline_;
+
+  size_t offsetOf(IPAddress const& addr) const;
+  static bool test(std::vector<Word> const& bits, size_t offset);
+  static void set(std::vector<Word>& bits, size_t offset, bool value);
+
+  void saveLease(IPAddress const& addr, bool isLeased);
+  void releaseStaleLeases();
+
+private:
+  IPAddressPool(IPAddressPool const& copy) = delete;
+  IPAddressPool& operator=(IPAddressPool const& copy) = delete;
 
-  std::queue<IPAddress> reusables_;
-  std::set<IPAddress> reserved_;
+  IPAddressPool(IPAddressPool&& move) = delete;
+  IPAddressPool& operator=(IPAddressPool&& move) = delete;
 };
 } // namespace networking
@@ -3,6 +3,7 @@
 #include <event/Trigger.h>
 
 #include <chrono>
+#include <deque>
 
 namespace networking {
 
@@ -14,203 +15,433 @@ static const std::string kMessengerHeartBeatReplyMessageType =
 static const event::Duration kMessengerHeartBeatInterval = 1s;
 static const event::Duration kMessengerHeartBeatTimeout = 10s;
 static const size_t kMessengerOutboundQueueSize = 32;
+// How much is read from the socket at a time
+static const size_t kMessengerReadSize = 16 * 1024;
+// Frames that are yet to be sent can add up to this much before the
+// Transporter stops taking messages from outboundQ
+static const size_t kMessengerMaxBacklog = 256 * 1024;
+static const size_t kMessengerMaxFramesPerWrite = 16;
+// How much encryptors may grow a payload by
+static const size_t kMessengerEncryptionHeadroom = 256;
+// Heartbeats carry this (as true) for the peer to know that it may send
+// MessageFormat::Binary.
+static const std::string kMessengerBinaryHeartbeatKey = "binary_messages";
+
+void Message::encode(MessageFormat format, std::string& output) const {
+  switch (format) {
+  case MessageFormat::JSON:
+    output += json{{"type", type_}, {"body", body_}}.dump();
+    return;
+  case MessageFormat::Binary:
+    assertTrue(type_.length() <= UINT8_MAX,
+               "Message type too long: " + type_);
+    output += static_cast<char>(format);
+    output += static_cast<char>(type_.length());
+    output += type_;
+    json::to_msgpack(body_, output);
+    return;
+  }
+}
 
-class Messenger::Heartbeater {
-public:
-  Heartbeater(Messenger* messenger)
-      : messenger_(messenger), beatTimer_(messenger->loop_.createTimer(0s)),
-        missedTimer_(messenger->loop_.createTimer(kMessengerHeartBeatTimeout)),
-        statRtt_("Connection", "rtt") {
-    beater_ = messenger_->loop_.createAction(
-        "networking::Messenger::Heartbeater::beater_",
-        {beatTimer_->didFire(), messenger_->outboundQ->canPush()});
-
-    // Sets up periodic heart beat sending
-    beater_->callback = [this]() {
-      auto messageBody =
-          json{{"start", event::Timer::getEpochTimeInMilliseconds().count()}};
-
-      for (auto const& service : messenger_->heartbeatServices_) {
-        auto payload = service.producer();
+/* static */ std::optional<Message> Message::decode(Byte const* data,
+                                                    size_t size) {
+  if (size == 0) {
+    return std::nullopt;
+  }
 
-        if (!payload.is_null()) {
-          messageBody[service.name] = service.producer();
-        }
+  try {
+    switch (static_cast<MessageFormat>(data[0])) {
+    case MessageFormat::JSON: {
+      auto payload = json::parse(data, data + size);
+      return Message(payload.at("type").get<std::string>(),
+                     std::move(payload["body"]));
+    }
+    case MessageFormat::Binary: {
+      if (size < 2 || size < 2 + static_cast<size_t>(data[1])) {
+        return std::nullopt;
       }
-
-      messenger_->outboundQ->push(
-          Message(kMessengerHeartBeatMessageType, std::move(messageBody)));
-      beatTimer_->extend(kMessengerHeartBeatInterval);
-    };
-
-    // Sets up missed heartbeat disconnection
-    messenger_->loop_.arm(
-        "networking::Messenger::Heartbeater::missedTimerFireTrigger",
-        {missedTimer_->didFire()}, [this]() {
-          LOG_I("Messenger")
-              << "Disconnected due to missed heartbeats." << std::endl;
-          messenger_->disconnect();
-        });
-
-    // Sets up heartbeat message handler
-    messenger_->addHandler(
-        kMessengerHeartBeatMessageType, [this](auto const& message) {
-          auto body = message.getBody();
-
-          for (auto const& service : messenger_->heartbeatServices_) {
-            if (body.find(service.name) == body.end()) {
-              continue;
-            }
-
-            service.consumer(body[service.name]);
-          }
-
-          messenger_->outboundQ->push(
-              Message(kMessengerHeartBeatReplyMessageType, message.getBody()));
-          missedTimer_->reset(kMessengerHeartBeatTimeout);
-
-          return Message::null();
-        });
-
-    // Sets up heartbeat reply message handler
-    messenger_->addHandler(
-        kMessengerHeartBeatReplyMessageType, [this](auto const& message) {
-          auto start = message.getBody()["start"].template get<int>();
-          statRtt_.accumulate(
-              event::Timer::getEpochTimeInMilliseconds().count() - start);
-          return Message::null();
-        });
+      auto typeEnd = data + 2 + data[1];
+      return Message(std::string(data + 2, typeEnd),
+                     json::from_msgpack(typeEnd, data + size));
+    }
+    }
+  } catch (json::exception const&) {
+    return std::nullopt;
   }
 
-private:
-  Messenger* messenger_;
-
-  std::unique_ptr<event::Timer> beatTimer_;
-  std::unique_ptr<event::Action> beater_;
-  std::unique_ptr<event::Timer> missedTimer_;
-
-  stats::AvgStat statRtt_;
-};
+  return std::nullopt;
+}
 
+// Frames messages with a length header over the socket, after running them
+// through the encryptors.
+//
+// Both ways, frames are of any size up to kMessageMaxSize, though incoming ones
+// are held to kMessageMaxUnauthenticatedSize until setAuthenticated(). Incoming
+// bytes pile up until a frame is complete, and frames are only delivered while
+// the handlers have room in outboundQ for replies. Outgoing frames are queued
+// up as headers and bodies, and written out (in part, if the socket is full)
+// with a single writev() for as many of them as there are.
 class Messenger::Transporter {
 private:
   using LengthHeaderType = uint32_t;
 
+  struct Frame {
+    LengthHeaderType header;
+    std::string body;
+  };
+
 public:
   Transporter(Messenger* messenger, std::unique_ptr<TCPSocket> socket)
-      : messenger_(messenger), socket_(std::move(socket)), bufferUsed_(0),
-        sender_(messenger_->loop_.createAction(
-            "networking::Messenger::Transporter::sender_",
-            {socket_->canWrite(), messenger->outboundQ->canPop()})),
-        receiver_(messenger_->loop_.createAction(
-            "networking::Messenger::Transporter::receiver_",
-            {socket_->canRead(), messenger->outboundQ->canPush()})) {
-    sender_->callback.setMethod<Transporter, &Transporter::doSend>(this);
+      : messenger_(messenger), socket_(std::move(socket)),
+        hasInput_(messenger_->loop_.createBaseCondition()),
+        hasOutput_(messenger_->loop_.createBaseCondition()),
+        hasRoom_(messenger_->loop_.createBaseCondition()) {
+    auto& loop = messenger_->loop_;
+
+    receiver_ = loop.createAction(
+        "networking::Messenger::Transporter::receiver_",
+        {socket_->canRead(), messenger_->outboundQ->canPush()});
     receiver_->callback.setMethod<Transporter, &Transporter::doReceive>(this);
+    deliverer_ = loop.createAction(
+        "networking::Messenger::Transporter::deliverer_",
+        {hasInput_.get(), messenger_->outboundQ->canPush()});
+    deliverer_->callback.setMethod<Transporter, &Transporter::doDeliver>(this);
+
+    packer_ = loop.createAction("networking::Messenger::Transporter::packer_",
+                                {messenger_->outboundQ->canPop(),
+                                 hasRoom_.get()});
+    packer_->callback.setMethod<Transporter, &Transporter::doPack>(this);
+    sender_ = loop.createAction("networking::Messenger::Transporter::sender_",
+                                {socket_->canWrite(), hasOutput_.get()});
+    sender_->callback.setMethod<Transporter, &Transporter::doSend>(this);
+
+    hasRoom_->fire();
   }
 
   std::vector<std::unique_ptr<crypto::Encryptor>> encryptors_;
 
+  // Called once the peer says it takes MessageFormat::Binary.
+  void takesBinary() {
+    if (!takesBinary_) {
+      LOG_V("Messenger") << "Switching to binary messages." << std::endl;
+      takesBinary_ = true;
+    }
+  }
+
+  void setAuthenticated() { maxInputSize_ = kMessageMaxSize; }
+
+private:
+  Messenger* messenger_;
+
+  std::unique_ptr<TCPSocket> socket_;
+  bool takesBinary_ = false;
+
+  // Bytes received, from the start of the first frame not yet delivered
+  std::string input_;
+  size_t maxInputSize_ = kMessageMaxUnauthenticatedSize;
+  std::unique_ptr<event::BaseCondition> hasInput_;
+
+  // Frames to send, how much of the first one is sent already, and how many
+  // bytes there are to send overall
+  std::deque<Frame> output_;
+  size_t written_ = 0;
+  size_t outputSize_ = 0;
+  // Set once a Message::disconnect() is popped, for it to take effect after
+  // the frames before it are sent.
+  bool isDisconnecting_ = false;
+  std::unique_ptr<event::BaseCondition> hasOutput_;
+  std::unique_ptr<event::BaseCondition> hasRoom_;
+
+  std::unique_ptr<event::Action> receiver_;
+  std::unique_ptr<event::Action> deliverer_;
+  std::unique_ptr<event::Action> packer_;
+  std::unique_ptr<event::Action> sender_;
+
   void doReceive() {
+    Byte buffer[kMessengerReadSize];
+
     try {
-      size_t read = socket_->read(buffer_ + bufferUsed_,
-                                  kMessengerReceiveBufferSize - bufferUsed_);
-      bufferUsed_ += read;
+      size_t read = socket_->read(buffer, sizeof(buffer));
+      input_.append(reinterpret_cast<char*>(buffer), read);
     } catch (SocketClosedException const& ex) {
       LOG_I("Messenger") << "While receiving: " << ex.what() << std::endl;
       messenger_->disconnect();
       return;
     }
 
-    // Deliver complete messages
-    while (bufferUsed_ >= sizeof(LengthHeaderType)) {
-      int messageLen = ntohl(*((LengthHeaderType*)buffer_));
-      int totalLen = sizeof(LengthHeaderType) + messageLen;
-      if (bufferUsed_ < totalLen) {
+    doDeliver();
+  }
+
+  void doDeliver() {
+    size_t consumed = 0;
+
+    // Stops when a handler leaves no room for the next one to reply
+    while (messenger_->outboundQ->canPush()->eval()) {
+      if (input_.length() - consumed < sizeof(LengthHeaderType)) {
         break;
       }
 
-      // We have a complete message
-      Message message;
-      message.fill(buffer_ + sizeof(LengthHeaderType), messageLen);
+      LengthHeaderType messageLen;
+      memcpy(&messageLen, &input_[consumed], sizeof(messageLen));
+      messageLen = ntohl(messageLen);
 
-      LengthHeaderType payloadLen = messageLen;
-      for (auto decryptor = encryptors_.rbegin();
-           decryptor != encryptors_.rend(); decryptor++) {
-        payloadLen =
-            (*decryptor)->decrypt(message.data, payloadLen, kMessageSize);
+      if (messageLen > maxInputSize_) {
+        LOG_I("Messenger") << "Disconnected due to an oversized message."
+                           << std::endl;
+        messenger_->disconnect();
+        return;
       }
-      message.size = payloadLen;
 
-      if (bufferUsed_ > totalLen) {
-        // Move the left-over to the front
-        memmove(buffer_, buffer_ + totalLen, bufferUsed_ - (totalLen));
+      size_t offset = consumed + sizeof(LengthHeaderType);
+      if (input_.length() - offset < messageLen) {
+        break;
       }
+      consumed = offset + messageLen;
 
-      if (!message.isValid()) {
+      // We have a complete message, which is decrypted where it is.
+      auto payload = reinterpret_cast<Byte*>(&input_[offset]);
+      size_t payloadLen = messageLen;
+      for (auto decryptor = encryptors_.rbegin();
+           decryptor != encryptors_.rend(); decryptor++) {
+        payloadLen = (*decryptor)->decrypt(payload, payloadLen, messageLen);
+      }
+
+      auto message = Message::decode(payload, payloadLen);
+      if (!message) {
         LOG_I("Messenger") << "Disconnected due to invalid message."
                            << std::endl;
         messenger_->disconnect();
         return;
       }
 
-      bufferUsed_ -= (totalLen);
-
-      LOG_V("Messenger") << "Received: " << message.getType() << " - "
-                         << message.getBody() << std::endl;
+      LOG_V("Messenger") << "Received: " << message->getType() << " - "
+                         << message->getBody() << std::endl;
 
       //  Dispatch the incoming message to the correct handler
-      auto it = messenger_->handlers_.find(message.getType());
+      auto it = messenger_->handlers_.find(message->getType());
       assertTrue(it != messenger_->handlers_.end(),
-                 "Unknown message type " + message.getType());
-      auto reply = it->second(message);
-      if (reply.size > 0) {
+                 "Unknown message type " + message->getType());
+      auto reply = it->second(*message);
+      if (!reply.isNull()) {
         messenger_->outboundQ->push(std::move(reply));
       }
     }
+
+    input_.erase(0, consumed);
+    if (input_.empty() && input_.capacity() > kMessengerReadSize) {
+      // Whatever a large message took up
+      input_.shrink_to_fit();
+    }
+
+    // Whether there's another complete frame left for doDeliver()
+    bool hasFrame = false;
+    if (input_.length() >= sizeof(LengthHeaderType)) {
+      LengthHeaderType messageLen;
+      memcpy(&messageLen, input_.data(), sizeof(messageLen));
+      hasFrame =
+          input_.length() - sizeof(LengthHeaderType) >= ntohl(messageLen);
+    }
+
+    if (hasFrame) {
+      hasInput_->fire();
+    } else {
+      hasInput_->arm();
+    }
   }
 
-  void doSend() {
+  void doPack() {
     Message message = messenger_->outboundQ->pop();
 
     if (message.isDisconnect()) {
-      LOG_I("Messenger") << "Disconnected." << std::endl;
-      messenger_->disconnect();
+      isDisconnecting_ = true;
+      hasRoom_->arm();
+      if (output_.empty()) {
+        finishDisconnecting();
+      }
       return;
     }
 
     LOG_V("Messenger") << "Sent: " << message.getType() << " = "
                        << message.getBody() << std::endl;
 
-    LengthHeaderType payloadSize = message.size;
+    Frame frame;
+    message.encode(takesBinary_ ? MessageFormat::Binary : MessageFormat::JSON,
+                   frame.body);
+
+    size_t payloadSize = frame.body.length();
+    frame.body.resize(payloadSize + kMessengerEncryptionHeadroom);
     for (auto const& encryptor : encryptors_) {
       payloadSize =
-          encryptor->encrypt(message.data, payloadSize, message.capacity);
+          encryptor->encrypt(reinterpret_cast<Byte*>(&frame.body[0]),
+                             payloadSize, frame.body.length());
     }
+    frame.body.resize(payloadSize);
+
+    assertTrue(payloadSize <= kMessageMaxSize,
+               "Message too long: " + message.getType());
+    frame.header = htonl(payloadSize);
 
+    outputSize_ += sizeof(LengthHeaderType) + payloadSize;
+    output_.push_back(std::move(frame));
+
+    hasOutput_->fire();
+    if (outputSize_ >= kMessengerMaxBacklog) {
+      hasRoom_->arm();
+    }
+  }
+
+  void doSend() {
+    struct iovec segments[2 * kMessengerMaxFramesPerWrite];
+    int count = 0;
+
+    for (size_t i = 0; i < output_.size() && i < kMessengerMaxFramesPerWrite;
+         i++) {
+      auto& frame = output_[i];
+      size_t skipped = (i == 0 ? written_ : 0);
+
+      if (skipped < sizeof(LengthHeaderType)) {
+        segments[count].iov_base =
+            reinterpret_cast<Byte*>(&frame.header) + skipped;
+        segments[count].iov_len = sizeof(LengthHeaderType) - skipped;
+        count++;
+        skipped = 0;
+      } else {
+        skipped -= sizeof(LengthHeaderType);
+      }
+
+      segments[count].iov_base = &frame.body[skipped];
+      segments[count].iov_len = frame.body.length() - skipped;
+      count++;
+    }
+
+    size_t written;
     try {
-      LengthHeaderType networkPayloadSize = htonl(payloadSize);
-      int written =
-          socket_->write((Byte*)&networkPayloadSize, sizeof(payloadSize));
-      assertTrue(written == sizeof(payloadSize),
-                 "Message length header fragmented");
-      written = socket_->write(message.data, payloadSize);
-      assertTrue(written == payloadSize, "Message content fragmented");
+      written = socket_->writev(segments, count);
     } catch (SocketClosedException const& ex) {
       LOG_I("Messenger") << "While sending: " << ex.what() << std::endl;
       messenger_->disconnect();
       return;
     }
+
+    outputSize_ -= written;
+    written_ += written;
+    while (!output_.empty()) {
+      size_t frameSize =
+          sizeof(LengthHeaderType) + output_.front().body.length();
+      if (written_ < frameSize) {
+        break;
+      }
+      written_ -= frameSize;
+      output_.pop_front();
+    }
+
+    if (output_.empty()) {
+      hasOutput_->arm();
+      if (isDisconnecting_) {
+        finishDisconnecting();
+        return;
+      }
+    }
+    if (!isDisconnecting_ && outputSize_ < kMessengerMaxBacklog) {
+      hasRoom_->fire();
+    }
+  }
+
+  void finishDisconnecting() {
+    LOG_I("Messenger") << "Disconnected." << std::endl;
+    messenger_->disconnect();
+  }
+};
+
+class Messenger::Heartbeater {
+public:
+  Heartbeater(Messenger* messenger)
+      : messenger_(messenger), beatTimer_(messenger->loop_.createTimer(0s)),
+        missedTimer_(messenger->loop_.createTimer(kMessengerHeartBeatTimeout)),
+        statRtt_("Connection", "rtt") {
+    beater_ = messenger_->loop_.createAction(
+        "networking::Messenger::Heartbeater::beater_",
+        {beatTimer_->didFire(), messenger_->outboundQ->canPush()});
+
+    // Sets up periodic heart beat sending
+    beater_->callback = [this]() {
+      auto messageBody =
+          json{{"start", event::Timer::getEpochTimeInMilliseconds().count()},
+               {kMessengerBinaryHeartbeatKey, true}};
+
+      for (auto const& service : messenger_->heartbeatServices_) {
+        auto payload = service.producer();
+
+        if (!payload.is_null()) {
+          messageBody[service.name] = service.producer();
+        }
+      }
+
+      messenger_->outboundQ->push(
+          Message(kMessengerHeartBeatMessageType, std::move(messageBody)));
+      beatTimer_->extend(kMessengerHeartBeatInterval);
+    };
+
+    // Sets up missed heartbeat disconnection
+    messenger_->loop_.arm(
+        "networking::Messenger::Heartbeater::missedTimerFireTrigger",
+        {missedTimer_->didFire()}, [this]() {
+          LOG_I("Messenger")
+              << "Disconnected due to missed heartbeats." << std::endl;
+          messenger_->disconnect();
+        });
+
+    // Sets up heartbeat message handler
+    messenger_->addHandler(
+        kMessengerHeartBeatMessageType, [this](auto const& message) {
+          auto const& body = message.getBody();
+
+          if (body.find(kMessengerBinaryHeartbeatKey) != body.end()) {
+            messenger_->transporter_->takesBinary();
+          }
+
+          for (auto const& service : messenger_->heartbeatServices_) {
+            if (body.find(service.name) == body.end()) {
+              continue;
+            }
+
+            service.consumer(body.at(service.name));
+          }
+
+          messenger_->outboundQ->push(
+              Message(kMessengerHeartBeatReplyMessageType, message.getBody()));
+          missedTimer_->reset(kMessengerHeartBeatTimeout);
+
+          return Message::null();
+        });
+
+    // Sets up heartbeat reply message handler
+    messenger_->addHandler(
+        kMessengerHeartBeatReplyMessageType, [this](auto const& message) {
+          auto const& body = message.getBody();
+          auto it = body.find("start");
+          if (it == body.end() || !it->is_number_integer()) {
+            LOG_I("Messenger")
+                << "Disconnected due to an invalid heartbeat reply."
+                << std::endl;
+            return Message::disconnect();
+          }
+
+          auto start = it->template get<int64_t>();
+          statRtt_.accumulate(
+              event::Timer::getEpochTimeInMilliseconds().count() - start);
+          return Message::null();
+        });
   }
 
 private:
   Messenger* messenger_;
 
-  std::unique_ptr<TCPSocket> socket_;
-  int bufferUsed_;
-  Byte buffer_[kMessengerReceiveBufferSize];
-  std::unique_ptr<event::Action> sender_;
-  std::unique_ptr<event::Action> receiver_;
+  std::unique_ptr<event::Timer> beatTimer_;
+  std::unique_ptr<event::Action> beater_;
+  std::unique_ptr<event::Timer> missedTimer_;
+
+  stats::HistogramStat statRtt_;
 };
 
 Messenger::Messenger(event::EventLoop& loop, std::unique_ptr<TCPSocket> socket)
@@ -242,6 +473,12 @@ void Messenger::addHeartbeatService(HeartbeatService service) {
   heartbeatServices_.push_back(std::move(service));
 }
 
+void Messenger::setAuthenticated() {
+  if (!!transporter_) {
+    transporter_->setAuthenticated();
+  }
+}
+
 event::Condition* Messenger::didDisconnect() const {
   return didDisconnect_.get();
 }
@@ -2,68 +2,69 @@
 
 #include <json/json.hpp>
 
-#include <networking/Packet.h>
 #include <networking/TCPSocket.h>
 
 #include <common/Util.h>
 #include <crypto/Encryptor.h>
 #include <event/FIFO.h>
 #include <event/Timer.h>
-#include <stats/AvgStat.h>
+#include <stats/HistogramStat.h>
 
+#include <optional>
+#include <string>
 #include <vector>
 
 namespace networking {
 
 using json = nlohmann::json;
 
-const size_t kMessageSize = 2048;
+// Longer messages are taken as garbage, and the peer is disconnected
+const size_t kMessageMaxSize = 16 * 1024 * 1024;
+// Same, until the session is set up. Keeps a peer that has yet to prove who
+// it is from making us buffer up to kMessageMaxSize.
+const size_t kMessageMaxUnauthenticatedSize = 64 * 1024;
 const std::string kDisconnectMessageType = "disconnect";
 
-struct Message : public Packet {
-  Message() : Packet(kMessageSize) {}
+// How a Message is put on the wire. Payloads start with the byte of their
+// format, which lets peers that know about both take either.
+enum class MessageFormat : uint8_t {
+  // {"type": ..., "body": ...}, which is all that older peers know about
+  JSON = '{',
+  // The length of the type as one byte, the type, and then the body in
+  // MessagePack. Only sent once the peer says it takes it.
+  Binary = 0x01,
+};
+
+// The type of a message picks its handler, and the body is whatever JSON the
+// handler makes sense of. Both are decoded once, upon receipt.
+struct Message {
+  Message() {}
+
+  Message(std::string type, json body)
+      : type_(std::move(type)), body_(std::move(body)) {}
 
   static Message null() { return Message(); }
 
   static Message disconnect() { return Message(kDisconnectMessageType, ""); }
 
-  bool isDisconnect() const {
-    return this->getType() == kDisconnectMessageType;
-  }
-
-  Message(std::string const& type, json const& body) : Packet(kMessageSize) {
-    json payload = {
-        {"type", type},
-        {"body", body},
-    };
-    std::string content = payload.dump();
-    memcpy(data, content.c_str(), content.length());
-    size = content.length();
-  }
-
-  std::string getType() const {
-    return json::parse(
-        std::string(reinterpret_cast<char*>(data), size))["type"];
-  }
-
-  json getBody() const {
-    return json::parse(
-        std::string(reinterpret_cast<char*>(data), size))["body"];
-  }
-
-  bool isValid() const {
-    try {
-      auto type = getType();
-      auto body = getBody();
-    } catch (...) {
-      // FIXME: catch more cautiously once json cuts a new release.
-      return false;
-    }
-    return true;
-  }
-};
+  bool isNull() const { return type_.empty(); }
+
+  bool isDisconnect() const { return type_ == kDisconnectMessageType; }
+
+  std::string const& getType() const { return type_; }
 
-const size_t kMessengerReceiveBufferSize = 8192;
+  json const& getBody() const { return body_; }
+
+  // Appends the payload of the message to `output`.
+  void encode(MessageFormat format, std::string& output) const;
+
+  // Returns std::nullopt if the payload is malformed.
+  static std::optional<Message> decode(Byte const* data, size_t size);
+
+private:
+  std::string type_;
+  json body_;
+};
 
 class Messenger {
 public:
@@ -80,6 +81,10 @@ public:
   void addHeartbeatService(HeartbeatService service);
   event::Condition* didDisconnect() const;
 
+  // Lifts the limit on incoming messages to kMessageMaxSize, once the
+  // handlers have found the peer to be who it says it is.
+  void setAuthenticated();
+
 private:
   Messenger(Messenger const& copy) = delete;
   Messenger& operator=(Messenger const& copy) = delete;
@@ -1,30 +1,48 @@
 #include "networking/Packet.h"
 
+#include <stats/GaugeStat.h>
+
 namespace networking {
 
-/* static */ common::MemoryPool<kPacketPoolBlockSize, kPacketPoolBlockCount>
-    Packet::pool_;
+static stats::GaugeStat statPoolInUse("PacketPool", "in_use", []() {
+  return common::BufferPool::getInstance().getUsage().inUseBytes;
+});
+static stats::GaugeStat statPoolHighWater("PacketPool", "high_water", []() {
+  return common::BufferPool::getInstance().getUsage().highWaterBytes;
+});
+static stats::GaugeStat statPoolCached("PacketPool", "cached", []() {
+  return common::BufferPool::getInstance().getUsage().cachedBytes;
+});
 
-Packet::Packet(size_t capacity) : capacity(capacity), size(0) {
-  data = static_cast<Byte*>(pool_.allocate(capacity));
+Packet::Packet(size_t capacity)
+    : capacity(capacity), size(0), bufferSize_(capacity) {
+  buffer_ = static_cast<Byte*>(
+      common::BufferPool::getInstance().allocate(bufferSize_));
+  data = buffer_;
 }
 
-Packet::Packet(Packet&& move) : capacity(move.capacity), size(move.size) {
-  data = move.data;
+Packet::Packet(Packet&& move)
+    : capacity(move.capacity), size(move.size), data(move.data),
+      trace(std::move(move.trace)), buffer_(move.buffer_),
+      bufferSize_(move.bufferSize_) {
   move.data = nullptr;
+  move.buffer_ = nullptr;
 }
 
 Packet& Packet::operator=(Packet&& move) {
   std::swap(capacity, move.capacity);
   std::swap(size, move.size);
   std::swap(data, move.data);
+  std::swap(trace, move.trace);
+  std::swap(buffer_, move.buffer_);
+  std::swap(bufferSize_, move.bufferSize_);
 
   return *this;
 }
 
 Packet::~Packet() {
-  if (data != nullptr) {
-    pool_.free(data);
+  if (buffer_ != nullptr) {
+    common::BufferPool::getInstance().free(buffer_, bufferSize_);
   }
 }
 
@@ -44,23 +62,35 @@ void Packet::trimFront(size_t bytes) {
              "Trying to trim more bytes than there are in the packet.");
 
   this->size -= bytes;
+  this->capacity -= bytes;
   this->data += bytes;
 }
 
 void Packet::insertFront(size_t bytes) {
-  Byte* newData = this->data;
+  if (static_cast<size_t>(this->data - buffer_) >= bytes) {
+    // Reclaiming what an earlier trimFront() left
+    this->data -= bytes;
+    this->capacity += bytes;
+    this->size += bytes;
+    return;
+  }
 
-  if (this->size + bytes > this->capacity) {
-    this->capacity = this->size + bytes;
-    newData = (Byte*)pool_.allocate(this->capacity);
+  if (this->size + bytes <= this->capacity) {
+    memmove(this->data + bytes, this->data, this->size);
+    this->size += bytes;
+    return;
   }
 
-  memmove(newData + bytes, this->data, this->size);
-  this->size += bytes;
+  auto& pool = common::BufferPool::getInstance();
+  size_t newBufferSize = this->size + bytes;
+  Byte* newBuffer = static_cast<Byte*>(pool.allocate(newBufferSize));
+  memcpy(newBuffer + bytes, this->data, this->size);
+  pool.free(buffer_, bufferSize_);
 
-  if (newData != this->data) {
-    pool_.free(this->data);
-    this->data = newData;
-  }
+  buffer_ = newBuffer;
+  bufferSize_ = newBufferSize;
+  this->data = newBuffer;
+  this->capacity = newBufferSize;
+  this->size += bytes;
 }
 } // namespace networking
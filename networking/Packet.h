@@ -1,23 +1,24 @@
 #pragma once
 
-#include <common/MemoryPool.h>
+#include <common/BufferPool.h>
 #include <common/Util.h>
+#include <networking/PacketTrace.h>
 
 #include <string.h>
 #include <unistd.h>
 
 #include <array>
+#include <memory>
 #include <vector>
 
 namespace networking {
 
-const static size_t kPacketPoolBlockSize = 4096 + 32;
-const static size_t kPacketPoolBlockCount = 32;
-
 struct Packet {
   size_t capacity;
   size_t size;
   Byte* data;
+  // Only set on the packets sampled for latency tracing
+  std::unique_ptr<PacketTrace> trace;
 
   Packet(size_t capacity);
   Packet(Packet&& move);
@@ -37,11 +38,12 @@ struct Packet {
 
   template <typename T> T unpack(size_t offset = 0) {
     T obj;
-    unpack(obj);
+    unpack(obj, offset);
     return obj;
   }
 
-  // TODO: Make these work with correct destruction
+  // Both keep track of the underlying buffer, which is what gets freed in the
+  // end. Trimmed bytes are kept around as headroom for later insertFront()-s.
   void trimFront(size_t bytes);
   void insertFront(size_t bytes);
 
@@ -71,6 +73,8 @@ private:
   Packet(Packet const& copy) = delete;
   Packet& operator=(Packet const& copy) = delete;
 
-  static common::MemoryPool<kPacketPoolBlockSize, kPacketPoolBlockCount> pool_;
+  Byte* buffer_;
+  // As asked of the BufferPool
+  size_t bufferSize_;
 };
 } // namespace networking
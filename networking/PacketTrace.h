@@ -0,0 +1,27 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace networking {
+
+static const size_t kPacketTraceMaxStages = 8;
+
+// When a sampled packet passed each stage of the pipeline. What the stages
+// are is up to whoever traces the packet.
+struct PacketTrace {
+  using Clock = std::chrono::steady_clock;
+
+  std::array<Clock::time_point, kPacketTraceMaxStages> stamps;
+  // Bit i is set once stamps[i] is
+  uint8_t stamped = 0;
+
+  void mark(size_t stage) {
+    stamps[stage] = Clock::now();
+    stamped |= (1 << stage);
+  }
+
+  bool has(size_t stage) const { return (stamped & (1 << stage)) != 0; }
+};
+} // namespace networking
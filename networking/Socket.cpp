@@ -164,6 +164,75 @@ size_t Socket::write(Byte* buffer, size_t size) {
   return ret;
 }
 
+size_t Socket::writev(struct iovec const* segments, int count,
+                      bool zeroCopy /* = false */) {
+  assertTrue(connected_, "Socket::writev() called on a unconnected socket.");
+
+  size_t size = 0;
+  for (int i = 0; i < count; i++) {
+    size += segments[i].iov_len;
+  }
+
+  LOG_VV("Socket") << "Writing " << count << " segments with total size "
+                   << size << std::endl;
+
+  ssize_t ret = -1;
+  if (zeroCopy) {
+#if TARGET_LINUX
+    struct msghdr message = {};
+    message.msg_iov = const_cast<struct iovec*>(segments);
+    message.msg_iovlen = count;
+    ret = ::sendmsg(fd_.fd, &message, MSG_ZEROCOPY);
+#else
+    assertTrue(false, "Zero-copy sends are only supported on Linux.");
+#endif
+  } else {
+    ret = ::writev(fd_.fd, segments, count);
+  }
+  int err = errno;
+
+  if (type_ == TCP && ret == 0 && size != 0) {
+    throw SocketClosedException("The socket connection is closed.");
+  }
+
+  checkSocketException(ret, err);
+
+  // A zero-copy send fails with ENOBUFS once too many of them are in flight.
+  // The caller can fall back to a plain write in that case.
+  if (!checkRetryableError(ret,
+                           "sending " +
+                               std::string(type_ == TCP ? "TCP" : "UDP") +
+                               " segments",
+                           (zeroCopy ? ENOBUFS : 0))) {
+    return 0;
+  }
+
+  return ret;
+}
+
+size_t Socket::readv(struct iovec const* segments, int count) {
+  assertTrue(connected_, "Socket::readv() called on a unconnected socket.");
+
+  ssize_t ret = ::readv(fd_.fd, segments, count);
+  int err = errno;
+
+  if (type_ == TCP && ret == 0) {
+    throw SocketClosedException("The socket connection is closed.");
+  }
+
+  checkSocketException(ret, err);
+
+  if (!checkRetryableError(ret, "receiving " +
+                                    std::string(type_ == TCP ? "TCP" : "UDP") +
+                                    " segments")) {
+    return 0;
+  }
+
+  LOG_VV("Socket") << "Read segments with total size " << ret << std::endl;
+
+  return ret;
+}
+
 void Socket::setNonblock() {
   int ret = fcntl(fd_.fd, F_SETFL, fcntl(fd_.fd, F_GETFL, 0) | O_NONBLOCK);
   checkUnixError(ret, "setting O_NONBLOCK for SocketPipe");
@@ -185,4 +254,8 @@ event::Condition* Socket::canRead() const {
 event::Condition* Socket::canWrite() const {
   return loop_.getIOConditionManager().canWrite(fd_.fd);
 }
+
+event::Condition* Socket::hasErrors() const {
+  return loop_.getIOConditionManager().hasError(fd_.fd);
+}
 } // namespace networking
@@ -8,6 +8,8 @@
 #include <networking/NetworkType.h>
 #include <networking/SocketAddress.h>
 
+#include <sys/uio.h>
+
 #include <memory>
 
 namespace networking {
@@ -36,11 +38,22 @@ public:
   SocketAddress getPeerAddress() const;
   size_t read(Byte* buffer, size_t capacity);
   size_t write(Byte* buffer, size_t size);
+  // Gathers the given segments into a single write. Returns the number of
+  // bytes written, which might be less than their total size.
+  //
+  // With `zeroCopy`, the kernel sends straight out of the segments, which then
+  // must stay untouched until it reports the send as completed. See
+  // TCPSocket::enableZeroCopy().
+  size_t writev(struct iovec const* segments, int count,
+                bool zeroCopy = false);
+  // Scatters a single read into the given segments. Connected sockets only.
+  size_t readv(struct iovec const* segments, int count);
 
   bool isConnected() const { return connected_; }
 
   event::Condition* canRead() const;
   event::Condition* canWrite() const;
+  event::Condition* hasErrors() const;
 
   std::optional<int> getPort() const { return port_; }
 
@@ -0,0 +1,92 @@
+#include "networking/TCPSocket.h"
+
+#include <sys/socket.h>
+
+#if TARGET_LINUX
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#endif
+
+namespace networking {
+
+void TCPSocket::setSendBufferSize(size_t size) {
+  int value = static_cast<int>(size);
+  int ret = setsockopt(fd_.fd, SOL_SOCKET, SO_SNDBUF, &value, sizeof(value));
+  checkUnixError(ret, "setting SO_SNDBUF for TCP socket");
+}
+
+void TCPSocket::setReceiveBufferSize(size_t size) {
+  int value = static_cast<int>(size);
+  int ret = setsockopt(fd_.fd, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value));
+  checkUnixError(ret, "setting SO_RCVBUF for TCP socket");
+}
+
+void TCPSocket::setNotSentLowWatermark(size_t size) {
+#ifdef TCP_NOTSENT_LOWAT
+  int value = static_cast<int>(size);
+  int ret = setsockopt(fd_.fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &value,
+                       sizeof(value));
+  checkUnixError(ret, "setting TCP_NOTSENT_LOWAT for TCP socket");
+#else
+  LOG_V("TCPSocket") << "TCP_NOTSENT_LOWAT is not supported. Ignoring it."
+                     << std::endl;
+#endif
+}
+
+bool TCPSocket::enableZeroCopy() {
+#if TARGET_LINUX
+  int flag = 1;
+  int ret = setsockopt(fd_.fd, SOL_SOCKET, SO_ZEROCOPY, &flag, sizeof(flag));
+  if (ret < 0) {
+    LOG_V("TCPSocket") << "SO_ZEROCOPY is not supported: " << strerror(errno)
+                       << std::endl;
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+std::vector<TCPSocket::ZeroCopyCompletion>
+TCPSocket::readZeroCopyCompletions() {
+  std::vector<ZeroCopyCompletion> completions;
+
+#if TARGET_LINUX
+  while (true) {
+    Byte control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+    struct msghdr message = {};
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    int ret = recvmsg(fd_.fd, &message, MSG_ERRQUEUE);
+    if (!checkRetryableError(ret, "reading the TCP socket error queue")) {
+      break;
+    }
+
+    for (auto cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&message, cmsg)) {
+      bool isIPError = (cmsg->cmsg_level == SOL_IP &&
+                        cmsg->cmsg_type == IP_RECVERR) ||
+                       (cmsg->cmsg_level == SOL_IPV6 &&
+                        cmsg->cmsg_type == IPV6_RECVERR);
+      if (!isIPError) {
+        continue;
+      }
+
+      auto error = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cmsg));
+      if (error->ee_errno != 0 ||
+          error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+
+      completions.push_back(ZeroCopyCompletion{
+          error->ee_info, error->ee_data,
+          (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0});
+    }
+  }
+#endif
+
+  return completions;
+}
+} // namespace networking
@@ -4,10 +4,21 @@
 
 #include <networking/Socket.h>
 
+#include <vector>
+
 namespace networking {
 
 class TCPSocket : public Socket {
 public:
+  // The range of zero-copy sends (numbered from 0 in the order they were made)
+  // that the kernel no longer needs the buffers of.
+  struct ZeroCopyCompletion {
+    uint32_t first;
+    uint32_t last;
+    // Whether the kernel ended up copying the data anyway (e.g. on loopback)
+    bool copied;
+  };
+
   TCPSocket(event::EventLoop& loop, NetworkType networkType)
       : Socket(loop, networkType, TCP) {
     int flag = 1;
@@ -18,5 +29,18 @@ public:
   TCPSocket(event::EventLoop& loop, NetworkType networkType, int fd,
             SocketAddress peerAddr)
       : Socket(loop, networkType, TCP, fd, peerAddr) {}
+
+  void setSendBufferSize(size_t size);
+  void setReceiveBufferSize(size_t size);
+
+  // Makes the socket only writable while fewer than `size` bytes are waiting
+  // in the kernel to be sent, which bounds how much latency the kernel queue
+  // can add. Does nothing where TCP_NOTSENT_LOWAT is not available.
+  void setNotSentLowWatermark(size_t size);
+
+  // Returns false if the platform doesn't support SO_ZEROCOPY.
+  bool enableZeroCopy();
+  // Drains the error queue. Should be called whenever hasErrors() fires.
+  std::vector<ZeroCopyCompletion> readZeroCopyCompletions();
 };
 } // namespace networking
@@ -24,6 +24,10 @@ static const int kIOSTunnelPendingPacketQueueSize = 128;
 
 const size_t kTunnelPacketSize = 2048;
 
+// Size of the canonical (0x00 0x00 0x08 0x00) header that prefixes every
+// TunnelPacket handed out from and to Tunnel.
+const size_t kTunnelPacketHeaderSize = 4;
+
 struct TunnelPacket : public Packet {
 public:
   TunnelPacket() : Packet(kTunnelPacketSize) {}
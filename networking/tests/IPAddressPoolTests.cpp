@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+
+#include <common/Notebook.h>
+#include <networking/IPAddressPool.h>
+
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+using networking::IPAddress;
+using networking::IPAddressPool;
+using networking::SubnetAddress;
+
+static IPAddress makeAddress(std::string const& addr) {
+  return IPAddress(addr, networking::IPv4);
+}
+
+// A Notebook at a scratch path, removed again once the test is done.
+class ScratchNotebookPath {
+public:
+  ScratchNotebookPath()
+      : path("/tmp/stun_ip_address_pool_tests_" + std::to_string(getpid())) {
+    unlink(path.c_str());
+  }
+
+  ~ScratchNotebookPath() { unlink(path.c_str()); }
+
+  std::string const path;
+};
+
+TEST(IPAddressPoolTests, Exhaustion) {
+  IPAddressPool pool(SubnetAddress("10.0.0.0/29"));
+  pool.reserve(makeAddress("10.0.0.1"));
+
+  // .2 through .6, skipping the reserved one and the broadcast address
+  for (int i = 2; i <= 6; i++) {
+    ASSERT_EQ(pool.acquire(), makeAddress("10.0.0." + std::to_string(i)));
+  }
+  ASSERT_THROW(pool.acquire(), std::runtime_error)
+      << "Pool should have run out of addresses.";
+
+  pool.release(makeAddress("10.0.0.4"));
+  ASSERT_EQ(pool.acquire(), makeAddress("10.0.0.4"))
+      << "Released address should be handed out again.";
+}
+
+TEST(IPAddressPoolTests, Wraparound) {
+  IPAddressPool pool(SubnetAddress("10.0.0.0/24"));
+
+  // Past the first word of the bitmap
+  for (int i = 1; i <= 70; i++) {
+    ASSERT_EQ(pool.acquire(), makeAddress("10.0.0." + std::to_string(i)));
+  }
+
+  // Goes back for released addresses before moving on to unused ones
+  pool.release(makeAddress("10.0.0.66"));
+  pool.release(makeAddress("10.0.0.5"));
+  ASSERT_EQ(pool.acquire(), makeAddress("10.0.0.5"));
+  ASSERT_EQ(pool.acquire(), makeAddress("10.0.0.66"));
+  ASSERT_EQ(pool.acquire(), makeAddress("10.0.0.71"));
+}
+
+TEST(IPAddressPoolTests, StaleLeaseHeld) {
+  ScratchNotebookPath scratch;
+  common::Notebook notebook(scratch.path);
+
+  {
+    IPAddressPool pool(SubnetAddress("10.0.0.0/24"));
+    pool.persistLeases("test");
+    ASSERT_EQ(pool.acquire(), makeAddress("10.0.0.1"));
+  }
+
+  // As if the server restarted
+  IPAddressPool pool(SubnetAddress("10.0.0.0/24"));
+  pool.persistLeases("test", std::chrono::milliseconds(100));
+  ASSERT_EQ(pool.acquire(), makeAddress("10.0.0.2"))
+      << "Stale lease should be held.";
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(150));
+  ASSERT_EQ(pool.acquire(), makeAddress("10.0.0.1"))
+      << "Stale lease should be released after the hold.";
+}
+
+TEST(IPAddressPoolTests, PersistedLeaseRestored) {
+  ScratchNotebookPath scratch;
+
+  {
+    common::Notebook notebook(scratch.path);
+    IPAddressPool pool(SubnetAddress("10.0.0.0/24"));
+    pool.persistLeases("test");
+    pool.acquire();
+    pool.acquire();
+    pool.release(makeAddress("10.0.0.1"));
+    notebook.flush();
+  }
+
+  // Reads the leases back from disk
+  common::Notebook notebook(scratch.path);
+  IPAddressPool pool(SubnetAddress("10.0.0.0/24"));
+  pool.persistLeases("test");
+  ASSERT_EQ(pool.acquire(), makeAddress("10.0.0.1"));
+  ASSERT_EQ(pool.acquire(), makeAddress("10.0.0.3"))
+      << "Persisted lease should be restored.";
+
+  // Releasing a restored lease ends its hold right away
+  pool.release(makeAddress("10.0.0.2"));
+  ASSERT_EQ(pool.acquire(), makeAddress("10.0.0.2"));
+}
+
+TEST(IPAddressPoolTests, DoubleRelease) {
+  IPAddressPool pool(SubnetAddress("10.0.0.0/24"));
+  auto addr = pool.acquire();
+  pool.release(addr);
+  ASSERT_THROW(pool.release(addr), std::runtime_error)
+      << "Releasing an address twice should fail.";
+
+  pool.reserve(makeAddress("10.0.0.100"));
+  ASSERT_THROW(pool.release(makeAddress("10.0.0.100")), std::runtime_error)
+      << "Releasing a reserved address should fail.";
+}
@@ -1,24 +1,29 @@
 #pragma once
 
+#include <stats/Counter.h>
 #include <stats/StatsManager.h>
 
 namespace stats {
 
 class AvgStat : StatBase {
 public:
-  AvgStat(std::string entity, std::string metric) : StatBase(entity, metric) {}
+  AvgStat(std::string entity, std::string metric,
+          LabelSet const& labels = LabelSet())
+      : StatBase(entity, metric, labels) {}
 
   void accumulate(double const& increment) {
-    sum_ += increment;
-    count_ += 1;
+    sum_.add(increment);
+    count_.add(1);
   }
 
 private:
-  double sum_ = 0.0;
-  size_t count_ = 0;
+  Counter sum_;
+  Counter count_;
 
   virtual double collect() override {
-    return count_ == 0 ? sum_ : sum_ / count_;
+    double sum = sum_.read();
+    double count = count_.read();
+    return count == 0 ? sum : sum / count;
   }
 };
 } // namespace stats
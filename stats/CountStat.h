@@ -1,23 +1,23 @@
 #pragma once
 
+#include <stats/Counter.h>
 #include <stats/StatsManager.h>
 
-#include <limits>
-
 namespace stats {
 
 class CountStat : StatBase {
 public:
-  CountStat(std::string entity, std::string metric)
-      : StatBase(entity, metric) {}
+  CountStat(std::string entity, std::string metric,
+            LabelSet const& labels = LabelSet())
+      : StatBase(entity, metric, labels) {}
 
-  void accumulate() { count_++; }
+  void accumulate() { count_.add(1); }
 
-  size_t getCount() const { return count_; }
+  size_t getCount() const { return static_cast<size_t>(count_.read()); }
 
 private:
-  size_t count_ = 0;
+  Counter count_;
 
-  virtual double collect() override { return double(count_); }
+  virtual double collect() override { return count_.read(); }
 };
 } // namespace stats
@@ -0,0 +1,146 @@
+#include "stats/Counter.h"
+
+#include <common/Util.h>
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace stats {
+
+class Counter::Registry {
+public:
+  // Never destroyed, as counters may still be around during static
+  // destruction
+  static Registry& getInstance() {
+    static Registry* instance = new Registry();
+    return *instance;
+  }
+
+  std::mutex mutex;
+
+  size_t nextSlot = 0;
+  std::vector<size_t> freeSlots;
+
+  std::vector<ThreadCells*> threads;
+  // Added up by threads that have exited since, indexed by slot
+  std::vector<double> retired;
+
+  double sum(size_t slot) const {
+    double result = (slot < retired.size() ? retired[slot] : 0.0);
+
+    for (auto cells : threads) {
+      Chunk* chunk = cells->chunks[slot / kCounterChunkSize].load(
+          std::memory_order_acquire);
+      if (chunk != nullptr) {
+        result += chunk->cells[slot % kCounterChunkSize].load(
+            std::memory_order_relaxed);
+      }
+    }
+
+    return result;
+  }
+
+  void retire(size_t slot, double value) {
+    if (retired.size() <= slot) {
+      retired.resize(slot + 1, 0.0);
+    }
+    retired[slot] += value;
+  }
+};
+
+// Registers the calling thread's cells upon construction, and folds them into
+// the registry as the thread exits.
+class Counter::ThreadCellsOwner {
+public:
+  ThreadCellsOwner() {
+    auto& registry = Registry::getInstance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.threads.push_back(&cells_);
+    tCells_ = &cells_;
+  }
+
+  ~ThreadCellsOwner() {
+    auto& registry = Registry::getInstance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    auto& threads = registry.threads;
+    threads.erase(std::find(threads.begin(), threads.end(), &cells_));
+
+    for (size_t i = 0; i < kCounterMaxChunks; i++) {
+      Chunk* chunk = cells_.chunks[i].load(std::memory_order_relaxed);
+      if (chunk == nullptr) {
+        continue;
+      }
+
+      for (size_t j = 0; j < kCounterChunkSize; j++) {
+        double value = chunk->cells[j].load(std::memory_order_relaxed);
+        if (value != 0.0) {
+          registry.retire(i * kCounterChunkSize + j, value);
+        }
+      }
+      delete chunk;
+    }
+
+    tCells_ = nullptr;
+    tDestroyed = true;
+  }
+
+  // Set once the calling thread's cells are gone, after which its adds go
+  // straight to the registry.
+  static thread_local bool tDestroyed;
+
+private:
+  ThreadCells cells_;
+};
+
+/* static */ thread_local bool Counter::ThreadCellsOwner::tDestroyed = false;
+
+Counter::Counter() {
+  auto& registry = Registry::getInstance();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+
+  if (registry.freeSlots.empty()) {
+    assertTrue(registry.nextSlot < kCounterChunkSize * kCounterMaxChunks,
+               "Too many stats::Counter-s.");
+    slot_ = registry.nextSlot++;
+  } else {
+    slot_ = registry.freeSlots.back();
+    registry.freeSlots.pop_back();
+  }
+
+  baseline_ = registry.sum(slot_);
+}
+
+Counter::~Counter() {
+  auto& registry = Registry::getInstance();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.freeSlots.push_back(slot_);
+}
+
+double Counter::read() const {
+  auto& registry = Registry::getInstance();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  return registry.sum(slot_) - baseline_;
+}
+
+void Counter::addSlowly(double delta) {
+  if (ThreadCellsOwner::tDestroyed) {
+    auto& registry = Registry::getInstance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.retire(slot_, delta);
+    return;
+  }
+
+  if (tCells_ == nullptr) {
+    static thread_local ThreadCellsOwner owner;
+  }
+
+  auto& chunk = tCells_->chunks[slot_ / kCounterChunkSize];
+  if (chunk.load(std::memory_order_relaxed) == nullptr) {
+    chunk.store(new Chunk(), std::memory_order_release);
+  }
+
+  add(delta);
+}
+} // namespace stats
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <array>
+#include <atomic>
+
+namespace stats {
+
+// Counters are handed out in chunks of this many per thread
+static const size_t kCounterChunkSize = 64;
+static const size_t kCounterMaxChunks = 1024;
+static const size_t kCounterCacheLineSize = 64;
+
+// A sum that any thread may add() to without contending with the others.
+//
+// Each thread adds to a cell of its own, and cells of different threads
+// never share a cache line. Only read() has to go around all threads to sum
+// them up, which makes it much more expensive than add().
+class Counter {
+public:
+  Counter();
+  ~Counter();
+
+  void add(double delta) {
+    std::atomic<double>* cell = getCell(slot_);
+    if (cell == nullptr) {
+      addSlowly(delta);
+      return;
+    }
+
+    // Only ever written by this thread, so no read-modify-write is needed.
+    cell->store(cell->load(std::memory_order_relaxed) + delta,
+                std::memory_order_relaxed);
+  }
+
+  double read() const;
+
+private:
+  Counter(Counter const& copy) = delete;
+  Counter& operator=(Counter const& copy) = delete;
+
+  Counter(Counter&& move) = delete;
+  Counter& operator=(Counter&& move) = delete;
+
+  class Registry;
+  class ThreadCellsOwner;
+
+  struct alignas(kCounterCacheLineSize) Chunk {
+    std::array<std::atomic<double>, kCounterChunkSize> cells{};
+  };
+
+  // A thread's cells, indexed by slot. Chunks are only ever added by the
+  // owning thread, and read by any.
+  struct ThreadCells {
+    std::array<std::atomic<Chunk*>, kCounterMaxChunks> chunks{};
+  };
+
+  // Set once the calling thread's cells are, and cleared as the thread exits
+  inline static thread_local ThreadCells* tCells_ = nullptr;
+
+  size_t slot_;
+  // What the slot's cells already added up to when we got it, as slots are
+  // reused once their counters are gone
+  double baseline_;
+
+  static std::atomic<double>* getCell(size_t slot) {
+    if (tCells_ == nullptr) {
+      return nullptr;
+    }
+
+    auto& chunks = tCells_->chunks;
+    Chunk* chunk =
+        chunks[slot / kCounterChunkSize].load(std::memory_order_relaxed);
+    return (chunk == nullptr ? nullptr
+                             : &chunk->cells[slot % kCounterChunkSize]);
+  }
+
+  void addSlowly(double delta);
+};
+} // namespace stats
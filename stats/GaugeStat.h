@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stats/StatsManager.h>
+
+#include <functional>
+
+namespace stats {
+
+// Reports whatever `read` returns at the time of each collection, for values
+// that are tracked elsewhere anyway.
+class GaugeStat : StatBase {
+public:
+  GaugeStat(std::string entity, std::string metric,
+            std::function<double()> read, LabelSet const& labels = LabelSet())
+      : StatBase(entity, metric, labels), read_(read) {}
+
+private:
+  std::function<double()> read_;
+
+  virtual double collect() override { return read_(); }
+};
+} // namespace stats
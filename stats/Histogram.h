@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+namespace stats {
+
+// Each power of two is split into 2^(kHistogramSubBucketBits - 1) linear
+// sub-buckets, so that a bucket is never wider than 1/16 of the values in it.
+static const size_t kHistogramSubBucketBits = 5;
+// Values from 2^kHistogramMaxBits on are counted in the last bucket.
+static const size_t kHistogramMaxBits = 40;
+
+// A fixed-size histogram of non-negative values, HDR-style: values below
+// 2^kHistogramSubBucketBits get a bucket each, and every power of two above
+// that gets the same number of buckets. Recording is O(1), and percentiles
+// are never more than 1/16 above the actual values.
+//
+// Histograms of the same values (e.g. from several threads, or several
+// collection intervals) can be merge()-d together.
+class Histogram {
+public:
+  void record(double value) {
+    uint64_t rounded = (value > 0 ? static_cast<uint64_t>(value + 0.5) : 0);
+    counts_[getIndex(std::min(rounded, kMaxValue))]++;
+    count_++;
+    max_ = std::max(max_, value);
+  }
+
+  void merge(Histogram const& other) {
+    for (size_t i = 0; i < kBucketCount; i++) {
+      counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    max_ = std::max(max_, other.max_);
+  }
+
+  void clear() {
+    counts_.fill(0);
+    count_ = 0;
+    max_ = 0.0;
+  }
+
+  size_t getCount() const { return count_; }
+
+  double getMax() const { return max_; }
+
+  // Returns the highest value that falls into the same bucket as the one at
+  // `percentile` (between 0 and 1), or 0 if nothing was recorded.
+  double getPercentile(double percentile) const {
+    size_t rank = std::max<size_t>(
+        1, static_cast<size_t>(std::ceil(percentile * count_)));
+    size_t seen = 0;
+
+    for (size_t i = 0; i < kBucketCount; i++) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        return std::min(static_cast<double>(getHighestValue(i)), max_);
+      }
+    }
+    return max_;
+  }
+
+private:
+  static const uint64_t kHalfSubBucketCount =
+      uint64_t{1} << (kHistogramSubBucketBits - 1);
+  static const uint64_t kMaxValue = (uint64_t{1} << kHistogramMaxBits) - 1;
+  static const size_t kBucketCount =
+      (kHistogramMaxBits - kHistogramSubBucketBits + 2) * kHalfSubBucketCount;
+
+  std::array<uint64_t, kBucketCount> counts_{};
+  size_t count_ = 0;
+  double max_ = 0.0;
+
+  // Values below 2 * kHalfSubBucketCount index themselves. Above that, a
+  // value is shifted down until it's in [kHalfSubBucketCount, 2 *
+  // kHalfSubBucketCount), and each shift adds kHalfSubBucketCount buckets.
+  static size_t getIndex(uint64_t value) {
+    if (value < 2 * kHalfSubBucketCount) {
+      return value;
+    }
+
+    size_t msb = 63 - __builtin_clzll(value);
+    size_t shift = msb - (kHistogramSubBucketBits - 1);
+    return shift * kHalfSubBucketCount + (value >> shift);
+  }
+
+  static uint64_t getHighestValue(size_t index) {
+    if (index < 2 * kHalfSubBucketCount) {
+      return index;
+    }
+
+    size_t shift = index / kHalfSubBucketCount - 1;
+    uint64_t top = index - shift * kHalfSubBucketCount;
+    return ((top + 1) << shift) - 1;
+  }
+};
+} // namespace stats
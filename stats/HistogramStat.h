@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stats/Histogram.h>
+#include <stats/StatsManager.h>
+
+namespace stats {
+
+// Records values into a Histogram, and reports the tail of what was recorded
+// since the last collection as <metric>_p50, <metric>_p90, <metric>_p99,
+// <metric>_p999 and <metric>_max.
+class HistogramStat : StatBase {
+public:
+  HistogramStat(std::string entity, std::string metric,
+                LabelSet const& labels = LabelSet())
+      : StatBase(entity, metric, labels) {
+    for (size_t i = 0; i < kPercentileCount; i++) {
+      percentileKeys_[i] = StatsManager::intern(
+          entity, metric + kPercentiles[i].first, labels.getID());
+      StatsManager::setQuantile(percentileKeys_[i], metric,
+                                kPercentiles[i].second);
+    }
+    maxKey_ = StatsManager::intern(entity, metric + "_max", labels.getID());
+  }
+
+  void accumulate(double value) { histogram_.record(value); }
+
+  // What was recorded since the last collection, to be merged with others.
+  Histogram const& getSnapshot() const { return histogram_; }
+
+private:
+  static constexpr size_t kPercentileCount = 4;
+  static constexpr std::pair<char const*, double> kPercentiles[] = {
+      {"_p50", 0.50}, {"_p90", 0.90}, {"_p99", 0.99}, {"_p999", 0.999}};
+
+  Histogram histogram_;
+  StatKey percentileKeys_[kPercentileCount];
+  StatKey maxKey_;
+
+  virtual double collect() override { return histogram_.getPercentile(0.5); }
+
+  virtual void collectInto(StatsData& data) override {
+    for (size_t i = 0; i < kPercentileCount; i++) {
+      data.emplace_back(percentileKeys_[i],
+                        histogram_.getPercentile(kPercentiles[i].second));
+    }
+    data.emplace_back(maxKey_, histogram_.getMax());
+
+    histogram_.clear();
+  }
+};
+} // namespace stats
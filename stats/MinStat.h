@@ -8,7 +8,9 @@ namespace stats {
 
 template <typename T> class MinStat : StatBase {
 public:
-  MinStat(std::string entity, std::string metric) : StatBase(entity, metric) {}
+  MinStat(std::string entity, std::string metric,
+          LabelSet const& labels = LabelSet())
+      : StatBase(entity, metric, labels) {}
 
   void accumulate(T const& value) { min_ = std::min(min_, value); }
 
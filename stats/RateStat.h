@@ -1,21 +1,27 @@
 #pragma once
 
+#include <stats/Counter.h>
 #include <stats/StatsManager.h>
 
 namespace stats {
 
 class RateStat : StatBase {
 public:
-  RateStat(std::string entity, std::string metric) : StatBase(entity, metric) {}
+  RateStat(std::string entity, std::string metric,
+           LabelSet const& labels = LabelSet())
+      : StatBase(entity, metric, labels) {}
 
-  void accumulate(double const& increment) { value_ += increment; }
+  void accumulate(double const& increment) { value_.add(increment); }
 
 private:
-  double value_ = 0.0;
+  Counter value_;
+  // Only touched by collect(), as other threads may be adding to value_
+  double collected_ = 0.0;
 
   virtual double collect() override {
-    auto result = value_;
-    value_ = 0.0;
+    double total = value_.read();
+    double result = total - collected_;
+    collected_ = total;
     return result;
   }
 };
@@ -1,22 +1,26 @@
 #pragma once
 
+#include <stats/Counter.h>
 #include <stats/StatsManager.h>
 
 namespace stats {
 
 class RatioStat : StatBase {
 public:
-  RatioStat(std::string entity, std::string metric)
-      : StatBase(entity, metric) {}
+  RatioStat(std::string entity, std::string metric,
+            LabelSet const& labels = LabelSet())
+      : StatBase(entity, metric, labels) {}
 
   void accumulate(double numerator, double denominator) {
-    numerator_ += numerator;
-    denominator_ += denominator;
+    numerator_.add(numerator);
+    denominator_.add(denominator);
   }
 
 private:
-  double numerator_ = 0.0, denominator_ = 0.0;
+  Counter numerator_, denominator_;
 
-  virtual double collect() override { return numerator_ / denominator_; }
+  virtual double collect() override {
+    return numerator_.read() / denominator_.read();
+  }
 };
 } // namespace stats
@@ -1,14 +1,26 @@
 #include "stats/StatsManager.h"
 
+#include <algorithm>
+#include <sstream>
+
 namespace stats {
 
-/* static */ size_t StatBase::seq_ = 0;
+LabelSet::LabelSet(Labels labels) {
+  std::sort(labels.begin(), labels.end());
+  registration_.reset(
+      new Registration{StatsManager::registerLabels(std::move(labels))});
+}
+
+LabelSet::Registration::~Registration() { StatsManager::releaseLabels(id); }
+
+/* static */ std::atomic<size_t> StatBase::seq_{0};
 
 StatBase::StatBase(std::string entity, std::string metric,
+                   LabelSet const& labels /* = LabelSet() */,
                    Prefix prefix /* = Prefix::None */)
-    : entity_(entity), metric_(metric) {
-  id_ = StatBase::seq_;
-  StatBase::seq_++;
+    : entity_(entity), metric_(metric), labels_(labels),
+      key_(StatsManager::intern(entity, metric, labels.getID())) {
+  id_ = StatBase::seq_++;
   prefix_ = prefix;
   StatsManager::addStat(this);
 }
@@ -21,10 +33,232 @@ StatBase::StatBase(std::string entity, std::string metric,
 }
 
 /* static */ void StatsManager::addStat(StatBase* stat) {
-  getInstance().stats_.insert(stat);
+  auto& instance = getInstance();
+  std::lock_guard<std::mutex> lock(instance.mutex_);
+  instance.stats_.insert(stat);
 }
 
 /* static */ void StatsManager::removeStat(StatBase* stat) {
-  getInstance().stats_.erase(stat);
+  auto& instance = getInstance();
+  std::lock_guard<std::mutex> lock(instance.mutex_);
+  instance.stats_.erase(stat);
+}
+
+/* static */ StatKey StatsManager::intern(std::string const& entity,
+                                          std::string const& metric,
+                                          LabelSetID labels /* = 0 */) {
+  auto& instance = getInstance();
+  std::lock_guard<std::mutex> lock(instance.mutex_);
+
+  auto name = std::make_tuple(entity, metric, labels);
+  auto it = instance.keys_.find(name);
+  if (it != instance.keys_.end()) {
+    return it->second;
+  }
+
+  StatKey key;
+  if (instance.freeKeys_.empty()) {
+    key = static_cast<StatKey>(instance.names_.size());
+    instance.names_.emplace_back();
+  } else {
+    key = instance.freeKeys_.back();
+    instance.freeKeys_.pop_back();
+  }
+
+  instance.names_[key] = StatName{entity, metric, labels, std::nullopt};
+  instance.keys_.emplace(std::move(name), key);
+  instance.generation_++;
+  return key;
+}
+
+/* static */ std::string const& StatsManager::getEntity(StatKey key) {
+  auto& instance = getInstance();
+  std::lock_guard<std::mutex> lock(instance.mutex_);
+  return instance.names_[key].entity;
+}
+
+/* static */ std::string const& StatsManager::getMetric(StatKey key) {
+  auto& instance = getInstance();
+  std::lock_guard<std::mutex> lock(instance.mutex_);
+  return instance.names_[key].metric;
+}
+
+/* static */ Labels const& StatsManager::getLabels(StatKey key) {
+  auto& instance = getInstance();
+  std::lock_guard<std::mutex> lock(instance.mutex_);
+  return instance.labelSets_[instance.names_[key].labels];
+}
+
+/* static */ StatInfo StatsManager::describe(StatKey key) {
+  auto& instance = getInstance();
+  std::lock_guard<std::mutex> lock(instance.mutex_);
+
+  auto const& name = instance.names_[key];
+  return StatInfo{name.entity, name.metric, instance.labelSets_[name.labels],
+                  name.quantile};
+}
+
+/* static */ void StatsManager::setQuantile(StatKey key,
+                                            std::string const& metric,
+                                            double quantile) {
+  auto& instance = getInstance();
+  std::lock_guard<std::mutex> lock(instance.mutex_);
+  instance.names_[key].quantile = std::make_pair(metric, quantile);
+  instance.generation_++;
+}
+
+/* static */ uint64_t StatsManager::getGeneration() {
+  auto& instance = getInstance();
+  std::lock_guard<std::mutex> lock(instance.mutex_);
+  return instance.generation_;
+}
+
+/* static */ LabelSetID StatsManager::registerLabels(Labels labels) {
+  auto& instance = getInstance();
+  std::lock_guard<std::mutex> lock(instance.mutex_);
+
+  LabelSetID id = instance.nextLabelSetID_++;
+  instance.labelSets_.emplace(id, std::move(labels));
+  return id;
+}
+
+/* static */ void StatsManager::releaseLabels(LabelSetID id) {
+  auto& instance = getInstance();
+  std::lock_guard<std::mutex> lock(instance.mutex_);
+
+  instance.labelSets_.erase(id);
+
+  auto& keys = instance.keys_;
+  for (auto it = keys.begin(); it != keys.end();) {
+    if (std::get<2>(it->first) != id) {
+      it++;
+      continue;
+    }
+
+    instance.names_[it->second] = StatName{};
+    instance.freeKeys_.push_back(it->second);
+    it = keys.erase(it);
+  }
+
+  instance.generation_++;
+}
+
+/* static */ std::string StatsManager::formatLabels(Labels const& labels) {
+  if (labels.empty()) {
+    return "";
+  }
+
+  std::ostringstream output;
+  output << "{";
+  for (size_t i = 0; i < labels.size(); i++) {
+    output << (i == 0 ? "" : ",") << labels[i].first << "="
+           << labels[i].second;
+  }
+  output << "}";
+  return output.str();
+}
+
+// Whether `labels` has all of `filter`. Both are sorted by name.
+static bool matchLabels(Labels const& labels, Labels const& filter) {
+  return std::includes(labels.begin(), labels.end(), filter.begin(),
+                       filter.end());
+}
+
+/* static */ std::vector<Sample>
+StatsManager::query(SubscribeData const& data, LabelQuery const& query) {
+  std::vector<std::optional<size_t>> sampleOf;
+  auto samples = group(data, query, sampleOf);
+
+  for (size_t i = 0; i < data.size(); i++) {
+    if (!!sampleOf[i]) {
+      samples[*sampleOf[i]].value += data[i].second;
+    }
+  }
+  return samples;
+}
+
+/* static */ std::vector<Sample>
+StatsManager::group(SubscribeData const& data, LabelQuery const& query,
+                    std::vector<std::optional<size_t>>& sampleOf) {
+  using Group = std::tuple<std::string, std::string, Labels>;
+
+  auto& instance = getInstance();
+  auto filter = query.filter;
+  std::sort(filter.begin(), filter.end());
+
+  std::map<Group, size_t> groups;
+  std::vector<std::map<Group, size_t>::iterator> groupOf(data.size(),
+                                                         groups.end());
+
+  {
+    std::lock_guard<std::mutex> lock(instance.mutex_);
+
+    for (size_t i = 0; i < data.size(); i++) {
+      auto const& name = instance.names_[data[i].first];
+      auto const& labels = instance.labelSets_[name.labels];
+      if (!matchLabels(labels, filter)) {
+        continue;
+      }
+
+      Labels kept;
+      if (!query.groupBy) {
+        kept = labels;
+      } else {
+        for (auto const& label : labels) {
+          auto const& groupBy = *query.groupBy;
+          if (std::find(groupBy.begin(), groupBy.end(), label.first) !=
+              groupBy.end()) {
+            kept.push_back(label);
+          }
+        }
+      }
+
+      auto group = std::make_tuple(name.entity, name.metric, std::move(kept));
+      groupOf[i] = groups.emplace(std::move(group), 0).first;
+    }
+  }
+
+  std::vector<Sample> samples;
+  samples.reserve(groups.size());
+  for (auto& group : groups) {
+    group.second = samples.size();
+    samples.push_back(Sample{std::get<0>(group.first),
+                             std::get<1>(group.first),
+                             std::get<2>(group.first), 0.0});
+  }
+
+  sampleOf.assign(data.size(), std::nullopt);
+  for (size_t i = 0; i < data.size(); i++) {
+    if (groupOf[i] != groups.end()) {
+      sampleOf[i] = groupOf[i]->second;
+    }
+  }
+  return samples;
+}
+
+/* static */ void StatsManager::collect() {
+  auto& instance = getInstance();
+  auto& data = instance.data_;
+  data.clear();
+
+  {
+    std::lock_guard<std::mutex> lock(instance.mutex_);
+    for (auto stat : instance.stats_) {
+      stat->collectInto(data);
+    }
+  }
+
+  // Keeps the last of each key
+  std::stable_sort(
+      data.begin(), data.end(),
+      [](auto const& a, auto const& b) { return a.first < b.first; });
+  auto last = std::unique(
+      data.rbegin(), data.rend(),
+      [](auto const& a, auto const& b) { return a.first == b.first; });
+  data.erase(data.begin(), last.base());
+
+  for (auto const& callback : instance.callbacks_) {
+    callback(data);
+  }
 }
 } // namespace stats
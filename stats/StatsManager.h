@@ -1,12 +1,21 @@
 #pragma once
 
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
 #include <functional>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <queue>
 #include <set>
 #include <string>
+#include <tuple>
+#include <vector>
 
 namespace stats {
 
@@ -20,55 +29,142 @@ enum Prefix {
 
 class StatsManager;
 
+// An (entity, metric, labels) triple, interned by StatsManager::intern()
+using StatKey = uint32_t;
+
+using StatsData = std::vector<std::pair<StatKey, double>>;
+
+// (name, value) pairs, e.g. {"user", "alice"}, kept sorted by name
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+using LabelSetID = uint32_t;
+
+// Labels registered with the StatsManager, to be shared by the stats of e.g.
+// a session. The registration goes away along with the last copy of the
+// LabelSet, which is normally held by the stats themselves.
+class LabelSet {
+public:
+  // No labels at all
+  LabelSet() = default;
+  explicit LabelSet(Labels labels);
+
+  LabelSetID getID() const { return !registration_ ? 0 : registration_->id; }
+
+private:
+  struct Registration {
+    LabelSetID id;
+    ~Registration();
+  };
+
+  std::shared_ptr<Registration> registration_;
+};
+
 class StatBase {
 protected:
   StatBase(std::string entity, std::string metric,
-           Prefix prefix = Prefix::None);
+           LabelSet const& labels = LabelSet(), Prefix prefix = Prefix::None);
   virtual ~StatBase();
 
 protected:
   std::string entity_;
   std::string metric_;
+  LabelSet labels_;
+  StatKey key_;
 
 private:
-  static size_t seq_;
+  // Stats are created from more than one thread
+  static std::atomic<size_t> seq_;
 
   size_t id_;
   Prefix prefix_;
 
   virtual double collect() = 0;
 
+  // Stats that report more than one value (e.g. percentiles) override this
+  // to add each of them under a metric of their own.
+  virtual void collectInto(StatsData& data) {
+    data.emplace_back(key_, collect());
+  }
+
   friend class StatsManager;
 };
 
+// Picks out the collected values of the stats whose labels include all of
+// `filter`. With `groupBy` set, values that then only differ in the other
+// labels are added up, which makes sense for counts and rates but not for
+// averages or percentiles.
+struct LabelQuery {
+  Labels filter;
+  std::optional<std::vector<std::string>> groupBy;
+};
+
+struct Sample {
+  std::string entity;
+  std::string metric;
+  Labels labels;
+  double value;
+};
+
+// All there is to know about a key, for exporters that want more than the
+// names (e.g. to tell the percentiles of a histogram apart).
+struct StatInfo {
+  std::string entity;
+  std::string metric;
+  Labels labels;
+  // Set on the keys of the percentiles a HistogramStat reports, with the
+  // metric of the histogram as a whole and the percentile (between 0 and 1)
+  std::optional<std::pair<std::string, double>> quantile;
+};
+
 class StatsManager {
 public:
-  using SubscribeData = std::map<std::pair<std::string, std::string>, double>;
+  using SubscribeData = StatsData;
   using SubscribeCallback = std::function<void(SubscribeData const&)>;
 
   static void addStat(StatBase* stat);
   static void removeStat(StatBase* stat);
 
+  // Returns the same key for the same (entity, metric, labels) every time, so
+  // that collection doesn't have to deal with the strings at all.
+  static StatKey intern(std::string const& entity, std::string const& metric,
+                        LabelSetID labels = 0);
+  static std::string const& getEntity(StatKey key);
+  static std::string const& getMetric(StatKey key);
+  static Labels const& getLabels(StatKey key);
+  static StatInfo describe(StatKey key);
+
+  // Marks `key` as the given percentile of the histogram `metric`.
+  static void setQuantile(StatKey key, std::string const& metric,
+                          double quantile);
+
+  // Changes whenever a key comes, goes or changes meaning, so that exporters
+  // can cache what they derive from the keys until then.
+  static uint64_t getGeneration();
+
   static void subscribe(SubscribeCallback callback) {
     getInstance().callbacks_.push_back(callback);
   }
 
   // Collects all the stats the send the aggregated data to all the subscribed
-  // callbacks.
-  static void collect() {
-    auto data = SubscribeData{};
+  // callbacks, sorted by key. Where several stats share a key, the last one
+  // collected wins.
+  static void collect();
 
-    for (auto stat : getInstance().stats_) {
-      data[std::make_pair(stat->entity_, stat->metric_)] = stat->collect();
-    }
+  // Sorted by entity, metric and then labels
+  static std::vector<Sample> query(SubscribeData const& data,
+                                   LabelQuery const& query);
 
-    for (auto const& callback : getInstance().callbacks_) {
-      callback(data);
-    }
-  }
+  // Works out the samples query() would return, without adding up any values:
+  // `sampleOf` gets which of them each entry of `data` goes into, if any. For
+  // callers that run the same query over and over on data with the same keys.
+  static std::vector<Sample>
+  group(SubscribeData const& data, LabelQuery const& query,
+        std::vector<std::optional<size_t>>& sampleOf);
 
-  template <typename O> static void dump(O& output, SubscribeData const& data) {
-    dump(output, data,
+  template <typename O>
+  static void dump(O& output, SubscribeData const& data,
+                   LabelQuery const& query = LabelQuery()) {
+    dump(output, data, query,
          [](std::string const&, std::string const&) { return true; });
   }
 
@@ -76,46 +172,75 @@ public:
   static void
   dump(O& output, SubscribeData const& data,
        std::function<bool(std::string const&, std::string const&)> filter) {
-    auto byEntity =
-        std::map<std::string, std::vector<std::pair<std::string, double>>>{};
+    dump(output, data, LabelQuery(), filter);
+  }
 
-    for (auto const& entry : data) {
-      byEntity[entry.first.first].push_back(
-          std::make_pair(entry.first.second, entry.second));
+  template <typename O>
+  static void
+  dump(O& output, SubscribeData const& data, LabelQuery const& query,
+       std::function<bool(std::string const&, std::string const&)> filter) {
+    // Each entity and label combination gets a line of its own
+    auto byEntity = std::map<std::string, std::vector<Sample const*>>{};
+    auto samples = StatsManager::query(data, query);
+
+    for (auto const& sample : samples) {
+      if (filter(sample.entity, sample.metric)) {
+        byEntity[sample.entity + formatLabels(sample.labels)].push_back(
+            &sample);
+      }
     }
 
     for (auto const& entity : byEntity) {
-      std::vector<std::pair<std::string, double>> filteredStats;
-      for (auto const& stat : entity.second) {
-        if (filter(entity.first, stat.first)) {
-          filteredStats.push_back(stat);
-        }
-      }
-      if (filteredStats.empty()) {
-        continue;
-      }
-
       output << std::left << std::setw(kNamePaddingLength) << entity.first
              << ": ";
       bool isFirst = true;
-      for (auto const& stat : filteredStats) {
+      for (auto const& sample : entity.second) {
         if (isFirst) {
           isFirst = false;
         } else {
           output << ", ";
         }
-        output << stat.first << " = " << stat.second;
+        output << sample->metric << " = " << sample->value;
       }
       output << std::endl;
     }
   }
 
+  // Formats as {name=value,...}, or an empty string without any labels
+  static std::string formatLabels(Labels const& labels);
+
 private:
   static const size_t kNamePaddingLength = 10;
 
+  struct StatName {
+    std::string entity;
+    std::string metric;
+    LabelSetID labels;
+    std::optional<std::pair<std::string, double>> quantile;
+  };
+
+  // Guards the registered stats, the interned keys and the label sets, as
+  // stats may come and go on any thread.
+  std::mutex mutex_;
   std::set<StatBase*> stats_;
+  std::map<std::tuple<std::string, std::string, LabelSetID>, StatKey> keys_;
+  // Indexed by StatKey. A deque doesn't move what it holds when it grows.
+  std::deque<StatName> names_;
+  // Keys of the label sets that are gone, up for reuse
+  std::vector<StatKey> freeKeys_;
+  std::map<LabelSetID, Labels> labelSets_;
+  LabelSetID nextLabelSetID_ = 1;
+  uint64_t generation_ = 0;
+
   std::vector<SubscribeCallback> callbacks_;
+  StatsData data_;
 
   static StatsManager& getInstance();
+
+  static LabelSetID registerLabels(Labels labels);
+  // Forgets the label set, along with all the keys interned with it.
+  static void releaseLabels(LabelSetID id);
+
+  friend class LabelSet;
 };
 } // namespace stats
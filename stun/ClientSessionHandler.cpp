@@ -1,5 +1,6 @@
 #include "stun/ClientSessionHandler.h"
 
+#include "stun/HeaderContextResync.h"
 #include "stun/LossEstimatorHeartbeatService.h"
 
 #include <event/SignalCondition.h>
@@ -50,6 +51,8 @@ void ClientSessionHandler::attachHandlers() {
             {messenger_->didDisconnect()}, [this]() { didEnd_->fire(); });
 
   messenger_->addHandler("config", [this](auto const& message) {
+    messenger_->setAuthenticated();
+
     auto body = message.getBody();
 
     size_t mtu = config_.mtu;
@@ -79,6 +82,7 @@ void ClientSessionHandler::attachHandlers() {
     };
 
     auto tunnelPromise = tunnelFactory_(tunnelConfig);
+    bool headerCompression = body.value("header_compression", false);
 
     LOG_I("Session") << "Received config from the server." << std::endl;
 
@@ -89,12 +93,17 @@ void ClientSessionHandler::attachHandlers() {
 
     loop_.arm("stun::ClientSessionHandler::tunnelPromiseReadyTrigger",
               {tunnelPromise->isReady(), messenger_->outboundQ->canPush()},
-              [this, tunnelPromise]() {
+              [this, tunnelPromise, headerCompression]() {
                 LOG_I("Session") << "Tunnel established." << std::endl;
-                dispatcher_.reset(
-                    new Dispatcher(loop_, tunnelPromise->consume()));
+                dispatcher_.reset(new Dispatcher(
+                    loop_, tunnelPromise->consume(),
+                    Dispatcher::Config{config_.flowPinning,
+                                       headerCompression,
+                                       config_.traceSampleInterval,
+                                       createStatLabels()}));
                 messenger_->addHeartbeatService(
                     buildLossEstimatorHeartbeatService(*dispatcher_));
+                setUpHeaderContextResync(*messenger_, *dispatcher_);
 
                 // TODO: Set up DNS servers
 
@@ -115,18 +124,27 @@ void ClientSessionHandler::attachHandlers() {
       dataPipeType = body["type"];
     }
 
-    auto coreConfig = [dataPipeType, &socketAddress]() -> DataPipe::CoreConfig {
+    auto coreConfig = [this, dataPipeType,
+                       &socketAddress]() -> DataPipe::CoreConfig {
       switch (dataPipeType) {
       case DataPipeType::UDP:
         return UDPCoreDataPipe::ClientConfig{std::move(socketAddress)};
       case DataPipeType::TCP:
-        return TCPCoreDataPipe::ClientConfig{std::move(socketAddress)};
+        return TCPCoreDataPipe::ClientConfig{std::move(socketAddress),
+                                             config_.tcpOptions};
       }
     }();
     auto dataPipeConfig = DataPipe::Config{
         coreConfig,
         DataPipe::CommonConfig{body["aes_key"], body["padding_to_size"],
-                               body["compression"], 0s}};
+                               body["compression"], 0s,
+                               body.value("sequencing", false),
+                               config_.reorderLatencyBudget,
+                               body.value("fec_group_size", size_t{0}),
+                               body.value("coalesce_to", size_t{0}),
+                               config_.coalescingDelay,
+                               body.value("pacing", false),
+                               config_.priorityQueuing}};
     auto dataPipe =
         std::make_unique<DataPipe>(loop_, std::move(dataPipeConfig));
 
@@ -152,4 +170,11 @@ void ClientSessionHandler::attachHandlers() {
     return Message::disconnect();
   });
 }
+
+stats::LabelSet ClientSessionHandler::createStatLabels() const {
+  if (config_.user.empty()) {
+    return stats::LabelSet();
+  }
+  return stats::LabelSet({{"user", config_.user}});
+}
 } // namespace stun
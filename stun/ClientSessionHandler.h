@@ -38,6 +38,12 @@ public:
   std::string user;
   size_t mtu;
   bool acceptDNSPushes;
+  bool flowPinning;
+  event::Duration reorderLatencyBudget;
+  event::Duration coalescingDelay;
+  bool priorityQueuing;
+  size_t traceSampleInterval;
+  TCPCoreDataPipe::SocketOptions tcpOptions;
 
   std::vector<SubnetAddress> subnetsToForward;
   std::vector<SubnetAddress> subnetsToExclude;
@@ -73,5 +79,6 @@ private:
   std::unique_ptr<event::BaseCondition> didEnd_;
 
   void attachHandlers();
+  stats::LabelSet createStatLabels() const;
 };
 } // namespace stun
@@ -2,6 +2,8 @@
 
 #include <event/Trigger.h>
 
+#include <arpa/inet.h>
+
 #include <chrono>
 
 namespace stun {
@@ -10,6 +12,12 @@ using namespace std::chrono_literals;
 
 static const event::Duration kDataPipeProbeInterval = 1s;
 
+// How long a partially filled FEC group may wait for more packets before its
+// parity is sent anyway.
+static const event::Duration kDataPipeFECFlushInterval = 20ms;
+
+using DataPipeSequenceType = uint32_t;
+
 #if TARGET_IOS
 static const size_t kDataPipeFIFOSize = 16;
 #else
@@ -50,8 +58,15 @@ private:
 
 DataPipe::DataPipe(event::EventLoop& loop, Config config)
     : inboundQ(new event::FIFO<DataPacket>(loop, kDataPipeFIFOSize)),
-      outboundQ(new event::FIFO<DataPacket>(loop, kDataPipeFIFOSize)),
       loop_(loop), config_{config}, didClose_(loop.createBaseCondition()) {
+  if (config_.common.priorityQueuing) {
+    outboundQ.reset(new event::PriorityFIFO<DataPacket>(
+        loop, kDataPipeFIFOSize, PacketClassifier::getClasses(),
+        PacketClass::Default, true));
+  } else {
+    outboundQ.reset(
+        new event::PriorityFIFO<DataPacket>(loop, kDataPipeFIFOSize));
+  }
 
   core_ = std::visit(CoreDataPipeFactory{loop_}, config.core);
 
@@ -77,9 +92,77 @@ DataPipe::DataPipe(event::EventLoop& loop, Config config)
         new crypto::AESEncryptor(crypto::AESKey(config_.common.aesKey)));
   }
 
+  // Set up sequencing
+  if (config_.common.sequencing) {
+    sequenceWindow_.reset(new SequenceWindow());
+
+    if (config_.common.reorderLatencyBudget != 0s) {
+      reorderBuffer_.reset(
+          new ReorderBuffer(config_.common.reorderLatencyBudget));
+      reorderTimer_ = loop_.createTimer();
+      reorderReleaser_ = loop_.createAction("stun::DataPipe::reorderReleaser_",
+                                            {reorderTimer_->didFire()});
+      reorderReleaser_->callback
+          .setMethod<DataPipe, &DataPipe::doReleaseReordered>(this);
+    }
+  }
+
+  // Set up FEC
+  if (config_.common.fecGroupSize != 0) {
+    fecEncoder_.reset(new FECEncoder(config_.common.fecGroupSize));
+    fecDecoder_.reset(new FECDecoder());
+    fecFlushTimer_ = loop_.createTimer();
+    fecFlusher_ = loop_.createAction("stun::DataPipe::fecFlusher_",
+                                     {fecFlushTimer_->didFire()});
+    fecFlusher_->callback.setMethod<DataPipe, &DataPipe::doFlushFEC>(this);
+  }
+
+  // Set up coalescing
+  if (config_.common.coalescingSize != 0) {
+    size_t capacity = DataPacket::Size - getEnvelopeOverhead(config_.common);
+    if (config_.common.coalescingSize > capacity) {
+      LOG_I("DataPipe") << "Coalescing into bundles of " << capacity
+                        << " bytes instead of "
+                        << config_.common.coalescingSize
+                        << " to leave room for FEC, padding and encryption."
+                        << std::endl;
+    }
+    coalescer_.reset(
+        new PacketCoalescer(config_.common.coalescingSize, capacity));
+    coalescingTimer_ = loop_.createTimer();
+    coalescingFlusher_ = loop_.createAction(
+        "stun::DataPipe::coalescingFlusher_", {coalescingTimer_->didFire()});
+    coalescingFlusher_->callback
+        .setMethod<DataPipe, &DataPipe::doFlushCoalesced>(this);
+  }
+
+  // Set up pacing
+  isPacerReady_ = loop_.createComputedCondition();
+  isPacerReady_->expression = [this]() {
+    return !isPaced() || pacer->isReady(event::Timer::getTime());
+  };
+  if (config_.common.pacing) {
+    pacingTimer_ = loop_.createTimer();
+    pacingWaker_ = loop_.createAction("stun::DataPipe::pacingWaker_",
+                                      {pacingTimer_->didFire()});
+    pacingWaker_->callback.setMethod<DataPipe, &DataPipe::doWakeFromPacing>(
+        this);
+  }
+
+  hasPendingInbound_ = loop_.createComputedCondition();
+  hasPendingInbound_->expression = [this]() {
+    return !pendingInbound_.empty();
+  };
+  pendingInboundDeliverer_ = loop_.createAction(
+      "stun::DataPipe::pendingInboundDeliverer_",
+      {hasPendingInbound_.get(), inboundQ->canPush()});
+  pendingInboundDeliverer_->callback
+      .setMethod<DataPipe, &DataPipe::doDeliverPendingInbound>(this);
+
   // Configure sender and receiver
-  sender_ = loop_.createAction("stun::DataPipe::sender_",
-                               {outboundQ->canPop(), core_->canSend()});
+  sender_ = loop_.createAction(
+      "stun::DataPipe::sender_",
+      {outboundQ->canPop(), core_->canSend(), isPacerReady_.get()});
   sender_->callback.setMethod<DataPipe, &DataPipe::doSend>(this);
   receiver_ = loop_.createAction("stun::DataPipe::receiver_",
                                  {inboundQ->canPush(), core_->canReceive()});
@@ -92,12 +175,47 @@ DataPipe::DataPipe(event::EventLoop& loop, Config config)
   prober_->callback.setMethod<DataPipe, &DataPipe::doProbe>(this);
 } // namespace stun
 
+/* static */ size_t DataPipe::getMaxPayloadSize(CommonConfig const& config) {
+  size_t overhead = getEnvelopeOverhead(config);
+  if (config.sequencing) {
+    overhead += sizeof(DataPipeSequenceType);
+  }
+  if (config.coalescingSize != 0) {
+    overhead += PacketCoalescer::Overhead;
+  }
+
+  return DataPacket::Size - overhead;
+}
+
+// What's added to each bundle (or each packet, without coalescing) on its way
+// to the wire.
+/* static */ size_t
+DataPipe::getEnvelopeOverhead(CommonConfig const& config) {
+  size_t overhead = 0;
+  if (config.fecGroupSize != 0) {
+    overhead += FECEncoder::Overhead;
+  }
+  if (config.minPaddingTo != 0) {
+    overhead += crypto::Padder::Overhead;
+  }
+  if (!config.aesKey.empty()) {
+    overhead += crypto::AESEncryptor::Overhead;
+  }
+
+  return overhead;
+}
+
 event::Condition* DataPipe::didClose() { return didClose_.get(); }
 
 void DataPipe::doKill() {
   sender_.reset();
   receiver_.reset();
   prober_.reset();
+  reorderReleaser_.reset();
+  fecFlusher_.reset();
+  coalescingFlusher_.reset();
+  pacingWaker_.reset();
+  pendingInboundDeliverer_.reset();
   didClose_->fire();
 }
 
@@ -107,44 +225,230 @@ void DataPipe::doProbe() {
 }
 
 void DataPipe::doSend() {
-  while (outboundQ->canPop()->eval()) {
+  // The core might run out of room (e.g. the TCP send ring) before we run out
+  // of packets.
+  while (outboundQ->canPop()->eval() && core_->canSend()->eval()) {
+    if (isPaced() && !checkPacer()) {
+      break;
+    }
+
     DataPacket data = outboundQ->pop();
+    PacketTracer::mark(data, TxDequeued);
 
     size_t payloadSize = data.size;
 
+    if (!!sequenceWindow_) {
+      DataPipeSequenceType seq = htonl(nextSequence_++);
+      data.fill(reinterpret_cast<Byte*>(&seq), sizeof(seq), data.size);
+    }
     if (!!compressor_) {
       data.size = compressor_->encrypt(data.data, data.size, data.capacity);
     }
-    if (!!padder_) {
-      data.size = padder_->encrypt(data.data, data.size, data.capacity);
+
+    if (!coalescer_) {
+      if (!sendProtected(std::move(data), payloadSize)) {
+        return;
+      }
+      continue;
     }
-    if (!!aesEncryptor_) {
-      data.size = aesEncryptor_->encrypt(data.data, data.size, data.capacity);
+
+    if (!coalescer_->canBundle(data)) {
+      // A bundle carries nothing but length-prefixed packets, so there's no
+      // way to slip this one past the coalescer.
+      LOG_E("DataPipe") << "Dropped a packet of size " << data.size
+                        << " too big to be coalesced." << std::endl;
+      continue;
+    }
+    if (!coalescer_->canAppend(data) && !flushCoalesced()) {
+      return;
+    }
+    if (coalescer_->empty() && config_.common.coalescingDelay != 0s) {
+      coalescingDeadline_ =
+          event::Timer::getTime() + config_.common.coalescingDelay;
+      coalescingTimer_->reset(config_.common.coalescingDelay);
     }
+    coalescer_->append(data);
+    coalescedPayloadSize_ += payloadSize;
+    if (!!data.trace && !coalescedTrace_) {
+      coalescedTrace_ = std::move(data.trace);
+    }
+  }
+
+  if (!!coalescer_ && !coalescer_->empty() &&
+      config_.common.coalescingDelay == 0s) {
+    // Nothing more to wait for
+    flushCoalesced();
+  }
+}
 
-    if (statEfficiency != nullptr) {
-      statEfficiency->accumulate(payloadSize, data.size);
+bool DataPipe::isPaced() const {
+  return config_.common.pacing && pacer != nullptr && pacer->getRate() != 0;
+}
+
+bool DataPipe::checkPacer() {
+  auto now = event::Timer::getTime();
+
+  if (!pacer->isReady(now)) {
+    // The sender_ is held back until the pacer is ready again, and the timer
+    // makes sure that the event loop looks again by then.
+    if (!pacedSince_) {
+      pacedSince_ = now;
     }
+    pacer->markLimited();
+    pacingTimer_->reset(pacer->getWait(now));
+    return false;
+  }
 
-    try {
-      if (!core_->send(std::move(data))) {
-        LOG_E("DataPipe") << "Dropped a packet due to send() failure."
-                          << std::endl;
-      }
-    } catch (networking::SocketClosedException const& ex) {
-      // TODO: SocketClosedException should not leak outside of CoreDataPipe
-      LOG_E("DataPipe") << "While sending: " << ex.what() << std::endl;
-      doKill();
-      return;
+  if (!!pacedSince_) {
+    if (pacingStats != nullptr) {
+      pacingStats->statDelay.accumulate(
+          std::chrono::duration_cast<event::Duration>(now - *pacedSince_)
+              .count());
     }
+    pacedSince_.reset();
+  }
+  return true;
+}
+
+void DataPipe::doWakeFromPacing() {
+  // Nothing to send here. Once the timer is disarmed, the sender_ takes over.
+  pacingTimer_->reset();
+
+  if (!outboundQ->canPop()->eval()) {
+    pacedSince_.reset();
+  }
+}
 
-    LOG_VV("DataPipe") << "Sent a packet. Payload size " << payloadSize
-                       << ", wire size " << data.size << "." << std::endl;
+void DataPipe::doFlushCoalesced() {
+  if (coalescer_->empty()) {
+    return;
+  }
+
+  // The timer may still carry a deadline meant for an earlier bundle
+  auto now = event::Timer::getTime();
+  if (now < coalescingDeadline_) {
+    coalescingTimer_->reset(
+        std::chrono::duration_cast<event::Duration>(coalescingDeadline_ - now));
+    return;
+  }
+
+  flushCoalesced();
+}
+
+bool DataPipe::flushCoalesced() {
+  if (statCoalescing != nullptr) {
+    statCoalescing->accumulate(coalescer_->getCount());
+  }
+
+  size_t payloadSize = coalescedPayloadSize_;
+  coalescedPayloadSize_ = 0;
+  DataPacket bundle = coalescer_->flush();
+  bundle.trace = std::move(coalescedTrace_);
+  return sendProtected(std::move(bundle), payloadSize);
+}
+
+bool DataPipe::sendProtected(DataPacket data, size_t payloadSize) {
+  if (!fecEncoder_) {
+    return sendEncoded(std::move(data), payloadSize);
+  }
+
+  if (!FECEncoder::canEncode(data)) {
+    LOG_E("DataPipe") << "Dropped a packet of size " << data.size
+                      << " with no room left for FEC." << std::endl;
+    return true;
+  }
+
+  bool startsGroup = !fecEncoder_->hasPendingGroup();
+  auto parity = fecEncoder_->encode(data);
+
+  if (!sendEncoded(std::move(data), payloadSize)) {
+    return false;
+  }
+
+  if (!!parity) {
+    if (fecStats != nullptr) {
+      fecStats->statParity.accumulate(1);
+    }
+    return sendEncoded(std::move(*parity), 0);
+  }
+
+  if (startsGroup) {
+    fecFlushDeadline_ = event::Timer::getTime() + kDataPipeFECFlushInterval;
+    fecFlushTimer_->reset(kDataPipeFECFlushInterval);
+  }
+  return true;
+}
+
+bool DataPipe::sendEncoded(DataPacket data, size_t payloadSize) {
+  PacketTracer::mark(data, TxPreEncrypt);
+  if (!!padder_) {
+    data.size = padder_->encrypt(data.data, data.size, data.capacity);
+  }
+  if (!!aesEncryptor_) {
+    data.size = aesEncryptor_->encrypt(data.data, data.size, data.capacity);
+  }
+  PacketTracer::mark(data, TxPostEncrypt);
+
+  if (statEfficiency != nullptr) {
+    statEfficiency->accumulate(payloadSize, data.size);
+  }
+
+  size_t wireSize = data.size;
+  auto trace = std::move(data.trace);
+
+  if (isPaced()) {
+    pacer->consume(wireSize, event::Timer::getTime());
+  }
+
+  try {
+    if (!core_->send(std::move(data))) {
+      LOG_E("DataPipe") << "Dropped a packet due to send() failure."
+                        << std::endl;
+    }
+  } catch (networking::SocketClosedException const& ex) {
+    // TODO: SocketClosedException should not leak outside of CoreDataPipe
+    LOG_E("DataPipe") << "While sending: " << ex.what() << std::endl;
+    doKill();
+    return false;
+  }
+
+  if (!!trace && tracer != nullptr) {
+    trace->mark(TxSent);
+    tracer->finishTx(std::move(trace));
+  }
+
+  LOG_VV("DataPipe") << "Sent a packet. Payload size " << payloadSize
+                     << ", wire size " << wireSize << "." << std::endl;
+  return true;
+}
+
+void DataPipe::doFlushFEC() {
+  if (!fecEncoder_->hasPendingGroup()) {
+    return;
+  }
+
+  // The timer may still carry a deadline meant for an earlier group
+  auto now = event::Timer::getTime();
+  if (now < fecFlushDeadline_) {
+    fecFlushTimer_->reset(
+        std::chrono::duration_cast<event::Duration>(fecFlushDeadline_ - now));
+    return;
+  }
+
+  if (fecStats != nullptr) {
+    fecStats->statParity.accumulate(1);
+  }
+  sendEncoded(*fecEncoder_->flush(), 0);
+}
+
+void DataPipe::adaptFEC(double lossRate) {
+  if (!!fecEncoder_) {
+    fecEncoder_->adapt(lossRate);
   }
 }
 
 void DataPipe::doReceive() {
-  while (inboundQ->canPush()->eval()) {
+  while (inboundQ->canPush()->eval() && pendingInbound_.empty()) {
     DataPacket data;
 
     try {
@@ -157,7 +461,14 @@ void DataPipe::doReceive() {
       return;
     }
 
+    if (tracer != nullptr) {
+      tracer->startRx(data);
+    }
+
     size_t wireSize = data.size;
+    if (pacingStats != nullptr) {
+      pacingStats->totalReceivedWireBytes += wireSize;
+    }
 
     if (!!aesEncryptor_) {
       data.size = aesEncryptor_->decrypt(data.data, data.size, data.capacity);
@@ -165,18 +476,139 @@ void DataPipe::doReceive() {
     if (!!padder_) {
       data.size = padder_->decrypt(data.data, data.size, data.capacity);
     }
-    if (!!compressor_) {
-      data.size = compressor_->decrypt(data.data, data.size, data.capacity);
+    PacketTracer::mark(data, RxDecrypted);
+
+    if (!fecDecoder_) {
+      receiveBundle(std::move(data), wireSize);
+    } else {
+      size_t recoveredBefore = fecDecoder_->totalRecovered;
+      std::vector<DataPacket> decoded;
+      fecDecoder_->decode(std::move(data), decoded);
+
+      size_t recovered = fecDecoder_->totalRecovered - recoveredBefore;
+      if (recovered > 0 && fecStats != nullptr) {
+        fecStats->totalRecovered += recovered;
+        fecStats->statRecovered.accumulate(recovered);
+      }
+
+      for (auto& packet : decoded) {
+        // Only the first one actually came over the wire
+        receiveBundle(std::move(packet), wireSize);
+        wireSize = 0;
+      }
     }
 
-    if (statEfficiency != nullptr) {
-      statEfficiency->accumulate(data.size, wireSize);
+    doDeliverPendingInbound();
+  }
+}
+
+void DataPipe::receiveBundle(DataPacket data, size_t wireSize) {
+  if (!coalescer_) {
+    receiveDecoded(std::move(data), wireSize);
+    return;
+  }
+
+  std::vector<DataPacket> packets;
+  if (!PacketCoalescer::split(data, packets)) {
+    LOG_E("DataPipe") << "Received a malformed bundle. Salvaged "
+                      << packets.size() << " packets from it." << std::endl;
+  }
+
+  for (auto& packet : packets) {
+    if (!!data.trace) {
+      packet.trace.reset(new PacketTrace(*data.trace));
+    }
+    receiveDecoded(std::move(packet), wireSize);
+    wireSize = 0;
+  }
+}
+
+void DataPipe::receiveDecoded(DataPacket data, size_t wireSize) {
+  if (!!compressor_) {
+    data.size = compressor_->decrypt(data.data, data.size, data.capacity);
+  }
+
+  if (statEfficiency != nullptr) {
+    statEfficiency->accumulate(data.size, wireSize);
+  }
+
+  LOG_VV("DataPipe") << "Received a packet. Wire size " << wireSize
+                     << ", payload size " << data.size << "." << std::endl;
+
+  if (!!sequenceWindow_) {
+    receiveSequenced(std::move(data));
+  } else {
+    pendingInbound_.push_back(std::move(data));
+  }
+}
+
+void DataPipe::receiveSequenced(DataPacket data) {
+  if (data.size < sizeof(DataPipeSequenceType)) {
+    LOG_E("DataPipe") << "Dropped a packet without a sequence number."
+                      << std::endl;
+    return;
+  }
+
+  data.size -= sizeof(DataPipeSequenceType);
+  auto seq = ntohl(data.unpack<DataPipeSequenceType>(data.size));
+  auto verdict = sequenceWindow_->accept(seq);
+
+  if (sequenceStats != nullptr) {
+    if (verdict.lost > 0) {
+      sequenceStats->totalLost += verdict.lost;
+      sequenceStats->statLost.accumulate(verdict.lost);
+    }
+    if (verdict.reordered) {
+      sequenceStats->statReordered.accumulate(1);
     }
+    if (!verdict.seq) {
+      sequenceStats->statReplayed.accumulate(1);
+    } else {
+      sequenceStats->totalReceived++;
+    }
+  }
+
+  if (!verdict.seq) {
+    LOG_VV("DataPipe") << "Dropped a duplicate or replayed packet."
+                       << std::endl;
+    return;
+  }
+
+  if (!!reorderBuffer_) {
+    reorderBuffer_->insert(*verdict.seq, std::move(data),
+                           event::Timer::getTime(), pendingInbound_);
+    updateReorderTimer();
+  } else {
+    pendingInbound_.push_back(std::move(data));
+  }
+}
+
+void DataPipe::updateReorderTimer() {
+  auto deadline = reorderBuffer_->getDeadline();
+
+  if (!deadline) {
+    reorderTimer_->reset();
+  } else {
+    reorderTimer_->reset(std::max(
+        0ms, std::chrono::duration_cast<event::Duration>(
+                 *deadline - event::Timer::getTime())));
+  }
+}
+
+void DataPipe::doReleaseReordered() {
+  reorderBuffer_->release(event::Timer::getTime(), pendingInbound_);
+  updateReorderTimer();
+  doDeliverPendingInbound();
+}
 
-    LOG_VV("DataPipe") << "Received a packet. Wire size " << wireSize
-                       << ", payload size " << data.size << "." << std::endl;
+void DataPipe::doDeliverPendingInbound() {
+  while (!pendingInbound_.empty() && inboundQ->canPush()->eval()) {
+    DataPacket data = std::move(pendingInbound_.front());
+    pendingInbound_.pop_front();
 
+    // Probes carry a sequence number but no payload
     if (data.size > 0) {
+      PacketTracer::mark(data, RxDelivered);
       inboundQ->push(std::move(data));
     }
   }
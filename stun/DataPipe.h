@@ -2,6 +2,12 @@
 
 #include <variant>
 
+#include <stun/FECCoder.h>
+#include <stun/Pacer.h>
+#include <stun/PacketClassifier.h>
+#include <stun/PacketCoalescer.h>
+#include <stun/PacketTracer.h>
+#include <stun/SequenceWindow.h>
 #include <stun/TCPCoreDataPipe.h>
 #include <stun/UDPCoreDataPipe.h>
 
@@ -9,12 +15,17 @@
 #include <crypto/LZOCompressor.h>
 #include <crypto/Padder.h>
 #include <event/FIFO.h>
+#include <event/PriorityFIFO.h>
 #include <event/Timer.h>
 #include <networking/Packet.h>
 #include <networking/Tunnel.h>
 #include <networking/UDPSocket.h>
+#include <stats/AvgStat.h>
 #include <stats/RatioStat.h>
 
+#include <deque>
+#include <optional>
+
 using crypto::AESEncryptor;
 using crypto::LZOCompressor;
 using crypto::Padder;
@@ -31,6 +42,24 @@ public:
     size_t minPaddingTo;
     bool compression;
     event::Duration ttl;
+    bool sequencing;
+    // How long an out-of-order packet may be held back waiting for the gap in
+    // front of it to fill. Zero disables reordering. Only used when sequencing.
+    event::Duration reorderLatencyBudget;
+    // Number of data packets protected by each parity packet, or zero to
+    // disable FEC. This is the upper bound when adapting to the loss rate.
+    size_t fecGroupSize;
+    // Small packets are packed together into bundles of up to this size
+    // before being sent. Zero disables coalescing.
+    size_t coalescingSize;
+    // How long a bundle may wait to be filled up. Zero only coalesces packets
+    // that are already queued.
+    event::Duration coalescingDelay;
+    // Whether sends are spread out according to the (shared) pacer
+    bool pacing;
+    // Whether outboundQ sorts packets into PacketClass-es, and drops from
+    // them once they build up a standing queue
+    bool priorityQueuing;
   };
 
   using CoreConfig =
@@ -52,14 +81,27 @@ public:
   DataPipe& operator=(DataPipe&& copy) = delete;
 
   std::unique_ptr<event::FIFO<DataPacket>> inboundQ;
-  std::unique_ptr<event::FIFO<DataPacket>> outboundQ;
+  std::unique_ptr<event::PriorityFIFO<DataPacket>> outboundQ;
 
   event::Condition* didClose();
 
-  stats::RatioStat* statEfficiency;
+  // The largest packet that still fits in a DataPacket once sequencing,
+  // coalescing, FEC, padding and encryption have added their headers and
+  // trailers.
+  static size_t getMaxPayloadSize(CommonConfig const& config);
+
+  stats::RatioStat* statEfficiency = nullptr;
+  SequenceStats* sequenceStats = nullptr;
+  FECStats* fecStats = nullptr;
+  stats::AvgStat* statCoalescing = nullptr;
+  Pacer* pacer = nullptr;
+  PacingStats* pacingStats = nullptr;
+  PacketTracer* tracer = nullptr;
 
   CoreDataPipe& getCore() { return *core_; }
 
+  void adaptFEC(double lossRate);
+
 private:
   event::EventLoop& loop_;
 
@@ -86,9 +128,60 @@ private:
   std::unique_ptr<event::Action> sender_;
   std::unique_ptr<event::Action> receiver_;
 
+  // Sequencing
+  uint32_t nextSequence_ = 0;
+  std::unique_ptr<SequenceWindow> sequenceWindow_;
+  std::unique_ptr<ReorderBuffer> reorderBuffer_;
+  std::unique_ptr<event::Timer> reorderTimer_;
+  std::unique_ptr<event::Action> reorderReleaser_;
+
+  // FEC
+  std::unique_ptr<FECEncoder> fecEncoder_;
+  std::unique_ptr<FECDecoder> fecDecoder_;
+  event::Time fecFlushDeadline_;
+  std::unique_ptr<event::Timer> fecFlushTimer_;
+  std::unique_ptr<event::Action> fecFlusher_;
+
+  // Coalescing
+  std::unique_ptr<PacketCoalescer> coalescer_;
+  size_t coalescedPayloadSize_ = 0;
+  // That of the first traced packet in the bundle, which the bundle carries
+  std::unique_ptr<PacketTrace> coalescedTrace_;
+  event::Time coalescingDeadline_;
+  std::unique_ptr<event::Timer> coalescingTimer_;
+  std::unique_ptr<event::Action> coalescingFlusher_;
+
+  // Pacing
+  std::optional<event::Time> pacedSince_;
+  std::unique_ptr<event::ComputedCondition> isPacerReady_;
+  std::unique_ptr<event::Timer> pacingTimer_;
+  std::unique_ptr<event::Action> pacingWaker_;
+
+  // Packets ready for inboundQ that didn't fit in it yet
+  std::deque<DataPacket> pendingInbound_;
+  std::unique_ptr<event::ComputedCondition> hasPendingInbound_;
+  std::unique_ptr<event::Action> pendingInboundDeliverer_;
+
   void doKill();
   void doProbe();
   void doSend();
   void doReceive();
+  void doReleaseReordered();
+  void doDeliverPendingInbound();
+  void doFlushFEC();
+  void doFlushCoalesced();
+  void doWakeFromPacing();
+
+  bool flushCoalesced();
+  bool sendProtected(DataPacket data, size_t payloadSize);
+  bool sendEncoded(DataPacket data, size_t payloadSize);
+  void receiveBundle(DataPacket data, size_t wireSize);
+  void receiveDecoded(DataPacket data, size_t wireSize);
+  void receiveSequenced(DataPacket data);
+  void updateReorderTimer();
+  bool isPaced() const;
+  bool checkPacer();
+
+  static size_t getEnvelopeOverhead(CommonConfig const& config);
 };
 } // namespace stun
@@ -1,33 +1,65 @@
 #include "stun/Dispatcher.h"
 
 #include <event/Trigger.h>
+#include <networking/FlowKey.h>
 
 namespace stun {
 
+using networking::FlowKey;
 using networking::TunnelClosedException;
 
 Dispatcher::Dispatcher(event::EventLoop& loop,
-                       std::unique_ptr<networking::Tunnel> tunnel)
-    : loop_(loop), tunnel_(std::move(tunnel)),
+                       std::unique_ptr<networking::Tunnel> tunnel,
+                       Config config)
+    : loop_(loop), config_(config),
+      sequenceStats_("Connection", config.labels),
+      fecStats_("Connection", config.labels),
+      statCoalescing_("Connection", "tx_coalescing", config.labels),
+      pacingStats_("Connection", config.labels),
+      tracer_("Connection", config.traceSampleInterval, config.labels),
+      tunnel_(std::move(tunnel)),
       canSend_(loop.createComputedCondition()),
       canReceive_(loop.createComputedCondition()),
-      statTxPackets_("Connection", "tx_packets"),
-      statTxBytes_("Connection", "tx_bytes"),
-      statRxPackets_("Connection", "rx_packets"),
-      statRxBytes_("Connection", "rx_bytes"),
-      statEfficiency_("Connection", "efficiency") {
+      statTxPackets_("Connection", "tx_packets", config.labels),
+      statTxBytes_("Connection", "tx_bytes", config.labels),
+      statRxPackets_("Connection", "rx_packets", config.labels),
+      statRxBytes_("Connection", "rx_bytes", config.labels),
+      statEfficiency_("Connection", "efficiency", config.labels),
+      statFlowSpills_("Connection", "flow_spills", config.labels),
+      statHeaderContextMisses_("Connection", "header_context_misses",
+                               config.labels),
+      statTxShaped_("Connection", "tx_shaped", config.labels),
+      statRxShaped_("Connection", "rx_shaped", config.labels) {
   canSend_->expression.setMethod<Dispatcher, &Dispatcher::calculateCanSend>(
       this);
   canReceive_->expression
       .setMethod<Dispatcher, &Dispatcher::calculateCanReceive>(this);
 
-  sender_ = loop.createAction("stun::Dispatcher::sender_",
-                              {tunnel_->canRead(), canSend_.get()});
+  isTxWithinRate_ = loop.createComputedCondition();
+  isTxWithinRate_->expression = [this]() {
+    return !rateLimit_ ||
+           rateLimit_->isReady(RateLimiter::TX, event::Timer::getTime());
+  };
+  isRxWithinRate_ = loop.createComputedCondition();
+  isRxWithinRate_->expression = [this]() {
+    return !rateLimit_ ||
+           rateLimit_->isReady(RateLimiter::RX, event::Timer::getTime());
+  };
+
+  sender_ = loop.createAction(
+      "stun::Dispatcher::sender_",
+      {tunnel_->canRead(), canSend_.get(), isTxWithinRate_.get()});
   sender_->callback.setMethod<Dispatcher, &Dispatcher::doSend>(this);
 
-  receiver_ = loop.createAction("stun::Dispatcher::receiver_",
-                                {canReceive_.get(), tunnel_->canWrite()});
+  receiver_ = loop.createAction(
+      "stun::Dispatcher::receiver_",
+      {canReceive_.get(), tunnel_->canWrite(), isRxWithinRate_.get()});
   receiver_->callback.setMethod<Dispatcher, &Dispatcher::doReceive>(this);
+
+  if (config_.headerCompression) {
+    headerCompressor_.reset(new HeaderCompressor());
+    headerDecompressor_.reset(new HeaderDecompressor());
+  }
 }
 
 bool Dispatcher::calculateCanSend() {
@@ -53,7 +85,84 @@ bool Dispatcher::calculateCanReceive() {
   return false;
 }
 
+bool Dispatcher::readPacket(DataPacket& out) {
+  TunnelPacket in;
+
+  try {
+    auto ret = tunnel_->read(in);
+    if (!ret) {
+      return false;
+    }
+    tracer_.startTx(in);
+  } catch (TunnelClosedException const& ex) {
+    LOG_E("Dispatcher") << "Tunnel is closed: " << ex.what() << std::endl;
+    assertTrue(false, "Tunnel should never close.");
+  }
+
+  assertTrue(in.data[0] == 0x00 && in.data[1] == 0x00 && in.data[2] == 0x08 &&
+                 in.data[3] == 0x00,
+             "Outgoing packets read from tunnel need to have header 0x00 0x00 "
+             "0x08 0x00. Got instead: " +
+                 std::to_string(in.data[0]) + " " + std::to_string(in.data[1]) +
+                 " " + std::to_string(in.data[2]) + " " +
+                 std::to_string(in.data[3]));
+
+  bytesDispatched += in.size;
+  statTxPackets_.accumulate();
+  statTxBytes_.accumulate(in.size);
+  if (!!rateLimit_) {
+    rateLimit_->consume(RateLimiter::TX, in.size, event::Timer::getTime());
+  }
+  out.fill(std::move(in));
+
+  return true;
+}
+
+bool Dispatcher::isWithinRate(RateLimiter::Direction direction) {
+  if (!rateLimit_) {
+    return true;
+  }
+
+  auto now = event::Timer::getTime();
+  if (rateLimit_->isReady(direction, now)) {
+    return true;
+  }
+
+  // Leaving the packets where they are (in the tunnel or the DataPipe-s) until
+  // the buckets refill pushes back on the sender, instead of dropping them.
+  (direction == RateLimiter::TX ? statTxShaped_ : statRxShaped_).accumulate(1);
+  rateLimitTimer_->reset(rateLimit_->getWait(direction, now));
+  return false;
+}
+
+void Dispatcher::pushPacket(DataPipe& dataPipe, DataPacket packet) {
+  auto& queue = *dataPipe.outboundQ;
+
+  // Has to happen before the headers are compressed away
+  bool prioritized = (queue.getClassCount() > 1);
+  auto cls = (prioritized ? PacketClassifier::classify(packet.data, packet.size)
+                          : PacketClass::Default);
+  size_t size = packet.size;
+
+  if (!!headerCompressor_) {
+    // Counted as payload carried for free
+    statEfficiency_.accumulate(headerCompressor_->compress(packet), 0);
+  }
+
+  PacketTracer::mark(packet, TxDispatched);
+  if (prioritized) {
+    queue.push(std::move(packet), cls, size);
+  } else {
+    queue.push(std::move(packet));
+  }
+}
+
 void Dispatcher::doSend() {
+  if (config_.flowPinning) {
+    doSendPinned();
+    return;
+  }
+
   bool sent = false;
 
   // Finding a data pipe that can accept packets
@@ -64,34 +173,16 @@ void Dispatcher::doSend() {
       // Found a data pipe that can accept packets
       // Push as many as possible
       while (dataPipes_[pipeIndex]->outboundQ->canPush()->eval()) {
-        TunnelPacket in;
-
-        try {
-          auto ret = tunnel_->read(in);
-          if (!ret) {
-            break;
-          }
-        } catch (TunnelClosedException const& ex) {
-          LOG_E("Dispatcher") << "Tunnel is closed: " << ex.what() << std::endl;
-          assertTrue(false, "Tunnel should never close.");
+        if (!isWithinRate(RateLimiter::TX)) {
+          break;
         }
 
-        assertTrue(
-            in.data[0] == 0x00 && in.data[1] == 0x00 && in.data[2] == 0x08 &&
-                in.data[3] == 0x00,
-            "Outgoing packets read from tunnel need to have header 0x00 0x00 "
-            "0x08 0x00. Got instead: " +
-                std::to_string(in.data[0]) + " " + std::to_string(in.data[1]) +
-                " " + std::to_string(in.data[2]) + " " +
-                std::to_string(in.data[3]));
-
         DataPacket out;
-        bytesDispatched += in.size;
-        statTxPackets_.accumulate();
-        statTxBytes_.accumulate(in.size);
-        out.fill(std::move(in));
+        if (!readPacket(out)) {
+          break;
+        }
 
-        dataPipes_[pipeIndex]->outboundQ->push(std::move(out));
+        pushPacket(*dataPipes_[pipeIndex], std::move(out));
       }
 
       sent = true;
@@ -103,13 +194,101 @@ void Dispatcher::doSend() {
   assertTrue(sent, "Cannot find a free DataPipe to send to.");
 }
 
+void Dispatcher::doSendPinned() {
+  while (calculateCanSend() && isWithinRate(RateLimiter::TX)) {
+    DataPacket out;
+    if (!readPacket(out)) {
+      break;
+    }
+
+    DataPipe* dataPipe = pickPinnedDataPipe(out);
+    assertTrue(dataPipe != nullptr, "Cannot find a free DataPipe to send to.");
+    pushPacket(*dataPipe, std::move(out));
+  }
+}
+
+// Scores a (flow, DataPipe) pair for rendezvous hashing. Each flow is pinned to
+// the DataPipe with the highest score. When a DataPipe is added, only the flows
+// for which it scores the highest move over to it; when a DataPipe is removed,
+// only the flows that were pinned to it get redistributed.
+static uint32_t getRendezvousScore(uint32_t flowHash, DataPipe const* pipe) {
+  auto pipeHash = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(pipe) >> 4);
+  return FlowKey::mix(flowHash ^ FlowKey::mix(pipeHash));
+}
+
+DataPipe* Dispatcher::pickPinnedDataPipe(DataPacket const& packet) {
+  // Packets that we cannot parse a flow out of are all treated as one flow.
+  auto flow = FlowKey::parse(packet.data + networking::kTunnelPacketHeaderSize,
+                             packet.size - networking::kTunnelPacketHeaderSize);
+  uint32_t flowHash = (flow ? flow->hash() : 0);
+
+  DataPipe* pinned = nullptr;
+  uint32_t pinnedScore = 0;
+  for (auto const& dataPipe : dataPipes_) {
+    uint32_t score = getRendezvousScore(flowHash, dataPipe.get());
+    if (pinned == nullptr || score > pinnedScore) {
+      pinned = dataPipe.get();
+      pinnedScore = score;
+    }
+  }
+
+  if (pinned != nullptr && pinned->outboundQ->canPush()->eval()) {
+    return pinned;
+  }
+
+  // The pinned DataPipe is backed up. We'd rather reorder this flow a bit than
+  // stall all other flows, so we spill over to any DataPipe that has room.
+  statFlowSpills_.accumulate();
+
+  for (auto const& dataPipe : dataPipes_) {
+    if (dataPipe->outboundQ->canPush()->eval()) {
+      return dataPipe.get();
+    }
+  }
+
+  return nullptr;
+}
+
 void Dispatcher::doReceive() {
   bool received = false;
 
   for (auto const& dataPipe_ : dataPipes_) {
     while (dataPipe_->inboundQ->canPop()->eval()) {
+      if (!isWithinRate(RateLimiter::RX)) {
+        return;
+      }
+
+      DataPacket packet = dataPipe_->inboundQ->pop();
+      PacketTracer::mark(packet, RxDequeued);
+      received = true;
+
+      if (!!rateLimit_) {
+        rateLimit_->consume(RateLimiter::RX, packet.size,
+                            event::Timer::getTime());
+      }
+
+      if (!!headerDecompressor_) {
+        std::optional<uint8_t> missingContext;
+        auto restored = headerDecompressor_->decompress(packet, missingContext);
+
+        if (!!missingContext && !!requestHeaderContextResync) {
+          LOG_V("Dispatcher") << "Requesting header compression context "
+                              << int(*missingContext) << " again."
+                              << std::endl;
+          requestHeaderContextResync(*missingContext);
+        }
+        if (!restored) {
+          statHeaderContextMisses_.accumulate();
+          continue;
+        }
+
+        statEfficiency_.accumulate(*restored, 0);
+      }
+
+      // The tunnel takes the packet, trace and all
+      auto trace = std::move(packet.trace);
       TunnelPacket in;
-      in.fill(dataPipe_->inboundQ->pop());
+      in.fill(std::move(packet));
       bytesDispatched += in.size;
       statRxPackets_.accumulate();
       statRxBytes_.accumulate(in.size);
@@ -119,7 +298,10 @@ void Dispatcher::doReceive() {
         return;
       }
 
-      received = true;
+      if (!!trace) {
+        trace->mark(RxWritten);
+        tracer_.finishRx(std::move(trace));
+      }
     }
   }
 
@@ -128,6 +310,28 @@ void Dispatcher::doReceive() {
 
 void Dispatcher::addDataPipe(std::unique_ptr<DataPipe> dataPipe) {
   dataPipe->statEfficiency = &statEfficiency_;
+  dataPipe->sequenceStats = &sequenceStats_;
+  dataPipe->fecStats = &fecStats_;
+  dataPipe->statCoalescing = &statCoalescing_;
+  dataPipe->pacer = &pacer_;
+  dataPipe->pacingStats = &pacingStats_;
+  dataPipe->tracer = &tracer_;
+  dataPipe->adaptFEC(fecLossRate_);
+
+  auto& queue = *dataPipe->outboundQ;
+  if (queue.getClassCount() > 1) {
+    for (size_t cls = queueStats_.size(); cls < queue.getClassCount(); cls++) {
+      queueStats_.emplace_back(new event::PriorityFIFOClassStats(
+          "Connection",
+          std::string("tx_queue_") +
+              PacketClassifier::getName(PacketClass(cls)),
+          config_.labels));
+    }
+    for (size_t cls = 0; cls < queue.getClassCount(); cls++) {
+      queue.setStats(cls, queueStats_[cls].get());
+    }
+  }
+
   DataPipe* pipe = dataPipe.get();
   dataPipes_.emplace_back(std::move(dataPipe));
 
@@ -145,4 +349,67 @@ void Dispatcher::addDataPipe(std::unique_ptr<DataPipe> dataPipe) {
               dataPipes_.erase(it);
             });
 }
+
+/* static */ size_t
+Dispatcher::getMaxMTU(DataPipe::CommonConfig const& pipeConfig,
+                      bool headerCompression) {
+  size_t overhead = networking::kTunnelPacketHeaderSize;
+  if (headerCompression) {
+    overhead += HeaderCompressor::Overhead;
+  }
+
+  return DataPipe::getMaxPayloadSize(pipeConfig) - overhead;
+}
+
+void Dispatcher::adaptFEC(double lossRate) {
+  fecLossRate_ = lossRate;
+
+  for (auto& dataPipe : dataPipes_) {
+    dataPipe->adaptFEC(lossRate);
+  }
+}
+
+void Dispatcher::adaptPacing(size_t deliveredBytes, event::Duration interval,
+                             double lossRate) {
+  pacer_.onFeedback(deliveredBytes, interval, lossRate);
+  pacingStats_.statRate.accumulate(pacer_.getRate());
+}
+
+void Dispatcher::limitRate(std::unique_ptr<RateLimiter::Session> rateLimit) {
+  rateLimit_ = std::move(rateLimit);
+  if (!rateLimit_) {
+    return;
+  }
+
+  rateLimitTimer_ = loop_.createTimer();
+  rateLimitWaker_ = loop_.createAction("stun::Dispatcher::rateLimitWaker_",
+                                       {rateLimitTimer_->didFire()});
+  rateLimitWaker_->callback
+      .setMethod<Dispatcher, &Dispatcher::doWakeFromRateLimit>(this);
+}
+
+void Dispatcher::doWakeFromRateLimit() {
+  rateLimitTimer_->reset();
+
+  // The timer is shared by both directions, so make sure that the one still
+  // waiting gets woken up as well.
+  auto now = event::Timer::getTime();
+  std::optional<event::Duration> wait;
+  for (auto direction : {RateLimiter::TX, RateLimiter::RX}) {
+    if (!rateLimit_->isReady(direction, now)) {
+      auto directionWait = rateLimit_->getWait(direction, now);
+      wait = (!wait ? directionWait : std::min(*wait, directionWait));
+    }
+  }
+
+  if (!!wait) {
+    rateLimitTimer_->reset(*wait);
+  }
+}
+
+void Dispatcher::resyncHeaderContext(uint8_t contextID) {
+  if (!!headerCompressor_) {
+    headerCompressor_->resync(contextID);
+  }
+}
 } // namespace stun
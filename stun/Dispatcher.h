@@ -1,8 +1,13 @@
 #pragma once
 
 #include <stun/DataPipe.h>
+#include <stun/HeaderCompressor.h>
+#include <stun/PacketClassifier.h>
+#include <stun/PacketTracer.h>
+#include <stun/RateLimiter.h>
 
 #include <networking/Tunnel.h>
+#include <stats/AvgStat.h>
 #include <stats/CountStat.h>
 #include <stats/RateStat.h>
 #include <stats/RatioStat.h>
@@ -13,15 +18,57 @@ using networking::TunnelPacket;
 
 class Dispatcher {
 public:
-  Dispatcher(event::EventLoop& loop,
-             std::unique_ptr<networking::Tunnel> tunnel);
+  struct Config {
+    // When enabled, all packets belonging to the same IP flow are sent over
+    // the same DataPipe (as long as it has room), instead of being sprayed
+    // across all active DataPipes. This avoids reordering the inner flows.
+    bool flowPinning;
+    // Compresses the tunnel, IP and TCP/UDP headers of the tunneled packets.
+    // Both ends need to agree on this.
+    bool headerCompression;
+    // Traces one in every this many packets in each direction through the
+    // pipeline, to break their latency down by stage. Zero disables tracing.
+    size_t traceSampleInterval;
+    // Attached to all the stats of this Dispatcher, e.g. the user and the
+    // session, so that those of concurrent sessions don't collide.
+    stats::LabelSet labels;
+  };
+
+  Dispatcher(event::EventLoop& loop, std::unique_ptr<networking::Tunnel> tunnel,
+             Config config);
 
   size_t bytesDispatched = 0;
 
+  // The largest tunnel MTU whose packets still fit in DataPipe-s with
+  // `pipeConfig`, once the tunnel header and header compression are added.
+  static size_t getMaxMTU(DataPipe::CommonConfig const& pipeConfig,
+                          bool headerCompression);
+
   void addDataPipe(std::unique_ptr<DataPipe> dataPipe);
 
   stats::CountStat const& getStatTxPackets() const { return statTxPackets_; }
   stats::CountStat const& getStatRxPackets() const { return statRxPackets_; }
+  SequenceStats const& getSequenceStats() const { return sequenceStats_; }
+  FECStats const& getFECStats() const { return fecStats_; }
+  PacingStats const& getPacingStats() const { return pacingStats_; }
+
+  // Tunes the FEC redundancy of all DataPipe-s to the given raw loss rate.
+  void adaptFEC(double lossRate);
+
+  // Updates the pacing rate of the DataPipe-s that pace, given how many bytes
+  // the peer received over the last `interval` and the loss rate over it.
+  void adaptPacing(size_t deliveredBytes, event::Duration interval,
+                   double lossRate);
+
+  // Called when a packet arrives compressed against a header compression
+  // context we don't have. The peer should be asked to resend the context,
+  // which it does upon resyncHeaderContext().
+  std::function<void(uint8_t contextID)> requestHeaderContextResync;
+  void resyncHeaderContext(uint8_t contextID);
+
+  // Shapes the traffic in both directions to the session's rate limits, if
+  // there are any.
+  void limitRate(std::unique_ptr<RateLimiter::Session> rateLimit);
 
 private:
   Dispatcher(Dispatcher const& copy) = delete;
@@ -32,6 +79,19 @@ private:
 
   event::EventLoop& loop_;
 
+  Config config_;
+
+  // Shared by all DataPipes, hence declared before them
+  SequenceStats sequenceStats_;
+  FECStats fecStats_;
+  stats::AvgStat statCoalescing_;
+  double fecLossRate_ = 0;
+  Pacer pacer_;
+  PacingStats pacingStats_;
+  // One per PacketClass, created along with the first prioritized DataPipe
+  std::vector<std::unique_ptr<event::PriorityFIFOClassStats>> queueStats_;
+  PacketTracer tracer_;
+
   std::unique_ptr<networking::Tunnel> tunnel_;
   std::vector<std::unique_ptr<DataPipe>> dataPipes_;
   size_t currentDataPipeIndex_;
@@ -42,16 +102,36 @@ private:
   std::unique_ptr<event::Action> sender_;
   std::unique_ptr<event::Action> receiver_;
 
+  std::unique_ptr<RateLimiter::Session> rateLimit_;
+  std::unique_ptr<event::ComputedCondition> isTxWithinRate_;
+  std::unique_ptr<event::ComputedCondition> isRxWithinRate_;
+  std::unique_ptr<event::Timer> rateLimitTimer_;
+  std::unique_ptr<event::Action> rateLimitWaker_;
+
+  std::unique_ptr<HeaderCompressor> headerCompressor_;
+  std::unique_ptr<HeaderDecompressor> headerDecompressor_;
+
   stats::CountStat statTxPackets_;
   stats::RateStat statTxBytes_;
   stats::CountStat statRxPackets_;
   stats::RateStat statRxBytes_;
   stats::RatioStat statEfficiency_;
+  stats::CountStat statFlowSpills_;
+  stats::CountStat statHeaderContextMisses_;
+  stats::RateStat statTxShaped_;
+  stats::RateStat statRxShaped_;
 
   void doSend();
+  void doSendPinned();
   void doReceive();
+  void doWakeFromRateLimit();
+
+  bool readPacket(DataPacket& out);
+  void pushPacket(DataPipe& dataPipe, DataPacket packet);
+  DataPipe* pickPinnedDataPipe(DataPacket const& packet);
 
   bool calculateCanReceive();
   bool calculateCanSend();
+  bool isWithinRate(RateLimiter::Direction direction);
 };
 } // namespace stun
@@ -0,0 +1,217 @@
+#include "stun/FECCoder.h"
+
+#include <common/Util.h>
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+
+namespace stun {
+
+static const Byte kFECParityIndex = 0xFF;
+static const size_t kFECMinGroupSize = 2;
+
+// Aim for this many lost packets per group on average. Well below one, so that
+// groups with two or more losses (which single parity can't recover) are rare.
+static const double kFECTargetLossesPerGroup = 0.1;
+
+typedef uint16_t FECLengthType;
+
+struct FECTrailer {
+  uint32_t groupID;
+  Byte index;
+  Byte count;
+} __attribute__((packed));
+
+static_assert(FECEncoder::Overhead ==
+                  sizeof(FECLengthType) + sizeof(FECTrailer),
+              "FECEncoder::Overhead is out of date.");
+
+// Simple enough for the compiler to vectorize.
+static void xorInto(Byte* target, Byte const* source, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    target[i] ^= source[i];
+  }
+}
+
+static void appendTrailer(DataPacket& data, uint32_t groupID, size_t index,
+                          size_t count) {
+  auto trailer = FECTrailer{htonl(groupID), static_cast<Byte>(index),
+                            static_cast<Byte>(count)};
+  data.pack(trailer, data.size);
+}
+
+FECEncoder::FECEncoder(size_t maxGroupSize)
+    : maxGroupSize_(maxGroupSize), groupSize_(maxGroupSize) {
+  assertTrue(maxGroupSize >= 1 && maxGroupSize <= MaxGroupSize,
+             "Invalid FEC group size: " + std::to_string(maxGroupSize));
+}
+
+std::optional<DataPacket> FECEncoder::encode(DataPacket& data) {
+  assertTrue(canEncode(data), "No room for FEC in a packet of size " +
+                                  std::to_string(data.size));
+
+  FECLengthType length = htons(data.size);
+  xorInto(parity_.data(), reinterpret_cast<Byte*>(&length), sizeof(length));
+  xorInto(parity_.data() + sizeof(length), data.data, data.size);
+  parityLength_ = std::max(parityLength_, sizeof(length) + data.size);
+
+  appendTrailer(data, groupID_, groupCount_, 0);
+  groupCount_++;
+
+  if (groupCount_ >= groupSize_) {
+    return finishGroup();
+  }
+
+  return std::nullopt;
+}
+
+std::optional<DataPacket> FECEncoder::flush() {
+  if (groupCount_ == 0) {
+    return std::nullopt;
+  }
+
+  return finishGroup();
+}
+
+DataPacket FECEncoder::finishGroup() {
+  DataPacket parity;
+  parity.fill(parity_.data(), parityLength_);
+  appendTrailer(parity, groupID_, kFECParityIndex, groupCount_);
+
+  std::fill_n(parity_.begin(), parityLength_, 0);
+  parityLength_ = 0;
+  groupCount_ = 0;
+  groupID_++;
+
+  return parity;
+}
+
+void FECEncoder::adapt(double lossRate) {
+  if (lossRate <= 0) {
+    groupSize_ = maxGroupSize_;
+    return;
+  }
+
+  auto ideal = static_cast<size_t>(kFECTargetLossesPerGroup / lossRate);
+  groupSize_ = std::clamp(ideal, std::min(kFECMinGroupSize, maxGroupSize_),
+                          maxGroupSize_);
+}
+
+FECDecoder::Group* FECDecoder::getGroup(uint32_t groupID) {
+  auto it = groups_.find(groupID);
+  if (it != groups_.end()) {
+    return &it->second;
+  }
+
+  if (groups_.size() >= Window && groupID < groups_.begin()->first) {
+    // Too old, we have already given up on this group.
+    return nullptr;
+  }
+
+  Group* group = &groups_[groupID];
+  while (groups_.size() > Window) {
+    groups_.erase(groups_.begin());
+  }
+  return group;
+}
+
+void FECDecoder::decode(DataPacket data, std::vector<DataPacket>& output) {
+  if (data.size < sizeof(FECTrailer)) {
+    LOG_E("FEC") << "Dropped a packet without an FEC trailer." << std::endl;
+    return;
+  }
+
+  data.size -= sizeof(FECTrailer);
+  auto trailer = data.unpack<FECTrailer>(data.size);
+  Group* group = getGroup(ntohl(trailer.groupID));
+
+  if (trailer.index == kFECParityIndex) {
+    if (group == nullptr || group->done || group->count != 0) {
+      return;
+    }
+
+    if (trailer.count == 0 || trailer.count > FECEncoder::MaxGroupSize) {
+      LOG_E("FEC") << "Dropped a parity packet with an invalid group size."
+                   << std::endl;
+      return;
+    }
+
+    group->count = trailer.count;
+    xorInto(group->accumulator.data(), data.data, data.size);
+    group->length = std::max(group->length, data.size);
+  } else {
+    if (trailer.index >= FECEncoder::MaxGroupSize) {
+      LOG_E("FEC") << "Dropped a packet with an invalid FEC index."
+                   << std::endl;
+      return;
+    }
+
+    uint64_t bit = uint64_t{1} << trailer.index;
+    if (group != nullptr && (group->recoveredMask & bit)) {
+      LOG_VV("FEC") << "Dropped a packet that was already recovered."
+                    << std::endl;
+      return;
+    }
+
+    if (group != nullptr && !group->done && !(group->receivedMask & bit)) {
+      FECLengthType length = htons(data.size);
+      xorInto(group->accumulator.data(), reinterpret_cast<Byte*>(&length),
+              sizeof(length));
+      xorInto(group->accumulator.data() + sizeof(length), data.data,
+              data.size);
+      group->length = std::max(group->length, sizeof(length) + data.size);
+      group->receivedMask |= bit;
+      group->receivedCount++;
+    }
+
+    output.emplace_back(std::move(data));
+  }
+
+  if (group != nullptr) {
+    auto recovered = tryRecover(*group);
+    if (!!recovered) {
+      output.emplace_back(std::move(*recovered));
+    }
+  }
+}
+
+std::optional<DataPacket> FECDecoder::tryRecover(Group& group) {
+  if (group.done || group.count == 0) {
+    return std::nullopt;
+  }
+
+  if (group.receivedCount >= group.count) {
+    // Nothing is missing.
+    group.done = true;
+    return std::nullopt;
+  }
+
+  if (group.receivedCount + 1 < group.count) {
+    // Either still waiting for more packets, or lost too many to recover.
+    return std::nullopt;
+  }
+
+  group.done = true;
+
+  // What's left in the accumulator is exactly the missing packet.
+  FECLengthType length;
+  memcpy(&length, group.accumulator.data(), sizeof(length));
+  length = ntohs(length);
+
+  if (sizeof(length) + length > group.length) {
+    LOG_E("FEC") << "Recovered a corrupted packet. Dropping it." << std::endl;
+    return std::nullopt;
+  }
+
+  DataPacket recovered;
+  recovered.fill(group.accumulator.data() + sizeof(length), length);
+  totalRecovered++;
+
+  uint64_t members = (group.count == FECEncoder::MaxGroupSize
+                          ? ~uint64_t{0}
+                          : (uint64_t{1} << group.count) - 1);
+  group.recoveredMask = members & ~group.receivedMask;
+  return recovered;
+}
+} // namespace stun
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stun/CoreDataPipe.h>
+
+#include <stats/RateStat.h>
+
+#include <array>
+#include <map>
+#include <optional>
+#include <vector>
+
+namespace stun {
+
+// FEC stats shared by all DataPipe-s of a Dispatcher. The recovered total is
+// reported to the peer so that it can tell the raw link loss apart from the
+// residual loss left after recovery.
+struct FECStats {
+  FECStats(std::string const& entity,
+           stats::LabelSet const& labels = stats::LabelSet())
+      : statRecovered(entity, "rx_fec_recovered", labels),
+        statParity(entity, "tx_fec_parity", labels) {}
+
+  stats::RateStat statRecovered;
+  stats::RateStat statParity;
+
+  size_t totalRecovered = 0;
+};
+
+// Single-parity forward error correction over groups of packets. After every
+// `groupSize` data packets the encoder emits one parity packet carrying the
+// XOR of the (length-prefixed) group members, which lets the decoder rebuild
+// any single packet lost from the group.
+//
+// Every packet gets a trailer with its group ID and its index in the group.
+// Data packets are otherwise untouched, so the decoder can pass them on right
+// away and only recovered packets incur extra latency.
+class FECEncoder {
+public:
+  constexpr static size_t MaxGroupSize = 64;
+  // How much FEC adds to a packet: the trailer, plus the length prefix that
+  // the parity packet carries for each member
+  constexpr static size_t Overhead = 8;
+
+  FECEncoder(size_t maxGroupSize);
+
+  // Whether there's room in `data` for FEC to protect it
+  static bool canEncode(DataPacket const& data) {
+    return data.size + Overhead <= data.capacity;
+  }
+
+  // Appends the FEC trailer to `data`, and returns the group's parity packet
+  // if `data` completes the current group. `data` must pass canEncode().
+  std::optional<DataPacket> encode(DataPacket& data);
+
+  // Returns the parity packet for the current group if it has any members.
+  // Used to avoid stranding a partial group when the traffic stops.
+  std::optional<DataPacket> flush();
+
+  // Picks the group size for the given (raw) loss rate, so that on average a
+  // group loses far less than the one packet it can recover.
+  void adapt(double lossRate);
+
+  size_t getGroupSize() const { return groupSize_; }
+  bool hasPendingGroup() const { return groupCount_ > 0; }
+
+private:
+  FECEncoder(FECEncoder const& copy) = delete;
+  FECEncoder& operator=(FECEncoder const& copy) = delete;
+
+  FECEncoder(FECEncoder&& move) = delete;
+  FECEncoder& operator=(FECEncoder&& move) = delete;
+
+  size_t maxGroupSize_;
+  size_t groupSize_;
+
+  uint32_t groupID_ = 0;
+  size_t groupCount_ = 0;
+  size_t parityLength_ = 0;
+  std::array<Byte, DataPacket::Size> parity_ = {};
+
+  DataPacket finishGroup();
+};
+
+class FECDecoder {
+public:
+  // Number of most recent groups kept around waiting for recovery.
+  constexpr static size_t Window = 16;
+
+  FECDecoder() {}
+
+  // Strips the FEC trailer from `data`. Data packets are appended to `output`
+  // as-is, followed by the packet recovered with their help, if any.
+  void decode(DataPacket data, std::vector<DataPacket>& output);
+
+  size_t totalRecovered = 0;
+
+private:
+  FECDecoder(FECDecoder const& copy) = delete;
+  FECDecoder& operator=(FECDecoder const& copy) = delete;
+
+  FECDecoder(FECDecoder&& move) = delete;
+  FECDecoder& operator=(FECDecoder&& move) = delete;
+
+  struct Group {
+    // Number of data packets in the group, known once the parity arrives.
+    size_t count = 0;
+    uint64_t receivedMask = 0;
+    size_t receivedCount = 0;
+    // The packet rebuilt from the parity, whose original is dropped should it
+    // still show up
+    uint64_t recoveredMask = 0;
+    bool done = false;
+
+    size_t length = 0;
+    std::array<Byte, DataPacket::Size> accumulator = {};
+  };
+
+  std::map<uint32_t, Group> groups_;
+
+  Group* getGroup(uint32_t groupID);
+  std::optional<DataPacket> tryRecover(Group& group);
+};
+} // namespace stun
@@ -0,0 +1,366 @@
+#include "stun/HeaderCompressor.h"
+
+#include <networking/Tunnel.h>
+
+#include <netinet/in.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace stun {
+
+using networking::FlowKey;
+using networking::kTunnelPacketHeaderSize;
+
+static const Byte kHeaderCompressorTunnelHeader[] = {0x00, 0x00, 0x08, 0x00};
+
+static const size_t kHeaderCompressorIPHeaderSize = 20;
+static const size_t kHeaderCompressorTCPHeaderSize = 20;
+static const size_t kHeaderCompressorUDPHeaderSize = 8;
+static const size_t kHeaderCompressorPortsSize = 4;
+
+// How many packets of a new (or resynced) context carry full headers, in case
+// some of them get lost or overtaken on another DataPipe.
+static const size_t kHeaderCompressorFullHeaderRepetitions = 3;
+
+// How many packets may be dropped for a missing context before asking the peer
+// for it again.
+static const size_t kHeaderCompressorResyncRetryInterval = 64;
+
+// First byte of every packet
+enum HeaderCompressorPacketType : Byte {
+  kPacketUncompressed = 0,
+  kPacketFullHeaders = 1,
+  kPacketCompressedTCP = 2,
+  kPacketCompressedUDP = 3,
+};
+
+// Fields that normally come from the context, but are sent along if they
+// differ in a particular packet
+enum HeaderCompressorFieldMask : Byte {
+  kFieldTOS = 1 << 0,
+  kFieldTTL = 1 << 1,
+  kFieldFragment = 1 << 2,
+  kFieldUrgent = 1 << 3,
+};
+
+// Size of the type, context ID, generation and field mask
+static const size_t kHeaderCompressorPreambleSize = 4;
+
+static uint16_t readUInt16(Byte const* data) {
+  return (data[0] << 8) | data[1];
+}
+
+static void writeUInt16(Byte* data, uint16_t value) {
+  data[0] = value >> 8;
+  data[1] = value & 0xff;
+}
+
+static uint16_t computeIPv4Checksum(Byte const* header) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < kHeaderCompressorIPHeaderSize; i += 2) {
+    sum += readUInt16(header + i);
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return ~sum;
+}
+
+// Returns the size of the TCP/UDP header we compress (excluding TCP options),
+// or 0 if the packet is not one we know how to compress.
+static size_t getCompressibleHeaderSize(Byte const* data, size_t size) {
+  if (size < kTunnelPacketHeaderSize + kHeaderCompressorIPHeaderSize ||
+      memcmp(data, kHeaderCompressorTunnelHeader, kTunnelPacketHeaderSize)) {
+    return 0;
+  }
+
+  Byte const* ip = data + kTunnelPacketHeaderSize;
+  size_t ipSize = size - kTunnelPacketHeaderSize;
+
+  // No IP options, no fragments, and a total length that adds up
+  if (ip[0] != 0x45 || (readUInt16(ip + 6) & 0x3fff) != 0 ||
+      readUInt16(ip + 2) != ipSize) {
+    return 0;
+  }
+
+  Byte const* transport = ip + kHeaderCompressorIPHeaderSize;
+  size_t transportSize = ipSize - kHeaderCompressorIPHeaderSize;
+
+  switch (ip[9]) {
+  case IPPROTO_TCP:
+    if (transportSize < kHeaderCompressorTCPHeaderSize ||
+        (transport[12] >> 4) * 4 < kHeaderCompressorTCPHeaderSize ||
+        (transport[12] >> 4) * 4 > transportSize) {
+      return 0;
+    }
+    return kHeaderCompressorTCPHeaderSize;
+  case IPPROTO_UDP:
+    if (transportSize < kHeaderCompressorUDPHeaderSize ||
+        readUInt16(transport + 4) != transportSize) {
+      return 0;
+    }
+    return kHeaderCompressorUDPHeaderSize;
+  default:
+    return 0;
+  }
+}
+
+size_t HeaderCompressor::compress(DataPacket& packet) {
+  size_t transportHeaderSize =
+      getCompressibleHeaderSize(packet.data, packet.size);
+
+  if (transportHeaderSize == 0) {
+    assertTrue(packet.size + Overhead <= packet.capacity,
+               "HeaderCompressor doesn't have enough space for the type.");
+    memmove(packet.data + 1, packet.data, packet.size);
+    packet.data[0] = kPacketUncompressed;
+    packet.size += 1;
+    return 0;
+  }
+
+  Byte* ip = packet.data + kTunnelPacketHeaderSize;
+  auto flow = *FlowKey::parse(ip, packet.size - kTunnelPacketHeaderSize);
+
+  auto it = contextIDs_.find(flow);
+  uint8_t contextID =
+      (it == contextIDs_.end() ? assignContext(flow, ip) : it->second);
+  Context& context = contexts_[contextID];
+  context.lastUsed = ++clock_;
+
+  bool matchesContext = (ip[1] == context.tos && ip[8] == context.ttl &&
+                         readUInt16(ip + 6) == context.fragmentField);
+
+  if (context.fullHeadersLeft > 0 && matchesContext) {
+    context.fullHeadersLeft--;
+
+    // The preamble takes up less space than the tunnel header it replaces.
+    size_t ipSize = packet.size - kTunnelPacketHeaderSize;
+    packet.data[0] = kPacketFullHeaders;
+    packet.data[1] = contextID;
+    packet.data[2] = context.generation;
+    memmove(packet.data + 3, ip, ipSize);
+    packet.size = 3 + ipSize;
+    return kTunnelPacketHeaderSize - 3;
+  }
+
+  Byte const* transport = ip + kHeaderCompressorIPHeaderSize;
+  bool isTCP = (ip[9] == IPPROTO_TCP);
+
+  Byte header[32];
+  size_t size = kHeaderCompressorPreambleSize;
+  Byte mask = 0;
+
+  auto append = [&header, &size](Byte const* field, size_t fieldSize) {
+    memcpy(header + size, field, fieldSize);
+    size += fieldSize;
+  };
+
+  if (ip[1] != context.tos) {
+    mask |= kFieldTOS;
+    append(ip + 1, 1);
+  }
+  if (ip[8] != context.ttl) {
+    mask |= kFieldTTL;
+    append(ip + 8, 1);
+  }
+  if (readUInt16(ip + 6) != context.fragmentField) {
+    mask |= kFieldFragment;
+    append(ip + 6, 2);
+  }
+  append(ip + 4, 2); // Identification
+
+  if (isTCP) {
+    // Sequence number, ack number, data offset & flags, window and checksum
+    append(transport + 4, 14);
+    if (readUInt16(transport + 18) != 0) {
+      mask |= kFieldUrgent;
+      append(transport + 18, 2);
+    }
+  } else {
+    append(transport + 6, 2); // Checksum
+  }
+
+  header[0] = (isTCP ? kPacketCompressedTCP : kPacketCompressedUDP);
+  header[1] = contextID;
+  header[2] = context.generation;
+  header[3] = mask;
+
+  // Whatever follows the fixed-size headers (including TCP options) is sent
+  // as-is.
+  size_t restOffset = kTunnelPacketHeaderSize + kHeaderCompressorIPHeaderSize +
+                      transportHeaderSize;
+  size_t restSize = packet.size - restOffset;
+  memmove(packet.data + size, packet.data + restOffset, restSize);
+  memcpy(packet.data, header, size);
+  packet.size = size + restSize;
+
+  return restOffset - size;
+}
+
+void HeaderCompressor::resync(uint8_t contextID) {
+  if (contexts_[contextID].valid) {
+    contexts_[contextID].fullHeadersLeft =
+        kHeaderCompressorFullHeaderRepetitions;
+  }
+}
+
+uint8_t HeaderCompressor::assignContext(FlowKey const& flow,
+                                        Byte const* header) {
+  // Take a free context if there is one, or otherwise the least recently used
+  auto victim = std::min_element(
+      contexts_.begin(), contexts_.end(),
+      [](Context const& a, Context const& b) {
+        return std::make_pair(a.valid, a.lastUsed) <
+               std::make_pair(b.valid, b.lastUsed);
+      });
+  uint8_t contextID = victim - contexts_.begin();
+
+  if (victim->valid) {
+    contextIDs_.erase(victim->flow);
+  }
+
+  victim->valid = true;
+  victim->flow = flow;
+  victim->generation++;
+  victim->tos = header[1];
+  victim->ttl = header[8];
+  victim->fragmentField = readUInt16(header + 6);
+  victim->fullHeadersLeft = kHeaderCompressorFullHeaderRepetitions;
+  contextIDs_[flow] = contextID;
+
+  return contextID;
+}
+
+std::optional<size_t>
+HeaderDecompressor::decompress(DataPacket& packet,
+                               std::optional<uint8_t>& missingContext) {
+  if (packet.size < 1) {
+    return std::nullopt;
+  }
+
+  switch (packet.data[0]) {
+  case kPacketUncompressed:
+    memmove(packet.data, packet.data + 1, packet.size - 1);
+    packet.size -= 1;
+    return 0;
+
+  case kPacketFullHeaders: {
+    if (packet.size < 3 + kHeaderCompressorIPHeaderSize +
+                          kHeaderCompressorPortsSize) {
+      return std::nullopt;
+    }
+
+    Context& context = contexts_[packet.data[1]];
+    Byte* ip = packet.data + 3;
+    context.valid = true;
+    context.generation = packet.data[2];
+    std::copy_n(ip, kHeaderCompressorIPHeaderSize, context.ipHeader.begin());
+    std::copy_n(ip + kHeaderCompressorIPHeaderSize, kHeaderCompressorPortsSize,
+                context.ports.begin());
+    context.resyncRequested = false;
+
+    size_t ipSize = packet.size - 3;
+    memmove(packet.data + kTunnelPacketHeaderSize, ip, ipSize);
+    memcpy(packet.data, kHeaderCompressorTunnelHeader, kTunnelPacketHeaderSize);
+    packet.size = kTunnelPacketHeaderSize + ipSize;
+    return kTunnelPacketHeaderSize - 3;
+  }
+
+  case kPacketCompressedTCP:
+  case kPacketCompressedUDP:
+    break;
+
+  default:
+    return std::nullopt;
+  }
+
+  if (packet.size < kHeaderCompressorPreambleSize) {
+    return std::nullopt;
+  }
+
+  bool isTCP = (packet.data[0] == kPacketCompressedTCP);
+  uint8_t contextID = packet.data[1];
+  Context& context = contexts_[contextID];
+
+  if (!context.valid || context.generation != packet.data[2]) {
+    if (!context.resyncRequested ||
+        ++context.missesSinceRequest >= kHeaderCompressorResyncRetryInterval) {
+      context.resyncRequested = true;
+      context.missesSinceRequest = 0;
+      missingContext = contextID;
+    }
+    return std::nullopt;
+  }
+
+  Byte mask = packet.data[3];
+  size_t offset = kHeaderCompressorPreambleSize;
+  bool truncated = false;
+
+  auto consume = [&packet, &offset, &truncated](Byte* field, size_t size) {
+    if (offset + size > packet.size) {
+      truncated = true;
+      return;
+    }
+    memcpy(field, packet.data + offset, size);
+    offset += size;
+  };
+
+  Byte header[kTunnelPacketHeaderSize + kHeaderCompressorIPHeaderSize +
+              kHeaderCompressorTCPHeaderSize] = {};
+  Byte* ip = header + kTunnelPacketHeaderSize;
+  Byte* transport = ip + kHeaderCompressorIPHeaderSize;
+
+  memcpy(header, kHeaderCompressorTunnelHeader, kTunnelPacketHeaderSize);
+  std::copy(context.ipHeader.begin(), context.ipHeader.end(), ip);
+  std::copy(context.ports.begin(), context.ports.end(), transport);
+
+  if (mask & kFieldTOS) {
+    consume(ip + 1, 1);
+  }
+  if (mask & kFieldTTL) {
+    consume(ip + 8, 1);
+  }
+  if (mask & kFieldFragment) {
+    consume(ip + 6, 2);
+  }
+  consume(ip + 4, 2);
+
+  size_t transportHeaderSize;
+  if (isTCP) {
+    transportHeaderSize = kHeaderCompressorTCPHeaderSize;
+    consume(transport + 4, 14);
+    if (mask & kFieldUrgent) {
+      consume(transport + 18, 2);
+    }
+  } else {
+    transportHeaderSize = kHeaderCompressorUDPHeaderSize;
+    consume(transport + 6, 2);
+  }
+
+  if (truncated) {
+    return std::nullopt;
+  }
+
+  size_t restSize = packet.size - offset;
+  size_t headerSize = kTunnelPacketHeaderSize + kHeaderCompressorIPHeaderSize +
+                      transportHeaderSize;
+  if (headerSize + restSize > packet.capacity) {
+    return std::nullopt;
+  }
+
+  writeUInt16(ip + 2, kHeaderCompressorIPHeaderSize + transportHeaderSize +
+                          restSize);
+  if (!isTCP) {
+    writeUInt16(transport + 4, transportHeaderSize + restSize);
+  }
+  writeUInt16(ip + 10, 0);
+  writeUInt16(ip + 10, computeIPv4Checksum(ip));
+
+  memmove(packet.data + headerSize, packet.data + offset, restSize);
+  memcpy(packet.data, header, headerSize);
+  packet.size = headerSize + restSize;
+
+  return headerSize - offset;
+}
+} // namespace stun
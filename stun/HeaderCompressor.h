@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stun/CoreDataPipe.h>
+
+#include <networking/FlowKey.h>
+
+#include <array>
+#include <optional>
+#include <unordered_map>
+
+namespace stun {
+
+// Compresses the tunnel, IPv4 and TCP/UDP headers of outgoing packets, in the
+// spirit of ROHC (RFC 3095) but much simpler.
+//
+// The fields that stay the same throughout a flow (addresses, ports, TOS, TTL,
+// flags) are stored in a context on both ends. The first few packets of a
+// flow carry the full headers, which sets up the context on the decompressor.
+// After that, packets only carry a context ID and the fields that change.
+//
+// Unlike ROHC, the changing fields are always sent verbatim instead of as
+// deltas. This costs a few bytes but means the contexts never change once set
+// up. Losing or reordering packets can't put the two ends out of sync.
+// Packets that arrive before their context can be requested again through
+// the control channel.
+class HeaderCompressor {
+public:
+  constexpr static size_t MaxContexts = 256;
+  // The most compress() can add to a packet, which it does when it can't
+  // compress it.
+  constexpr static size_t Overhead = 1;
+
+  HeaderCompressor() {}
+
+  // Compresses `packet` in place. Returns the number of bytes saved.
+  size_t compress(DataPacket& packet);
+
+  // Makes the next few packets using `contextID` carry full headers again.
+  void resync(uint8_t contextID);
+
+private:
+  HeaderCompressor(HeaderCompressor const& copy) = delete;
+  HeaderCompressor& operator=(HeaderCompressor const& copy) = delete;
+
+  HeaderCompressor(HeaderCompressor&& move) = delete;
+  HeaderCompressor& operator=(HeaderCompressor&& move) = delete;
+
+  struct Context {
+    bool valid = false;
+    networking::FlowKey flow;
+    uint8_t generation = 0;
+    Byte tos;
+    Byte ttl;
+    uint16_t fragmentField;
+    size_t fullHeadersLeft = 0;
+    size_t lastUsed = 0;
+  };
+
+  struct FlowKeyHasher {
+    size_t operator()(networking::FlowKey const& flow) const {
+      return flow.hash();
+    }
+  };
+
+  std::array<Context, MaxContexts> contexts_;
+  std::unordered_map<networking::FlowKey, uint8_t, FlowKeyHasher> contextIDs_;
+  size_t clock_ = 0;
+
+  uint8_t assignContext(networking::FlowKey const& flow, Byte const* header);
+};
+
+class HeaderDecompressor {
+public:
+  HeaderDecompressor() {}
+
+  // Restores the original headers of `packet` in place. Returns the number of
+  // bytes restored, or std::nullopt if the packet has to be dropped. In that
+  // case `missingContext` is set when the packet's context is unknown (and
+  // should be requested again from the peer).
+  std::optional<size_t> decompress(DataPacket& packet,
+                                   std::optional<uint8_t>& missingContext);
+
+private:
+  HeaderDecompressor(HeaderDecompressor const& copy) = delete;
+  HeaderDecompressor& operator=(HeaderDecompressor const& copy) = delete;
+
+  HeaderDecompressor(HeaderDecompressor&& move) = delete;
+  HeaderDecompressor& operator=(HeaderDecompressor&& move) = delete;
+
+  struct Context {
+    bool valid = false;
+    uint8_t generation = 0;
+    std::array<Byte, 20> ipHeader;
+    std::array<Byte, 4> ports;
+
+    bool resyncRequested = false;
+    size_t missesSinceRequest = 0;
+  };
+
+  std::array<Context, HeaderCompressor::MaxContexts> contexts_;
+};
+} // namespace stun
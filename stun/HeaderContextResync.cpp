@@ -0,0 +1,35 @@
+#include "stun/HeaderContextResync.h"
+
+namespace stun {
+
+using networking::json;
+using networking::Message;
+
+void setUpHeaderContextResync(networking::Messenger& messenger,
+                              stun::Dispatcher& dispatcher) {
+  dispatcher.requestHeaderContextResync = [&messenger](uint8_t contextID) {
+    // If the control channel is backed up, the request will simply be made
+    // again after a few more misses.
+    if (messenger.outboundQ->canPush()->eval()) {
+      messenger.outboundQ->push(
+          Message("header_context_resync", json{{"context_id", contextID}}));
+    }
+  };
+
+  messenger.addHandler(
+      "header_context_resync", [&dispatcher](auto const& message) {
+        auto const& body = message.getBody();
+        auto it = body.find("context_id");
+        if (it == body.end() || !it->is_number_unsigned() ||
+            it->template get<uint64_t>() > UINT8_MAX) {
+          LOG_E("Session") << "Received an invalid header context resync."
+                           << std::endl;
+          return Message::disconnect();
+        }
+
+        dispatcher.resyncHeaderContext(it->template get<uint8_t>());
+        return Message::null();
+      });
+}
+
+}; // namespace stun
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <networking/Messenger.h>
+#include <stun/Dispatcher.h>
+
+namespace stun {
+
+// Lets the Dispatcher-s on both ends ask each other for header compression
+// contexts they have missed, over the control channel.
+void setUpHeaderContextResync(networking::Messenger& messenger,
+                              stun::Dispatcher& dispatcher);
+
+}; // namespace stun
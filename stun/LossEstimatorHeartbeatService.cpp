@@ -2,6 +2,9 @@
 
 #include <json/json.hpp>
 
+#include <memory>
+#include <optional>
+
 namespace {
 using json = nlohmann::json;
 };
@@ -9,15 +12,39 @@ using json = nlohmann::json;
 namespace stun {
 
 networking::Messenger::HeartbeatService
-buildLossEstimatorHeartbeatService(stun::Dispatcher const& dispatcher) {
+buildLossEstimatorHeartbeatService(stun::Dispatcher& dispatcher) {
   auto name = std::string{"loss_estimator"};
 
   auto producer = [&dispatcher]() {
+    auto const& sequenceStats = dispatcher.getSequenceStats();
     return json{{"tx_packets", dispatcher.getStatTxPackets().getCount()},
-                {"rx_packets", dispatcher.getStatRxPackets().getCount()}};
+                {"rx_packets", dispatcher.getStatRxPackets().getCount()},
+                {"rx_sequenced", sequenceStats.totalReceived},
+                {"rx_lost", sequenceStats.totalLost},
+                {"rx_fec_recovered", dispatcher.getFECStats().totalRecovered},
+                {"rx_wire_bytes",
+                 dispatcher.getPacingStats().totalReceivedWireBytes}};
+  };
+
+  // Peer's sequenced totals as of the last heartbeat, used to derive the exact
+  // TX loss over the last interval
+  struct SequencedTotals {
+    size_t received = 0;
+    size_t lost = 0;
+    size_t recovered = 0;
   };
+  auto lastPeerTotals = std::make_shared<SequencedTotals>();
 
-  auto consumer = [&dispatcher](json const& value) {
+  // Same for what the pacer needs
+  struct DeliveryTotals {
+    size_t peerWireBytes = 0;
+    size_t peerRxPackets = 0;
+    std::optional<event::Time> time;
+  };
+  auto lastDelivery = std::make_shared<DeliveryTotals>();
+
+  auto consumer = [&dispatcher, lastPeerTotals,
+                   lastDelivery](json const& value) {
     auto peerTxPackets = value["tx_packets"].get<size_t>();
     auto peerRxPackets = value["rx_packets"].get<size_t>();
 
@@ -37,6 +64,58 @@ buildLossEstimatorHeartbeatService(stun::Dispatcher const& dispatcher) {
 
     LOG_V("LossEstimator") << "TX loss rate: " << myTxLossRate << ", "
                            << "RX loss rate: " << myRxLossRate << std::endl;
+
+    // Peers with sequencing enabled report exactly which packets never made it,
+    // which unlike the packet count comparison above isn't skewed by packets
+    // still in flight.
+    auto peerSequenced = value.value("rx_sequenced", size_t{0});
+    auto peerLost = value.value("rx_lost", size_t{0});
+    auto peerRecovered = value.value("rx_fec_recovered", size_t{0});
+    if (peerSequenced < lastPeerTotals->received ||
+        peerLost < lastPeerTotals->lost ||
+        peerRecovered < lastPeerTotals->recovered) {
+      // The peer's Dispatcher has been recreated
+      *lastPeerTotals = SequencedTotals{};
+    }
+
+    auto intervalReceived = peerSequenced - lastPeerTotals->received;
+    auto intervalLost = peerLost - lastPeerTotals->lost;
+    auto intervalRecovered = peerRecovered - lastPeerTotals->recovered;
+    *lastPeerTotals = SequencedTotals{peerSequenced, peerLost, peerRecovered};
+
+    std::optional<double> intervalLossRate;
+    if (intervalReceived + intervalLost > 0) {
+      auto total = static_cast<double>(intervalReceived + intervalLost);
+      intervalLossRate = (intervalLost + intervalRecovered) / total;
+      LOG_V("LossEstimator")
+          << "Sequenced TX loss rate: " << intervalLost / total << " ("
+          << intervalLost << " lost, " << intervalRecovered
+          << " recovered by FEC)" << std::endl;
+
+      // FEC has to be sized for the loss before recovery, otherwise it would
+      // back off as soon as it starts working.
+      dispatcher.adaptFEC(*intervalLossRate);
+    }
+
+    auto peerWireBytes = value.value("rx_wire_bytes", size_t{0});
+    auto now = event::Timer::getTime();
+    if (peerWireBytes < lastDelivery->peerWireBytes ||
+        peerRxPackets < lastDelivery->peerRxPackets) {
+      *lastDelivery = DeliveryTotals{};
+    }
+
+    if (!!lastDelivery->time) {
+      // Packet counts can't tell loss apart from packets still in flight, and
+      // taking those as loss would hold the rate down for nothing. Without
+      // sequencing, the pacer is told of no loss at all, and so never starts
+      // pacing.
+      dispatcher.adaptPacing(
+          peerWireBytes - lastDelivery->peerWireBytes,
+          std::chrono::duration_cast<event::Duration>(now -
+                                                      *lastDelivery->time),
+          intervalLossRate.value_or(0.0));
+    }
+    *lastDelivery = DeliveryTotals{peerWireBytes, peerRxPackets, now};
   };
 
   return {name, producer, consumer};
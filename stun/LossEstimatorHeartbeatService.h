@@ -6,6 +6,6 @@
 namespace stun {
 
 networking::Messenger::HeartbeatService
-buildLossEstimatorHeartbeatService(stun::Dispatcher const& dispatcher);
+buildLossEstimatorHeartbeatService(stun::Dispatcher& dispatcher);
 
 }; // namespace stun
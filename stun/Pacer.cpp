@@ -0,0 +1,102 @@
+#include "stun/Pacer.h"
+
+#include <algorithm>
+
+namespace stun {
+
+using namespace std::chrono_literals;
+
+// How many heartbeats the delivery rate max filter spans
+static const size_t kPacerBandwidthWindow = 10;
+
+// Gains applied to the bandwidth estimate in turn, one per heartbeat. The
+// probing phase is followed by a draining one to empty the queue it built up.
+static const double kPacerGainCycle[] = {1.25, 0.75, 1.0, 1.0};
+static const size_t kPacerGainCycleLength =
+    sizeof(kPacerGainCycle) / sizeof(kPacerGainCycle[0]);
+
+// Loss rate above which we stop trusting the old delivery rates
+static const double kPacerLossThreshold = 0.02;
+
+// Bytes per second
+static const size_t kPacerMinRate = 128 * 1024;
+
+// The bucket holds enough for this long at the pacing rate, so that the
+// millisecond timer granularity doesn't hold us below the rate.
+static const event::Duration kPacerBurstDuration = 5ms;
+static const size_t kPacerMinBurst = 16 * 1024;
+
+Pacer::Pacer() : bucket_(0, 0) {}
+
+bool Pacer::isReady(event::Time now) {
+  return rate_ == 0 || bucket_.isReady(now);
+}
+
+event::Duration Pacer::getWait(event::Time now) {
+  if (rate_ == 0) {
+    return 0ms;
+  }
+
+  // Rounded up so that we never wake up too early
+  auto wait = bucket_.getWait(now);
+  auto waitMs = std::chrono::duration_cast<event::Duration>(wait);
+  return (waitMs < wait ? waitMs + 1ms : waitMs);
+}
+
+void Pacer::consume(size_t size, event::Time now) {
+  if (rate_ != 0) {
+    bucket_.consume(size, now);
+  }
+}
+
+void Pacer::onFeedback(size_t deliveredBytes, event::Duration interval,
+                       double lossRate) {
+  if (interval <= 0ms) {
+    return;
+  }
+
+  double deliveryRate =
+      deliveredBytes / std::chrono::duration<double>(interval).count();
+  bool limited = limited_;
+  limited_ = false;
+
+  if (lossRate > kPacerLossThreshold) {
+    // The path is dropping what we send, so whatever made it through is the
+    // best guess for its bandwidth now.
+    startup_ = false;
+    deliveryRates_.clear();
+    deliveryRates_.push_back(deliveryRate);
+  } else if (startup_) {
+    // We don't pace until the path has shown that it needs it.
+    return;
+  } else {
+    double bandwidth = (deliveryRates_.empty()
+                            ? 0
+                            : *std::max_element(deliveryRates_.begin(),
+                                                deliveryRates_.end()));
+
+    // When we didn't have enough to send to fill the pacing rate, the delivery
+    // rate says nothing about the path, unless it's a new high.
+    if (limited || deliveryRate > bandwidth) {
+      deliveryRates_.push_back(deliveryRate);
+      if (deliveryRates_.size() > kPacerBandwidthWindow) {
+        deliveryRates_.pop_front();
+      }
+    }
+  }
+
+  double bandwidth =
+      *std::max_element(deliveryRates_.begin(), deliveryRates_.end());
+  double gain = kPacerGainCycle[gainCyclePhase_];
+  gainCyclePhase_ = (gainCyclePhase_ + 1) % kPacerGainCycleLength;
+
+  rate_ = std::max(kPacerMinRate, static_cast<size_t>(gain * bandwidth));
+  double burst = std::max(
+      static_cast<double>(kPacerMinBurst),
+      rate_ * std::chrono::duration<double>(kPacerBurstDuration).count());
+  bucket_.setRate(rate_, burst);
+
+  LOG_V("Pacer") << "Delivery rate " << static_cast<size_t>(deliveryRate)
+                 << " B/s, pacing at " << rate_ << " B/s." << std::endl;
+}
+} // namespace stun
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <common/TokenBucket.h>
+#include <common/Util.h>
+
+#include <event/EventLoop.h>
+
+#include <stats/AvgStat.h>
+
+#include <deque>
+
+namespace stun {
+
+// Pacing stats shared by all DataPipe-s of a Dispatcher. The received wire
+// byte total is reported to the peer, which derives its delivery rate from it.
+struct PacingStats {
+  PacingStats(std::string const& entity,
+              stats::LabelSet const& labels = stats::LabelSet())
+      : statRate(entity, "tx_pacing_rate", labels),
+        statDelay(entity, "tx_pacing_delay", labels) {}
+
+  stats::AvgStat statRate;
+  stats::AvgStat statDelay;
+
+  size_t totalReceivedWireBytes = 0;
+};
+
+// Spreads out the packets sent over UDP DataPipe-s, so that a burst from the
+// tunnel doesn't overflow the (often shallow) buffers along the path.
+//
+// The rate follows a much simplified take on BBR. Each heartbeat tells us how
+// many bytes the peer received over the last interval. The pacing rate is the
+// highest of these delivery rates seen recently, times a gain that cycles to
+// probe for more bandwidth and then drain the queue that probing built up.
+//
+// Unlike BBR, we don't pace at all until the path first loses packets, as a
+// wrong guess would add latency to paths that never needed pacing. After
+// that, loss makes the rate fall back to the current delivery rate. Loss is
+// only measured with sequencing on, so pacing requires it.
+class Pacer {
+public:
+  Pacer();
+
+  // Bytes per second, or 0 when we don't know enough to pace yet.
+  size_t getRate() const { return rate_; }
+
+  bool isReady(event::Time now);
+  event::Duration getWait(event::Time now);
+  void consume(size_t size, event::Time now);
+
+  // Records that we had packets to send but had to wait for the pacer.
+  void markLimited() { limited_ = true; }
+
+  // Feeds in the bytes the peer received over the last `interval`.
+  void onFeedback(size_t deliveredBytes, event::Duration interval,
+                  double lossRate);
+
+private:
+  Pacer(Pacer const& copy) = delete;
+  Pacer& operator=(Pacer const& copy) = delete;
+
+  Pacer(Pacer&& move) = delete;
+  Pacer& operator=(Pacer&& move) = delete;
+
+  common::TokenBucket bucket_;
+  size_t rate_ = 0;
+
+  std::deque<double> deliveryRates_;
+  bool startup_ = true;
+  size_t gainCyclePhase_ = 0;
+  bool limited_ = false;
+};
+} // namespace stun
@@ -0,0 +1,114 @@
+#include "stun/PacketClassifier.h"
+
+#include <networking/FlowKey.h>
+#include <networking/Tunnel.h>
+
+#include <netinet/in.h>
+
+namespace stun {
+
+using networking::FlowKey;
+
+// Expedited Forwarding, and the class selectors for network control
+static const uint8_t kPacketClassifierDSCPEF = 46;
+static const uint8_t kPacketClassifierDSCPCS6 = 48;
+static const uint8_t kPacketClassifierDSCPCS7 = 56;
+// Lower Effort (RFC 8622), and CS1 which served the same purpose before it
+static const uint8_t kPacketClassifierDSCPLE = 1;
+static const uint8_t kPacketClassifierDSCPCS1 = 8;
+
+// Packets on interactive ports bigger than this are likely bulk transfers
+// over the same protocol (e.g. scp over SSH).
+static const size_t kPacketClassifierInteractiveMaxSize = 256;
+
+static const size_t kPacketClassifierQuantum = 1500;
+
+// Whether this is a TCP segment without any payload, i.e. a bare ACK.
+static bool isBareTCPSegment(Byte const* data, size_t size,
+                             FlowKey const& flow) {
+  // Fragments don't have their ports parsed
+  if (flow.protocol != IPPROTO_TCP || flow.srcPort == 0) {
+    return false;
+  }
+
+  size_t ipHeaderSize = 4 * (data[0] & 0x0f);
+  if (size < ipHeaderSize + 13) {
+    return false;
+  }
+  size_t tcpHeaderSize = 4 * (data[ipHeaderSize + 12] >> 4);
+  return size == ipHeaderSize + tcpHeaderSize;
+}
+
+static bool isInteractivePort(uint8_t protocol, uint16_t port) {
+  switch (port) {
+  case 22: // SSH
+  case 53: // DNS
+    return true;
+  case 123:  // NTP
+  case 3478: // STUN/TURN, as used by WebRTC
+  case 5060: // SIP
+    return protocol == IPPROTO_UDP;
+  default:
+    return false;
+  }
+}
+
+/* static */ PacketClass PacketClassifier::classify(Byte const* data,
+                                                    size_t size) {
+  if (size < networking::kTunnelPacketHeaderSize) {
+    return Default;
+  }
+  data += networking::kTunnelPacketHeaderSize;
+  size -= networking::kTunnelPacketHeaderSize;
+
+  auto flow = FlowKey::parse(data, size);
+  if (!flow) {
+    return Default;
+  }
+
+  uint8_t dscp = data[1] >> 2;
+  switch (dscp) {
+  case kPacketClassifierDSCPEF:
+  case kPacketClassifierDSCPCS6:
+  case kPacketClassifierDSCPCS7:
+    return Interactive;
+  case kPacketClassifierDSCPLE:
+  case kPacketClassifierDSCPCS1:
+    return Bulk;
+  }
+
+  if (size <= kPacketClassifierInteractiveMaxSize &&
+      (isInteractivePort(flow->protocol, flow->srcPort) ||
+       isInteractivePort(flow->protocol, flow->dstPort))) {
+    return Interactive;
+  }
+
+  // Holding back ACKs behind our own uploads would slow down downloads.
+  if (isBareTCPSegment(data, size, *flow)) {
+    return Interactive;
+  }
+
+  return Default;
+}
+
+/* static */ std::vector<event::PriorityFIFO<DataPacket>::Class>
+PacketClassifier::getClasses() {
+  return {
+      {true, kPacketClassifierQuantum},
+      {false, 3 * kPacketClassifierQuantum},
+      {false, kPacketClassifierQuantum},
+  };
+}
+
+/* static */ char const* PacketClassifier::getName(PacketClass cls) {
+  switch (cls) {
+  case Interactive:
+    return "interactive";
+  case Default:
+    return "default";
+  case Bulk:
+    return "bulk";
+  }
+  return "unknown";
+}
+} // namespace stun
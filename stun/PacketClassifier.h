@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stun/CoreDataPipe.h>
+
+#include <common/Util.h>
+
+#include <event/PriorityFIFO.h>
+
+#include <vector>
+
+namespace stun {
+
+// Traffic classes of DataPipe::outboundQ, in order of priority.
+enum PacketClass : size_t {
+  // Latency-sensitive traffic: VoIP, DNS, interactive SSH, bare TCP ACKs...
+  Interactive = 0,
+  Default = 1,
+  // Traffic marked as not caring about latency at all
+  Bulk = 2,
+};
+
+// Sorts tunneled packets into PacketClass-es, by their DSCP marking first and
+// then by well-known ports. Packets we can't parse end up in Default.
+class PacketClassifier {
+public:
+  static PacketClass classify(Byte const* data, size_t size);
+
+  // The classes to set up a PriorityFIFO with. Interactive traffic always
+  // goes first, as it's light by nature; the rest share by weight.
+  static std::vector<event::PriorityFIFO<DataPacket>::Class> getClasses();
+
+  static char const* getName(PacketClass cls);
+};
+} // namespace stun
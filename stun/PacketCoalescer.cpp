@@ -0,0 +1,80 @@
+#include "stun/PacketCoalescer.h"
+
+#include <common/Util.h>
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+
+namespace stun {
+
+typedef uint16_t PacketCoalescerLengthType;
+
+static_assert(PacketCoalescer::Overhead == sizeof(PacketCoalescerLengthType),
+              "PacketCoalescer::Overhead is out of date.");
+
+PacketCoalescer::PacketCoalescer(size_t maxBundleSize, size_t capacity)
+    : maxBundleSize_(std::min(maxBundleSize, capacity)), capacity_(capacity) {
+  assertTrue(capacity_ <= DataPacket::Size,
+             "Invalid bundle capacity: " + std::to_string(capacity_));
+}
+
+bool PacketCoalescer::canAppend(DataPacket const& packet) const {
+  if (empty()) {
+    return canBundle(packet);
+  }
+
+  return bundle_.size + sizeof(PacketCoalescerLengthType) + packet.size <=
+         maxBundleSize_;
+}
+
+bool PacketCoalescer::canBundle(DataPacket const& packet) const {
+  return sizeof(PacketCoalescerLengthType) + packet.size <= capacity_;
+}
+
+void PacketCoalescer::append(DataPacket const& packet) {
+  assertTrue(canAppend(packet), "Packet too big to be coalesced.");
+
+  PacketCoalescerLengthType length = htons(packet.size);
+  bundle_.pack(length, bundle_.size);
+  bundle_.fill(packet.data, packet.size, bundle_.size);
+
+  count_++;
+  payloadSize_ += packet.size;
+}
+
+DataPacket PacketCoalescer::flush() {
+  DataPacket bundle = std::move(bundle_);
+  bundle_ = DataPacket();
+  count_ = 0;
+  payloadSize_ = 0;
+  return bundle;
+}
+
+/* static */ bool PacketCoalescer::split(DataPacket const& bundle,
+                                         std::vector<DataPacket>& output) {
+  size_t offset = 0;
+
+  while (offset < bundle.size) {
+    if (offset + sizeof(PacketCoalescerLengthType) > bundle.size) {
+      return false;
+    }
+
+    PacketCoalescerLengthType length;
+    memcpy(&length, bundle.data + offset, sizeof(length));
+    length = ntohs(length);
+    offset += sizeof(length);
+
+    if (offset + length > bundle.size) {
+      return false;
+    }
+
+    DataPacket packet;
+    packet.fill(bundle.data + offset, length);
+    output.emplace_back(std::move(packet));
+    offset += length;
+  }
+
+  return true;
+}
+} // namespace stun
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stun/CoreDataPipe.h>
+
+#include <vector>
+
+namespace stun {
+
+// Packs several small packets into a single bundle, so that they share one
+// padding footer, one encryption IV and one datagram on the wire. Each packet
+// in the bundle is prefixed by its length.
+class PacketCoalescer {
+public:
+  // The length prefix added to each packet
+  constexpr static size_t Overhead = sizeof(uint16_t);
+
+  // Bundles are filled up to `maxBundleSize`, which is clamped to `capacity`,
+  // the most that a bundle can physically hold.
+  PacketCoalescer(size_t maxBundleSize, size_t capacity = DataPacket::Size);
+
+  bool empty() const { return count_ == 0; }
+  size_t getCount() const { return count_; }
+  size_t getPayloadSize() const { return payloadSize_; }
+
+  // Returns whether `packet` would still fit in the current bundle. An empty
+  // bundle takes any packet that fits in a bundle of its own.
+  bool canAppend(DataPacket const& packet) const;
+  void append(DataPacket const& packet);
+
+  // Returns whether `packet` fits in a bundle at all. Those that don't cannot
+  // be sent through this coalescer.
+  bool canBundle(DataPacket const& packet) const;
+
+  // Hands out the current bundle and starts a new one.
+  DataPacket flush();
+
+  // Splits a bundle back into the original packets, appending them to
+  // `output`. Returns false if the bundle turns out to be malformed.
+  static bool split(DataPacket const& bundle, std::vector<DataPacket>& output);
+
+private:
+  PacketCoalescer(PacketCoalescer const& copy) = delete;
+  PacketCoalescer& operator=(PacketCoalescer const& copy) = delete;
+
+  PacketCoalescer(PacketCoalescer&& move) = delete;
+  PacketCoalescer& operator=(PacketCoalescer&& move) = delete;
+
+  size_t maxBundleSize_;
+  size_t capacity_;
+
+  DataPacket bundle_;
+  size_t count_ = 0;
+  size_t payloadSize_ = 0;
+};
+} // namespace stun
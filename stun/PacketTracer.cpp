@@ -0,0 +1,72 @@
+#include "stun/PacketTracer.h"
+
+#include <optional>
+
+namespace stun {
+
+PacketTracer::StageStats::StageStats(std::string const& entity,
+                                     std::string const& prefix,
+                                     std::vector<char const*> const& steps,
+                                     stats::LabelSet const& labels)
+    : total(entity, prefix + "total", labels) {
+  stages.resize(steps.size() + 1);
+  for (size_t i = 0; i < steps.size(); i++) {
+    stages[i + 1].reset(
+        new stats::HistogramStat(entity, prefix + steps[i], labels));
+  }
+}
+
+PacketTracer::PacketTracer(std::string const& entity, size_t sampleInterval,
+                           stats::LabelSet const& labels)
+    : sampleInterval_(sampleInterval), txCountdown_(sampleInterval),
+      rxCountdown_(sampleInterval),
+      txStats_(entity, "tx_latency_",
+               {"dispatch", "queue", "process", "encrypt", "send"}, labels),
+      rxStats_(entity, "rx_latency_", {"decrypt", "reorder", "queue", "write"},
+               labels) {}
+
+void PacketTracer::start(networking::Packet& packet, size_t& countdown,
+                         size_t stage) {
+  if (sampleInterval_ == 0 || --countdown > 0) {
+    return;
+  }
+
+  countdown = sampleInterval_;
+  packet.trace.reset(new PacketTrace());
+  packet.trace->mark(stage);
+}
+
+void PacketTracer::finish(std::unique_ptr<PacketTrace> trace,
+                          StageStats& stats) {
+  if (!trace) {
+    return;
+  }
+
+  auto toMicros = [](PacketTrace::Clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+  };
+
+  // Stages a packet skipped (e.g. encryption when it's disabled) are folded
+  // into the next step.
+  std::optional<size_t> first;
+  size_t last = 0;
+  for (size_t stage = 0; stage < stats.stages.size(); stage++) {
+    if (!trace->has(stage)) {
+      continue;
+    }
+
+    if (!!first) {
+      stats.stages[stage]->accumulate(
+          toMicros(trace->stamps[stage] - trace->stamps[last]));
+    } else {
+      first = stage;
+    }
+    last = stage;
+  }
+
+  if (!!first) {
+    stats.total.accumulate(
+        toMicros(trace->stamps[last] - trace->stamps[*first]));
+  }
+}
+} // namespace stun
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <networking/Packet.h>
+#include <stats/HistogramStat.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace stun {
+
+using networking::PacketTrace;
+
+// Stages a sent packet is traced through, in order
+enum TxTraceStage : size_t {
+  // Read from the tunnel
+  TxTunnelRead = 0,
+  // Pushed into a DataPipe's outboundQ
+  TxDispatched = 1,
+  // Popped by the DataPipe
+  TxDequeued = 2,
+  // Sequenced, compressed, coalesced and FEC-protected
+  TxPreEncrypt = 3,
+  TxPostEncrypt = 4,
+  // Handed to the socket
+  TxSent = 5,
+};
+
+// Stages a received packet is traced through, in order
+enum RxTraceStage : size_t {
+  // Read from the socket
+  RxReceived = 0,
+  RxDecrypted = 1,
+  // FEC-decoded, split, decompressed, reordered and pushed into inboundQ
+  RxDelivered = 2,
+  // Popped by the Dispatcher
+  RxDequeued = 3,
+  // Written into the tunnel
+  RxWritten = 4,
+};
+
+// Follows one in every `sampleInterval` packets through the pipeline in each
+// direction, and records the time spent between consecutive stages (plus the
+// total) into latency histograms, in microseconds.
+//
+// Packets that aren't sampled don't carry a PacketTrace at all, so marking
+// them costs a null check.
+class PacketTracer {
+public:
+  // A `sampleInterval` of 0 disables tracing.
+  PacketTracer(std::string const& entity, size_t sampleInterval,
+               stats::LabelSet const& labels = stats::LabelSet());
+
+  // Starts tracing `packet` at the first stage, if it's the one to sample.
+  void startTx(networking::Packet& packet) {
+    start(packet, txCountdown_, TxTunnelRead);
+  }
+  void startRx(networking::Packet& packet) {
+    start(packet, rxCountdown_, RxReceived);
+  }
+
+  static void mark(networking::Packet& packet, size_t stage) {
+    if (!!packet.trace) {
+      packet.trace->mark(stage);
+    }
+  }
+
+  void finishTx(std::unique_ptr<PacketTrace> trace) {
+    finish(std::move(trace), txStats_);
+  }
+  void finishRx(std::unique_ptr<PacketTrace> trace) {
+    finish(std::move(trace), rxStats_);
+  }
+
+private:
+  PacketTracer(PacketTracer const& copy) = delete;
+  PacketTracer& operator=(PacketTracer const& copy) = delete;
+
+  PacketTracer(PacketTracer&& move) = delete;
+  PacketTracer& operator=(PacketTracer&& move) = delete;
+
+  struct StageStats {
+    // `steps` names the step ending at each stage but the first
+    StageStats(std::string const& entity, std::string const& prefix,
+               std::vector<char const*> const& steps,
+               stats::LabelSet const& labels);
+
+    // Indexed by the stage a step ends at, so the first one is empty
+    std::vector<std::unique_ptr<stats::HistogramStat>> stages;
+    stats::HistogramStat total;
+  };
+
+  size_t sampleInterval_;
+  size_t txCountdown_;
+  size_t rxCountdown_;
+
+  StageStats txStats_;
+  StageStats rxStats_;
+
+  void start(networking::Packet& packet, size_t& countdown, size_t stage);
+  void finish(std::unique_ptr<PacketTrace> trace, StageStats& stats);
+};
+} // namespace stun
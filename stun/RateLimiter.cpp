@@ -0,0 +1,126 @@
+#include "stun/RateLimiter.h"
+
+#include <stun/CoreDataPipe.h>
+
+#include <algorithm>
+
+namespace stun {
+
+using namespace std::chrono_literals;
+
+static double getBurstSize(size_t rate, event::Duration burst) {
+  // At least a full packet, or nothing would ever get through
+  return std::max(static_cast<double>(DataPacket::Size),
+                  rate * std::chrono::duration<double>(burst).count());
+}
+
+static event::Duration roundUp(common::TokenBucket::Clock::duration wait) {
+  auto waitMs = std::chrono::duration_cast<event::Duration>(wait);
+  return (waitMs < wait ? waitMs + 1ms : waitMs);
+}
+
+RateLimiter::Node::Node(size_t rate, event::Duration burst)
+    : rate(rate), buckets{common::TokenBucket{static_cast<double>(rate),
+                                              getBurstSize(rate, burst)},
+                          common::TokenBucket{static_cast<double>(rate),
+                                              getBurstSize(rate, burst)}} {}
+
+RateLimiter::RateLimiter(Config config) : config_(config) {
+  if (config_.totalRate != 0) {
+    total_.reset(new Node(config_.totalRate, config_.burst));
+  }
+}
+
+std::unique_ptr<RateLimiter::Session>
+RateLimiter::createSession(std::string const& user) {
+  Node* userNode = nullptr;
+
+  auto rate = config_.userRates.find(user);
+  if (rate != config_.userRates.end()) {
+    auto& node = users_[user];
+    if (!node) {
+      node.reset(new Node(rate->second, config_.burst));
+    }
+    userNode = node.get();
+  }
+
+  if (userNode == nullptr && !total_) {
+    return nullptr;
+  }
+
+  auto session = std::unique_ptr<Session>(new Session(*this, userNode));
+  if (userNode != nullptr) {
+    userNode->sessions.push_back(session.get());
+    rebalance(*userNode);
+  }
+  return session;
+}
+
+void RateLimiter::rebalance(Node& user) {
+  if (user.sessions.empty()) {
+    return;
+  }
+
+  size_t share = user.rate / user.sessions.size();
+  for (auto session : user.sessions) {
+    for (auto& bucket : session->buckets_) {
+      bucket.setRate(share, getBurstSize(share, config_.burst));
+    }
+  }
+}
+
+RateLimiter::Session::Session(RateLimiter& limiter, Node* user)
+    : limiter_(limiter), user_(user), buckets_{common::TokenBucket{0, 0},
+                                               common::TokenBucket{0, 0}} {}
+
+RateLimiter::Session::~Session() {
+  if (user_ == nullptr) {
+    return;
+  }
+
+  auto& sessions = user_->sessions;
+  sessions.erase(std::find(sessions.begin(), sessions.end(), this));
+  limiter_.rebalance(*user_);
+}
+
+bool RateLimiter::Session::isReady(Direction direction, event::Time now) {
+  if (!!limiter_.total_ && !limiter_.total_->buckets[direction].isReady(now)) {
+    return false;
+  }
+
+  return user_ == nullptr || buckets_[direction].isReady(now) ||
+         user_->buckets[direction].isReady(now);
+}
+
+void RateLimiter::Session::consume(Direction direction, size_t size,
+                                   event::Time now) {
+  if (!!limiter_.total_) {
+    limiter_.total_->buckets[direction].consume(size, now);
+  }
+
+  if (user_ != nullptr) {
+    // Only packets within the session's own share are charged to it. Once
+    // it's borrowing, its own bucket is left to refill.
+    if (buckets_[direction].isReady(now)) {
+      buckets_[direction].consume(size, now);
+    }
+    user_->buckets[direction].consume(size, now);
+  }
+}
+
+event::Duration RateLimiter::Session::getWait(Direction direction,
+                                              event::Time now) {
+  auto wait = 0ms;
+
+  if (user_ != nullptr) {
+    wait = std::min(roundUp(buckets_[direction].getWait(now)),
+                    roundUp(user_->buckets[direction].getWait(now)));
+  }
+  if (!!limiter_.total_) {
+    wait = std::max(wait,
+                    roundUp(limiter_.total_->buckets[direction].getWait(now)));
+  }
+
+  return wait;
+}
+} // namespace stun
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <common/TokenBucket.h>
+#include <common/Util.h>
+
+#include <event/EventLoop.h>
+
+#include <array>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace stun {
+
+// Per-user bandwidth shaping on the server, loosely modelled after HTB.
+//
+// Buckets form a hierarchy of (optionally) all users together, each user, and
+// each of a user's sessions. A session is guaranteed an equal share of its
+// user's rate, and may borrow what the user's other sessions leave unused.
+// The total rate, if set, caps everything.
+//
+// Both directions are shaped separately, each at the configured rate.
+class RateLimiter {
+public:
+  struct Config {
+    // Bytes per second for each user
+    std::map<std::string, size_t> userRates;
+    // Bytes per second for all users together, or 0 for no limit
+    size_t totalRate;
+    // How long the buckets can save up for at their rate
+    event::Duration burst;
+  };
+
+  enum Direction {
+    // From the tunnel towards the client
+    TX = 0,
+    // From the client into the tunnel
+    RX = 1,
+  };
+
+  class Session;
+
+  RateLimiter(Config config);
+
+  // Returns nullptr for a session that isn't limited at all.
+  std::unique_ptr<Session> createSession(std::string const& user);
+
+private:
+  RateLimiter(RateLimiter const& copy) = delete;
+  RateLimiter& operator=(RateLimiter const& copy) = delete;
+
+  RateLimiter(RateLimiter&& move) = delete;
+  RateLimiter& operator=(RateLimiter&& move) = delete;
+
+  struct Node {
+    Node(size_t rate, event::Duration burst);
+
+    size_t rate;
+    std::array<common::TokenBucket, 2> buckets;
+    std::vector<Session*> sessions;
+  };
+
+  Config config_;
+  std::unique_ptr<Node> total_;
+  std::map<std::string, std::unique_ptr<Node>> users_;
+
+  void rebalance(Node& user);
+};
+
+class RateLimiter::Session {
+public:
+  ~Session();
+
+  bool isReady(Direction direction, event::Time now);
+  void consume(Direction direction, size_t size, event::Time now);
+  event::Duration getWait(Direction direction, event::Time now);
+
+private:
+  friend class RateLimiter;
+
+  Session(RateLimiter& limiter, Node* user);
+
+  Session(Session const& copy) = delete;
+  Session& operator=(Session const& copy) = delete;
+
+  Session(Session&& move) = delete;
+  Session& operator=(Session&& move) = delete;
+
+  RateLimiter& limiter_;
+  Node* user_;
+  std::array<common::TokenBucket, 2> buckets_;
+};
+} // namespace stun
@@ -0,0 +1,127 @@
+#include "stun/SequenceWindow.h"
+
+namespace stun {
+
+bool SequenceWindow::test(uint64_t seq) const {
+  return (bitmap_[(seq % Size) / 64] >> (seq % 64)) & 1;
+}
+
+void SequenceWindow::set(uint64_t seq) {
+  bitmap_[(seq % Size) / 64] |= (uint64_t{1} << (seq % 64));
+}
+
+void SequenceWindow::clear(uint64_t seq) {
+  bitmap_[(seq % Size) / 64] &= ~(uint64_t{1} << (seq % 64));
+}
+
+size_t SequenceWindow::advanceTo(uint64_t end) {
+  size_t lost = 0;
+
+  if (end - end_ >= Size) {
+    // The whole window slides out, and so does everything in between.
+    for (uint64_t seq = (end_ > Size ? end_ - Size : 0); seq < end_; seq++) {
+      lost += (test(seq) ? 0 : 1);
+    }
+    lost += (end - Size) - end_;
+    bitmap_.fill(0);
+  } else {
+    for (uint64_t seq = end_; seq < end; seq++) {
+      // Slot seq is shared with seq - Size, which is sliding out right now.
+      if (seq >= Size && !test(seq - Size)) {
+        lost++;
+      }
+      clear(seq);
+    }
+  }
+
+  end_ = end;
+  return lost;
+}
+
+SequenceWindow::Verdict SequenceWindow::accept(uint32_t seq) {
+  auto verdict = Verdict{};
+
+  // Extend the 32-bit wire sequence number to 64 bits by picking the candidate
+  // closest to what we have seen so far (serial number arithmetic).
+  auto delta = static_cast<int32_t>(seq - static_cast<uint32_t>(end_));
+  if (delta < 0 && static_cast<uint64_t>(-static_cast<int64_t>(delta)) > end_) {
+    return verdict;
+  }
+  uint64_t extended = end_ + delta;
+
+  if (extended >= end_) {
+    verdict.lost = advanceTo(extended + 1);
+  } else if (end_ - extended > Size || test(extended)) {
+    // Either a duplicate, or too old to tell whether it is one.
+    return verdict;
+  } else {
+    verdict.reordered = true;
+  }
+
+  set(extended);
+  verdict.seq = extended;
+  return verdict;
+}
+
+void ReorderBuffer::insert(uint64_t seq, DataPacket packet, event::Time now,
+                           std::deque<DataPacket>& output) {
+  if (seq < next_) {
+    // We have already given up waiting for this one. Late is still better than
+    // never for the inner flows.
+    output.push_back(std::move(packet));
+    return;
+  }
+
+  pending_.emplace(seq, std::move(packet));
+
+  if (pending_.size() > Capacity) {
+    // Out of room. Skip ahead to the lowest packet we are holding.
+    next_ = pending_.begin()->first;
+  }
+
+  releaseInOrder(output);
+
+  if (pending_.count(seq) != 0) {
+    arrivals_.emplace_back(now, seq);
+  }
+  dropStaleArrivals();
+}
+
+void ReorderBuffer::release(event::Time now, std::deque<DataPacket>& output) {
+  while (!arrivals_.empty() && arrivals_.front().first + budget_ <= now) {
+    // This packet has waited long enough. Whatever gaps are still in front of
+    // it have had their chance to fill.
+    uint64_t expired = arrivals_.front().second;
+    arrivals_.pop_front();
+
+    while (!pending_.empty() && pending_.begin()->first <= expired) {
+      next_ = pending_.begin()->first;
+      releaseInOrder(output);
+    }
+  }
+
+  dropStaleArrivals();
+}
+
+std::optional<event::Time> ReorderBuffer::getDeadline() const {
+  if (arrivals_.empty()) {
+    return std::nullopt;
+  }
+
+  return arrivals_.front().first + budget_;
+}
+
+void ReorderBuffer::releaseInOrder(std::deque<DataPacket>& output) {
+  while (!pending_.empty() && pending_.begin()->first == next_) {
+    output.push_back(std::move(pending_.begin()->second));
+    pending_.erase(pending_.begin());
+    next_++;
+  }
+}
+
+void ReorderBuffer::dropStaleArrivals() {
+  while (!arrivals_.empty() && arrivals_.front().second < next_) {
+    arrivals_.pop_front();
+  }
+}
+} // namespace stun
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stun/CoreDataPipe.h>
+
+#include <event/EventLoop.h>
+#include <stats/RateStat.h>
+
+#include <array>
+#include <deque>
+#include <map>
+#include <optional>
+
+namespace stun {
+
+// Sequencing stats shared by all DataPipe-s of a Dispatcher. The RateStat-s
+// report per-interval counts, while the totals are used by the loss estimator
+// heartbeat to report exact loss figures back to the peer.
+struct SequenceStats {
+  SequenceStats(std::string const& entity,
+                stats::LabelSet const& labels = stats::LabelSet())
+      : statLost(entity, "rx_lost", labels),
+        statReordered(entity, "rx_reordered", labels),
+        statReplayed(entity, "rx_replayed", labels) {}
+
+  stats::RateStat statLost;
+  stats::RateStat statReordered;
+  stats::RateStat statReplayed;
+
+  size_t totalReceived = 0;
+  size_t totalLost = 0;
+};
+
+// Receive-side sliding window over per-DataPipe sequence numbers, in the style
+// of the IPsec anti-replay window. It rejects duplicates and packets that are
+// too old to tell apart from replays, and counts a packet as lost once it
+// slides out of the window without having been received.
+class SequenceWindow {
+public:
+  constexpr static size_t Size = 1024;
+
+  struct Verdict {
+    // The sequence number extended to 64 bits, or std::nullopt if the packet
+    // is a duplicate / replay and should be dropped.
+    std::optional<uint64_t> seq;
+    // Number of packets that slid out of the window unreceived.
+    size_t lost = 0;
+    bool reordered = false;
+  };
+
+  SequenceWindow() {}
+
+  Verdict accept(uint32_t seq);
+
+private:
+  SequenceWindow(SequenceWindow const& copy) = delete;
+  SequenceWindow& operator=(SequenceWindow const& copy) = delete;
+
+  SequenceWindow(SequenceWindow&& move) = delete;
+  SequenceWindow& operator=(SequenceWindow&& move) = delete;
+
+  // Number of sequence numbers seen so far, i.e. one past the highest extended
+  // sequence number received.
+  uint64_t end_ = 0;
+  std::array<uint64_t, Size / 64> bitmap_ = {};
+
+  bool test(uint64_t seq) const;
+  void set(uint64_t seq);
+  void clear(uint64_t seq);
+  size_t advanceTo(uint64_t end);
+};
+
+// Holds out-of-order packets for up to a latency budget so that they can be
+// released in sequence order. Gaps that don't fill within the budget are
+// skipped over.
+class ReorderBuffer {
+public:
+  constexpr static size_t Capacity = 256;
+
+  ReorderBuffer(event::Duration budget) : budget_(budget) {}
+
+  void insert(uint64_t seq, DataPacket packet, event::Time now,
+              std::deque<DataPacket>& output);
+  void release(event::Time now, std::deque<DataPacket>& output);
+
+  std::optional<event::Time> getDeadline() const;
+
+private:
+  ReorderBuffer(ReorderBuffer const& copy) = delete;
+  ReorderBuffer& operator=(ReorderBuffer const& copy) = delete;
+
+  ReorderBuffer(ReorderBuffer&& move) = delete;
+  ReorderBuffer& operator=(ReorderBuffer&& move) = delete;
+
+  event::Duration budget_;
+
+  uint64_t next_ = 0;
+  std::map<uint64_t, DataPacket> pending_;
+  std::deque<std::pair<event::Time, uint64_t>> arrivals_;
+
+  void releaseInOrder(std::deque<DataPacket>& output);
+  void dropStaleArrivals();
+};
+} // namespace stun
@@ -13,10 +13,12 @@ Server::Server(event::EventLoop& loop, Config config)
   IPTables::masquerade(config.addressPool, config.masqueradeOutputInterface,
                        config.configID);
   addrPool.reset(new IPAddressPool(config.addressPool));
+  rateLimiter.reset(new RateLimiter(config.rateLimits));
 
   for (auto const& entry : config_.staticHosts) {
     addrPool->reserve(entry.second);
   }
+  addrPool->persistLeases(config.configID);
 
   server_.reset(new TCPServer(loop, networking::NetworkType::IPv4));
   listener_ =
@@ -48,7 +50,18 @@ void Server::doAccept() {
                                    config_.dataPipeRotationInterval,
                                    config_.authentication,
                                    config_.quotaTable,
-                                   config_.mtu};
+                                   config_.mtu,
+                                   config_.flowPinning,
+                                   config_.headerCompression,
+                                   config_.sequencing,
+                                   config_.reorderLatencyBudget,
+                                   config_.fecGroupSize,
+                                   config_.coalescingSize,
+                                   config_.coalescingDelay,
+                                   config_.pacing,
+                                   config_.priorityQueuing,
+                                   config_.traceSampleInterval,
+                                   config_.tcpOptions};
 
   auto handler = std::make_unique<ServerSessionHandler>(
       loop_, this, sessionConfig,
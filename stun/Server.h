@@ -28,7 +28,19 @@ public:
     event::Duration dataPipeRotationInterval;
     bool authentication;
     size_t mtu;
+    bool flowPinning;
+    bool headerCompression;
+    bool sequencing;
+    event::Duration reorderLatencyBudget;
+    size_t fecGroupSize;
+    size_t coalescingSize;
+    event::Duration coalescingDelay;
+    bool pacing;
+    bool priorityQueuing;
+    size_t traceSampleInterval;
+    TCPCoreDataPipe::SocketOptions tcpOptions;
     std::map<std::string, size_t> quotaTable;
+    RateLimiter::Config rateLimits;
     std::map<std::string, IPAddress> staticHosts;
     std::vector<networking::IPAddress> dnsPushes;
   };
@@ -36,6 +48,7 @@ public:
   Server(event::EventLoop& loop, Config config);
 
   std::unique_ptr<IPAddressPool> addrPool;
+  std::unique_ptr<RateLimiter> rateLimiter;
 
 private:
   event::EventLoop& loop_;
@@ -1,5 +1,6 @@
 #include "stun/ServerSessionHandler.h"
 
+#include <stun/HeaderContextResync.h>
 #include <stun/LossEstimatorHeartbeatService.h>
 #include <stun/Server.h>
 
@@ -129,10 +130,10 @@ ServerSessionHandler::ServerSessionHandler(
 }
 
 void ServerSessionHandler::savePriorQuota() {
-  auto& notebook = common::Notebook::getInstance();
-  notebook["priorQuotas"][config_.user] =
-      config_.priorQuotaUsed + dispatcher_->bytesDispatched;
-  notebook.save();
+  auto priorQuotaUsed = config_.priorQuotaUsed + dispatcher_->bytesDispatched;
+  common::Notebook::getInstance().update([this, priorQuotaUsed](json& notes) {
+    notes["priorQuotas"][config_.user] = priorQuotaUsed;
+  });
 }
 
 ServerSessionHandler::~ServerSessionHandler() {
@@ -193,15 +194,15 @@ void ServerSessionHandler::attachHandlers() {
                          << config_.quota << " bytes." << std::endl;
 
         // Retrieve the user's prior used quota
-        auto& notebook = common::Notebook::getInstance();
-        if (notebook["priorQuotas"].is_null()) {
-          notebook["priorQuotas"] = json({});
-        }
-        if (notebook["priorQuotas"][config_.user].is_null()) {
-          notebook["priorQuotas"][config_.user] = 0;
-        }
-        config_.priorQuotaUsed = notebook["priorQuotas"][config_.user];
-        notebook.save();
+        common::Notebook::getInstance().update([this](json& notes) {
+          if (notes["priorQuotas"].is_null()) {
+            notes["priorQuotas"] = json({});
+          }
+          if (notes["priorQuotas"][config_.user].is_null()) {
+            notes["priorQuotas"][config_.user] = 0;
+          }
+          config_.priorQuotaUsed = notes["priorQuotas"][config_.user];
+        });
 
         if (config_.quota != 0) {
           quotaReporter_.reset(new QuotaReporter(this));
@@ -216,6 +217,17 @@ void ServerSessionHandler::attachHandlers() {
       config_.mtu = std::min(config_.mtu, clientMtu);
     }
 
+    // Leave room for what the tunnel, header compression and the data pipes
+    // add to each packet
+    size_t maxMTU = Dispatcher::getMaxMTU(getDataPipeConfig(),
+                                          config_.headerCompression);
+    if (config_.mtu > maxMTU) {
+      LOG_I("Session") << getClientLogTag() << ": Lowering MTU from "
+                       << config_.mtu << " to " << maxMTU
+                       << " to fit packet overheads." << std::endl;
+      config_.mtu = maxMTU;
+    }
+
     // Acquire IP addresses
     config_.myTunnelAddr = server_->addrPool->acquire();
 
@@ -242,9 +254,14 @@ void ServerSessionHandler::attachHandlers() {
     InterfaceConfig::setLinkAddress(tunnel->deviceName, config_.myTunnelAddr,
                                     config_.peerTunnelAddr);
 
-    dispatcher_.reset(new Dispatcher(loop_, std::move(tunnel)));
+    dispatcher_.reset(new Dispatcher(
+        loop_, std::move(tunnel),
+        Dispatcher::Config{config_.flowPinning, config_.headerCompression,
+                           config_.traceSampleInterval, createStatLabels()}));
+    dispatcher_->limitRate(server_->rateLimiter->createSession(config_.user));
     messenger_->addHeartbeatService(
         buildLossEstimatorHeartbeatService(*dispatcher_));
+    setUpHeaderContextResync(*messenger_, *dispatcher_);
 
     if (body.find("provided_subnets") != body.end()) {
       for (auto const& subnetString : body["provided_subnets"]) {
@@ -286,6 +303,8 @@ void ServerSessionHandler::attachHandlers() {
           ServerSessionHandler, &ServerSessionHandler::doRotateDataPipe>(this);
     }
 
+    messenger_->setAuthenticated();
+
     return Message("config",
                    json{
                        {"server_tunnel_ip", config_.myTunnelAddr},
@@ -293,6 +312,7 @@ void ServerSessionHandler::attachHandlers() {
                        {"server_subnet", server_->config_.addressPool},
                        {"mtu", config_.mtu},
                        {"dns_pushes", server_->config_.dnsPushes},
+                       {"header_compression", config_.headerCompression},
                    });
   });
 
@@ -310,43 +330,27 @@ json ServerSessionHandler::createDataPipe() {
   LOG_V("Session") << getClientLogTag() << ": Creating a new data pipe."
                    << std::endl;
 
-  // Prepare encryption config
-  std::string aesKey;
-  if (config_.encryption) {
-    aesKey = crypto::AESKey::randomStringKey();
-  } else {
-    LOG_V("Session") << getClientLogTag()
-                     << ": Data encryption is disabled per configuration."
-                     << std::endl;
-  }
+  auto dataPipeType = getDataPipeType();
 
-  auto ttl = (config_.dataPipeRotationInterval == 0s
-                  ? 0s
-                  : config_.dataPipeRotationInterval +
-                        kSessionHandlerRotationGracePeriod);
-
-  auto dataPipeType = DataPipeType::UDP;
-  for (auto preferredType : config_.dataPipePreference) {
-    if (kSessionHandlerSupportedDataPipeTypes.count(preferredType) != 0) {
-      dataPipeType = preferredType;
-      break;
-    }
-  }
-
-  auto coreConfig = [dataPipeType]() -> DataPipe::CoreConfig {
+  auto coreConfig = [this, dataPipeType]() -> DataPipe::CoreConfig {
     switch (dataPipeType) {
     case DataPipeType::UDP:
       return UDPCoreDataPipe::ServerConfig{};
       break;
     case DataPipeType::TCP:
-      return TCPCoreDataPipe::ServerConfig{};
+      return TCPCoreDataPipe::ServerConfig{config_.tcpOptions};
       break;
     }
   }();
 
-  auto dataPipeConfig = DataPipe::Config{
-      coreConfig, DataPipe::CommonConfig{aesKey, config_.paddingTo,
-                                         config_.compression, ttl}};
+  auto commonConfig = getDataPipeConfig();
+  if (commonConfig.aesKey.empty()) {
+    LOG_V("Session") << getClientLogTag()
+                     << ": Data encryption is disabled per configuration."
+                     << std::endl;
+  }
+
+  auto dataPipeConfig = DataPipe::Config{coreConfig, commonConfig};
   auto dataPipe = std::make_unique<DataPipe>(loop_, std::move(dataPipeConfig));
   auto port = [dataPipeType, &dataPipe]() {
     switch (dataPipeType) {
@@ -360,9 +364,45 @@ json ServerSessionHandler::createDataPipe() {
 
   return json{{"type", dataPipeType},
               {"port", port},
-              {"aes_key", aesKey},
-              {"padding_to_size", config_.paddingTo},
-              {"compression", config_.compression}};
+              {"aes_key", commonConfig.aesKey},
+              {"padding_to_size", commonConfig.minPaddingTo},
+              {"compression", commonConfig.compression},
+              {"sequencing", commonConfig.sequencing},
+              {"fec_group_size", commonConfig.fecGroupSize},
+              {"coalesce_to", commonConfig.coalescingSize},
+              {"pacing", commonConfig.pacing}};
+}
+
+// Every data pipe gets a fresh AES key, if encryption is enabled.
+DataPipe::CommonConfig ServerSessionHandler::getDataPipeConfig() const {
+  auto aesKey =
+      (config_.encryption ? crypto::AESKey::randomStringKey() : std::string());
+
+  auto ttl = (config_.dataPipeRotationInterval == 0s
+                  ? 0s
+                  : config_.dataPipeRotationInterval +
+                        kSessionHandlerRotationGracePeriod);
+
+  // TCP doesn't lose packets, so there is nothing for FEC to recover. It
+  // also does its own congestion control, so there's no need to pace it.
+  // Pacing is driven by loss, which only sequencing measures reliably.
+  auto dataPipeType = getDataPipeType();
+  auto fecGroupSize =
+      (dataPipeType == DataPipeType::UDP ? config_.fecGroupSize : 0);
+  auto pacing = (dataPipeType == DataPipeType::UDP && config_.pacing &&
+                 config_.sequencing);
+
+  return DataPipe::CommonConfig{aesKey,
+                                config_.paddingTo,
+                                config_.compression,
+                                ttl,
+                                config_.sequencing,
+                                config_.reorderLatencyBudget,
+                                fecGroupSize,
+                                config_.coalescingSize,
+                                config_.coalescingDelay,
+                                pacing,
+                                config_.priorityQueuing};
 }
 
 std::string ServerSessionHandler::getClientLogTag() const {
@@ -373,4 +413,26 @@ std::string ServerSessionHandler::getClientLogTag() const {
   }
 }
 
+DataPipeType ServerSessionHandler::getDataPipeType() const {
+  for (auto preferredType : config_.dataPipePreference) {
+    if (kSessionHandlerSupportedDataPipeTypes.count(preferredType) != 0) {
+      return preferredType;
+    }
+  }
+  return DataPipeType::UDP;
+}
+
+// Sessions are told apart by the client's tunnel address, which is unique
+// among the live ones.
+stats::LabelSet ServerSessionHandler::createStatLabels() const {
+  auto labels = stats::Labels{
+      {"session", config_.peerTunnelAddr.toString()},
+      {"pipe", json(getDataPipeType()).get<std::string>()},
+  };
+  if (config_.authentication) {
+    labels.emplace_back("user", config_.user);
+  }
+  return stats::LabelSet(std::move(labels));
+}
+
 } // namespace stun
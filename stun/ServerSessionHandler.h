@@ -32,6 +32,17 @@ public:
     bool authentication;
     std::map<std::string, size_t> quotaTable;
     size_t mtu;
+    bool flowPinning;
+    bool headerCompression;
+    bool sequencing;
+    event::Duration reorderLatencyBudget;
+    size_t fecGroupSize;
+    size_t coalescingSize;
+    event::Duration coalescingDelay;
+    bool pacing;
+    bool priorityQueuing;
+    size_t traceSampleInterval;
+    TCPCoreDataPipe::SocketOptions tcpOptions;
 
     std::vector<DataPipeType> dataPipePreference;
     std::string user = "";
@@ -77,9 +88,12 @@ private:
 
   void attachHandlers();
   json createDataPipe();
+  DataPipe::CommonConfig getDataPipeConfig() const;
   void doRotateDataPipe();
   void savePriorQuota();
 
   std::string getClientLogTag() const;
+  DataPipeType getDataPipeType() const;
+  stats::LabelSet createStatLabels() const;
 };
 } // namespace stun
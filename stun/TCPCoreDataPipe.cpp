@@ -2,94 +2,252 @@
 
 namespace stun {
 
+// Zero-copy only pays off for large writes, as the kernel has to pin the
+// pages and report back on each of them.
+static const size_t kTCPCoreDataPipeZeroCopyMinSize = 16384;
+
 TCPCoreDataPipe::TCPCoreDataPipe(event::EventLoop& loop, ClientConfig config)
-    : CoreDataPipe{}, role_{Role::CLIENT}, socket_{new networking::TCPSocket{
-                                               loop, config.addr.type}},
+    : CoreDataPipe{}, loop_{loop}, role_{Role::CLIENT},
+      options_{config.options},
+      socket_{new networking::TCPSocket{loop, config.addr.type}},
       canSend_{loop.createComputedCondition()},
       canReceive_{loop.createComputedCondition()} {
+  // Buffer sizes need to be set before connecting to affect window scaling.
+  applySocketOptions();
   socket_->connect(std::move(config.addr));
 
   canSend_->expression = [this]() {
-    return (socket_->isConnected()) && (socket_->canWrite()->eval());
+    return !!closedReason_ || (socket_->isConnected() && hasRoomForPacket());
   };
   canReceive_->expression = [this]() {
-    return (socket_->isConnected()) && (socket_->canRead()->eval());
+    return !!closedReason_ || hasBufferedFrame() ||
+           ((socket_->isConnected()) && (socket_->canRead()->eval()));
   };
+
+  setUpFlusher();
 }
 
 TCPCoreDataPipe::TCPCoreDataPipe(event::EventLoop& loop, ServerConfig config)
-    : CoreDataPipe{}, role_{Role::SERVER}, server_{new networking::TCPServer{
-                                               loop,
-                                               networking::NetworkType::IPv4}},
+    : CoreDataPipe{}, loop_{loop}, role_{Role::SERVER},
+      options_{config.options}, server_{
+          new networking::TCPServer{loop, networking::NetworkType::IPv4}},
       canSend_{loop.createComputedCondition()},
       canReceive_{loop.createComputedCondition()} {
   server_->bind(0);
 
   canSend_->expression = [this]() {
-    return !!socket_ && socket_->canWrite()->eval();
+    return !!closedReason_ || (!!socket_ && hasRoomForPacket());
   };
 
   canReceive_->expression = [this]() {
-    return !!socket_ && socket_->canRead()->eval();
+    return !!closedReason_ || hasBufferedFrame() ||
+           (!!socket_ && socket_->canRead()->eval());
   };
 
   loop.arm("stun::TCPCoreDataPipe::serverCanAcceptTrigger",
            {server_->canAccept()}, [this]() {
              socket_ = std::unique_ptr<networking::TCPSocket>{
                  new networking::TCPSocket{server_->accept()}};
+             applySocketOptions();
+             setUpFlusher();
            });
 }
 
-/* virtual */ bool TCPCoreDataPipe::send(DataPacket packet) /* override */ {
-  if (packetBytesSent_ == packetToSend_.size) {
-    // Done with the current packet. Need to construct a new packet.
-    assertTrue(packet.size < std::numeric_limits<uint16_t>::max(),
-               "DataPacket too big for TCPCoreDataPipe.");
-    MessageHeader header{static_cast<uint16_t>(packet.size)};
+void TCPCoreDataPipe::applySocketOptions() {
+  if (options_.sendBufferSize != 0) {
+    socket_->setSendBufferSize(options_.sendBufferSize);
+  }
+  if (options_.receiveBufferSize != 0) {
+    socket_->setReceiveBufferSize(options_.receiveBufferSize);
+  }
+  if (options_.notSentLowWatermark != 0) {
+    socket_->setNotSentLowWatermark(options_.notSentLowWatermark);
+  }
+  if (options_.zeroCopy) {
+    zeroCopy_ = socket_->enableZeroCopy();
+  }
+}
+
+void TCPCoreDataPipe::setUpFlusher() {
+  hasPendingSends_ = loop_.createComputedCondition();
+  hasPendingSends_->expression = [this]() {
+    return !closedReason_ && sendRing_.getTail() > sentUpTo_ &&
+           socket_->isConnected();
+  };
+
+  flusher_ = loop_.createAction("stun::TCPCoreDataPipe::flusher_",
+                                {hasPendingSends_.get(), socket_->canWrite()});
+  flusher_->callback.setMethod<TCPCoreDataPipe, &TCPCoreDataPipe::doFlush>(
+      this);
+
+  if (zeroCopy_) {
+    completionReader_ = loop_.createAction(
+        "stun::TCPCoreDataPipe::completionReader_", {socket_->hasErrors()});
+    completionReader_->callback
+        .setMethod<TCPCoreDataPipe, &TCPCoreDataPipe::doReadCompletions>(this);
+  }
+}
+
+bool TCPCoreDataPipe::hasRoomForPacket() const {
+  return sendRing_.space() >= MessageHeader::WireSize + DataPacket::Size;
+}
+
+void TCPCoreDataPipe::doFlush() {
+  while (sendRing_.getTail() > sentUpTo_) {
+    struct iovec segments[2];
+    int count =
+        sendRing_.getReadSegments(segments, sentUpTo_ - sendRing_.getHead());
+    size_t bytesPending = sendRing_.getTail() - sentUpTo_;
+
+    size_t bytesWritten = 0;
+    bool zeroCopied = false;
+    try {
+      if (zeroCopy_ && bytesPending >= kTCPCoreDataPipeZeroCopyMinSize) {
+        bytesWritten = socket_->writev(segments, count, true);
+        zeroCopied = (bytesWritten > 0);
+      }
+      if (!zeroCopied) {
+        bytesWritten = socket_->writev(segments, count);
+      }
+    } catch (networking::SocketClosedException const& ex) {
+      // Actions can't throw, so leave it to send() or receive() to report.
+      closedReason_ = ex.what();
+      return;
+    }
+
+    sentUpTo_ += bytesWritten;
+    if (zeroCopied) {
+      writesInFlight_.push_back(Write{nextZeroCopyID_++, sentUpTo_, false});
+    } else if (bytesWritten > 0) {
+      writesInFlight_.push_back(Write{std::nullopt, sentUpTo_, true});
+    }
+    releaseCompletedWrites();
+
+    // Partial writes are fine. We'll resume from there once the socket
+    // becomes writable again.
+    if (bytesWritten < bytesPending) {
+      return;
+    }
+  }
+}
+
+void TCPCoreDataPipe::doReadCompletions() {
+  for (auto const& completion : socket_->readZeroCopyCompletions()) {
+    for (auto& write : writesInFlight_) {
+      if (!write.zeroCopyID) {
+        continue;
+      }
+
+      // IDs wrap around, so compare offsets from the start of the range.
+      uint32_t offset = *write.zeroCopyID - completion.first;
+      if (offset <= uint32_t(completion.last - completion.first)) {
+        write.completed = true;
+      }
+    }
+
+    if (completion.copied && zeroCopy_) {
+      // The kernel had to copy anyway (e.g. the route doesn't support
+      // scatter-gather), so we're only paying for the notifications.
+      LOG_V("TCPCoreDataPipe")
+          << "Zero-copy sends were copied by the kernel. Turning them off."
+          << std::endl;
+      zeroCopy_ = false;
+    }
+  }
+
+  releaseCompletedWrites();
+}
 
-    header.serialize(packetToSend_.data);
-    packetToSend_.size = MessageHeader::WireSize;
-    packetToSend_.fill(packet.data, packet.size, sizeof(MessageHeader));
-    packetBytesSent_ = 0;
+void TCPCoreDataPipe::releaseCompletedWrites() {
+  // Writes complete in order for all practical purposes, but the ring can
+  // only be consumed from the front, so an early completion just waits.
+  while (!writesInFlight_.empty() && writesInFlight_.front().completed) {
+    sendRing_.consume(writesInFlight_.front().end - sendRing_.getHead());
+    writesInFlight_.pop_front();
   }
+}
 
-  size_t bytesLeft = packetToSend_.size - packetBytesSent_;
-  size_t bytesSent =
-      socket_->write(packetToSend_.data + packetBytesSent_, bytesLeft);
-  packetBytesSent_ += bytesSent;
+/* virtual */ bool TCPCoreDataPipe::send(DataPacket packet) /* override */ {
+  if (!!closedReason_) {
+    throw networking::SocketClosedException(*closedReason_);
+  }
 
-  // TODO: This should actually be supported
-  assertTrue(packetBytesSent_ == packetToSend_.size,
-             "TCPCoreDataPipe sent an incomplete packet.");
+  assertTrue(packet.size < std::numeric_limits<uint16_t>::max(),
+             "DataPacket too big for TCPCoreDataPipe.");
+
+  if (sendRing_.space() < MessageHeader::WireSize + packet.size) {
+    return false;
+  }
+
+  Byte header[MessageHeader::WireSize];
+  MessageHeader{static_cast<uint16_t>(packet.size)}.serialize(header);
+  sendRing_.push(header, sizeof(header));
+  sendRing_.push(packet.data, packet.size);
 
   return true;
 }
 
-/* virtual */ bool TCPCoreDataPipe::receive(DataPacket& output) /* override */ {
-  // TODO: Receive more than 1 packet
+bool TCPCoreDataPipe::hasBufferedFrame() const {
+  if (receiveRing_.size() < MessageHeader::WireSize) {
+    return false;
+  }
 
-  size_t bytesRead = socket_->read(receiveBuffer_.data + receiveBuffer_.size,
-                                   ReceiveBufferSize - receiveBuffer_.size);
-  receiveBuffer_.size += bytesRead;
+  Byte header[MessageHeader::WireSize];
+  receiveRing_.peek(header, sizeof(header));
+  return receiveRing_.size() >=
+         MessageHeader::WireSize + MessageHeader::deserialize(header).size;
+}
 
-  if (receiveBuffer_.size < sizeof(MessageHeader)) {
+bool TCPCoreDataPipe::parseFrame(DataPacket& output) {
+  if (receiveRing_.size() < MessageHeader::WireSize) {
     return false;
   }
 
-  auto header = MessageHeader::deserialize(receiveBuffer_.data);
-  size_t fullPacketSize = sizeof(MessageHeader) + header.size;
+  Byte header[MessageHeader::WireSize];
+  receiveRing_.peek(header, sizeof(header));
+  size_t size = MessageHeader::deserialize(header).size;
+
+  // The peer is either broken or malicious, and there's no telling where the
+  // next frame would start.
+  if (size > output.capacity) {
+    LOG_E("TCPCoreDataPipe") << "Received a frame of size " << size
+                             << " too big for a DataPacket. Closing."
+                             << std::endl;
+    closedReason_ = "Received an oversized frame.";
+    throw networking::SocketClosedException(*closedReason_);
+  }
 
-  if (receiveBuffer_.size < fullPacketSize) {
+  if (receiveRing_.size() < MessageHeader::WireSize + size) {
     return false;
   }
 
-  // TODO: Move memmove func into Packet
-  output.fill(receiveBuffer_.data + sizeof(MessageHeader), header.size);
-  memmove(receiveBuffer_.data, receiveBuffer_.data + fullPacketSize,
-          receiveBuffer_.size - fullPacketSize);
-  receiveBuffer_.size -= fullPacketSize;
+  receiveRing_.consume(sizeof(header));
+  receiveRing_.peek(output.data, size);
+  receiveRing_.consume(size);
+  output.size = size;
 
   return true;
 }
 
+/* virtual */ bool TCPCoreDataPipe::receive(DataPacket& output) /* override */ {
+  if (!!closedReason_) {
+    throw networking::SocketClosedException(*closedReason_);
+  }
+
+  if (parseFrame(output)) {
+    return true;
+  }
+
+  // No complete frame left, so pull in as much as there is room for. With
+  // frames capped at a DataPacket, the ring can't be full at this point.
+  assertTrue(receiveRing_.space() > 0,
+             "TCPCoreDataPipe receive ring filled up without a full frame.");
+
+  struct iovec segments[2];
+  int count = receiveRing_.getWriteSegments(segments);
+  receiveRing_.commit(socket_->readv(segments, count));
+
+  return parseFrame(output);
+}
+
 }; // namespace stun
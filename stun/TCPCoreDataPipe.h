@@ -2,6 +2,7 @@
 
 #include <stun/CoreDataPipe.h>
 
+#include <common/RingBuffer.h>
 #include <common/Util.h>
 
 #include <event/Action.h>
@@ -11,6 +12,9 @@
 #include <networking/TCPServer.h>
 #include <networking/TCPSocket.h>
 
+#include <deque>
+#include <optional>
+
 namespace stun {
 
 class TCPCoreDataPipe : public CoreDataPipe {
@@ -20,11 +24,22 @@ public:
     SERVER,
   };
 
+  // Sizes of 0 leave the kernel defaults alone.
+  struct SocketOptions {
+    bool zeroCopy;
+    size_t sendBufferSize;
+    size_t receiveBufferSize;
+    size_t notSentLowWatermark;
+  };
+
   struct ClientConfig {
     networking::SocketAddress addr;
+    SocketOptions options;
   };
 
-  struct ServerConfig {};
+  struct ServerConfig {
+    SocketOptions options;
+  };
 
   struct MessageHeader {
     constexpr static size_t WireSize = 4;
@@ -74,7 +89,10 @@ public:
   }
 
 private:
+  event::EventLoop& loop_;
+
   Role role_;
+  SocketOptions options_;
 
   std::unique_ptr<networking::TCPServer> server_;
   std::unique_ptr<networking::TCPSocket> socket_;
@@ -83,13 +101,51 @@ private:
   std::unique_ptr<event::ComputedCondition> canReceive_;
 
   // Sending state
-  networking::Packet packetToSend_{sizeof(MessageHeader) + DataPacket::Size};
-  size_t packetBytesSent_ = 0;
+  //
+  // send() only frames packets into the ring. The flusher then writes out as
+  // much of the ring as the socket takes with a single writev().
+  //
+  // With zero-copy, the kernel keeps reading from the ring after writev()
+  // returns, so written bytes are only consumed once the kernel reports the
+  // write as completed through the socket's error queue. Until then they
+  // count against the ring's space, which holds back send() as needed.
+  constexpr static size_t SendRingSize = 1 << 16;
+  common::RingBuffer sendRing_{SendRingSize};
+  std::unique_ptr<event::ComputedCondition> hasPendingSends_;
+  std::unique_ptr<event::Action> flusher_;
+
+  struct Write {
+    std::optional<uint32_t> zeroCopyID;
+    uint64_t end;
+    bool completed;
+  };
+
+  bool zeroCopy_ = false;
+  uint64_t sentUpTo_ = 0;
+  uint32_t nextZeroCopyID_ = 0;
+  std::deque<Write> writesInFlight_;
+  std::unique_ptr<event::Action> completionReader_;
+
+  // Set when the flusher finds the connection closed, so that the next send()
+  // or receive() can report it.
+  std::optional<std::string> closedReason_;
 
   // Receiving state
-  constexpr static size_t ReceiveBufferSize =
-      2 * (sizeof(MessageHeader) + DataPacket::Size);
-  networking::Packet receiveBuffer_{ReceiveBufferSize};
+  //
+  // Each read pulls in as much as the ring has room for, which is usually many
+  // frames. receive() then hands them out one by one straight from the ring,
+  // only going back to the socket once no complete frame is left.
+  constexpr static size_t ReceiveRingSize = 1 << 16;
+  common::RingBuffer receiveRing_{ReceiveRingSize};
+
+  void applySocketOptions();
+  void setUpFlusher();
+  void doFlush();
+  void doReadCompletions();
+  void releaseCompletedWrites();
+  bool hasRoomForPacket() const;
+  bool hasBufferedFrame() const;
+  bool parseFrame(DataPacket& output);
 };
 
 }; // namespace stun
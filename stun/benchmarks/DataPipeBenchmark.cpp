@@ -0,0 +1,93 @@
+#include <stun/DataPipe.h>
+
+#include <common/Util.h>
+#include <event/EventLoop.h>
+#include <event/Timer.h>
+#include <event/Trigger.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+using namespace std::chrono_literals;
+
+using stun::DataPacket;
+using stun::DataPipe;
+using stun::UDPCoreDataPipe;
+
+static const size_t kBenchmarkPacketSize = 1200;
+static const event::Duration kBenchmarkDuration = 3s;
+
+static DataPipe::CommonConfig makeCommonConfig() {
+  // Everything optional is off, to leave just the pipeline itself.
+  return DataPipe::CommonConfig{"", 0, false, 0s,    false, 0ms,
+                                0,  0, 0ms,   false, false};
+}
+
+// Sends packets from one DataPipe to another over loopback UDP for a while
+// and returns how many of them were delivered per second. Everything happens
+// on one event loop, so the sending and receiving paths (DataPipe::doSend,
+// Socket::read, Action::invoke, ...) all count.
+static double benchmarkThroughput() {
+  event::EventLoop loop;
+
+  DataPipe server(loop, DataPipe::Config{UDPCoreDataPipe::ServerConfig{},
+                                         makeCommonConfig()});
+  auto port = dynamic_cast<UDPCoreDataPipe&>(server.getCore()).getPort();
+  DataPipe client(loop, DataPipe::Config{
+                            UDPCoreDataPipe::ClientConfig{
+                                networking::SocketAddress("127.0.0.1", port)},
+                            makeCommonConfig()});
+
+  size_t received = 0;
+  bool isDone = false;
+
+  auto sender = loop.createAction("DataPipeBenchmark::sender",
+                                  {client.outboundQ->canPush()});
+  sender->callback = [&client]() {
+    DataPacket packet;
+    packet.size = kBenchmarkPacketSize;
+    memset(packet.data, 0x42, packet.size);
+    client.outboundQ->push(std::move(packet));
+  };
+
+  auto receiver = loop.createAction("DataPipeBenchmark::receiver",
+                                    {server.inboundQ->canPop()});
+  receiver->callback = [&server, &received]() {
+    server.inboundQ->pop();
+    received++;
+  };
+
+  auto timer = loop.createTimer(kBenchmarkDuration);
+  loop.arm("DataPipeBenchmark::stopper", {timer->didFire()},
+           [&isDone]() { isDone = true; });
+
+  auto start = std::chrono::steady_clock::now();
+  while (!isDone) {
+    loop.runOnce();
+  }
+  auto seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  return received / seconds;
+}
+
+// Compare e.g. `buck run //stun/benchmarks:datapipe#release` against the same
+// with #release-vv, whose log statements are all compiled in. Either way, the
+// threshold is INFO, as when running without --verbose.
+int main(int argc, char* argv[]) {
+  common::Logger::getDefault().setLoggingThreshold(common::LogLevel::INFO);
+
+  std::cout << std::fixed << std::setprecision(0);
+  std::cout << "Packets of " << kBenchmarkPacketSize
+            << " bytes over loopback UDP, with STUN_MIN_LOG_LEVEL "
+            << STUN_MIN_LOG_LEVEL << std::endl;
+
+  for (size_t i = 0; i < 3; i++) {
+    std::cout << std::setw(12) << benchmarkThroughput() << " packets/s"
+              << std::endl;
+  }
+
+  return 0;
+}
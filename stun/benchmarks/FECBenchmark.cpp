@@ -0,0 +1,179 @@
+#include <stun/FECCoder.h>
+
+#include <common/Util.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+using stun::DataPacket;
+using stun::FECDecoder;
+using stun::FECEncoder;
+
+static const size_t kBenchmarkPacketSize = 1400;
+static const size_t kBenchmarkPacketCount = 20000;
+
+// Fills the packet with a pattern derived from its index, so that recovered
+// packets can be checked byte for byte.
+static DataPacket makePacket(size_t index) {
+  DataPacket packet;
+  packet.size = kBenchmarkPacketSize - (index % 64);
+  for (size_t i = 0; i < packet.size; i++) {
+    packet.data[i] = static_cast<Byte>(index * 31 + i);
+  }
+  auto tag = static_cast<uint32_t>(index);
+  memcpy(packet.data, &tag, sizeof(tag));
+  return packet;
+}
+
+static bool isIntact(DataPacket& packet, size_t index) {
+  return packet.size == kBenchmarkPacketSize - (index % 64) &&
+         memcmp(makePacket(index).data, packet.data, packet.size) == 0;
+}
+
+static std::vector<DataPacket> encodeAll(FECEncoder& encoder, size_t count) {
+  std::vector<DataPacket> wire;
+  for (size_t i = 0; i < count; i++) {
+    DataPacket packet = makePacket(i);
+    auto parity = encoder.encode(packet);
+    wire.emplace_back(std::move(packet));
+    if (!!parity) {
+      wire.emplace_back(std::move(*parity));
+    }
+  }
+
+  auto parity = encoder.flush();
+  if (!!parity) {
+    wire.emplace_back(std::move(*parity));
+  }
+
+  return wire;
+}
+
+static double getMegabytesPerSecond(size_t bytes,
+                                    std::chrono::steady_clock::duration time) {
+  auto seconds = std::chrono::duration<double>(time).count();
+  return bytes / seconds / 1024 / 1024;
+}
+
+static void benchmarkThroughput(size_t groupSize) {
+  // Packets are built up front so that only the coding is timed.
+  std::vector<DataPacket> packets;
+  for (size_t i = 0; i < kBenchmarkPacketCount; i++) {
+    packets.emplace_back(makePacket(i));
+  }
+
+  FECEncoder encoder(groupSize);
+  std::vector<DataPacket> wire;
+
+  auto start = std::chrono::steady_clock::now();
+  for (auto& packet : packets) {
+    auto parity = encoder.encode(packet);
+    if (!!parity) {
+      wire.emplace_back(std::move(*parity));
+    }
+  }
+  auto encodeTime = std::chrono::steady_clock::now() - start;
+
+  // Drop the first packet of every group, so that decoding always has to
+  // recover one packet per group.
+  std::vector<DataPacket> received;
+  auto parityIt = wire.begin();
+  for (size_t i = 0; i < packets.size(); i++) {
+    if (i % groupSize != 0) {
+      received.emplace_back(std::move(packets[i]));
+    }
+    if ((i + 1) % groupSize == 0) {
+      received.emplace_back(std::move(*parityIt++));
+    }
+  }
+
+  FECDecoder decoder;
+  std::vector<DataPacket> output;
+
+  start = std::chrono::steady_clock::now();
+  for (auto& packet : received) {
+    decoder.decode(std::move(packet), output);
+  }
+  auto decodeTime = std::chrono::steady_clock::now() - start;
+
+  size_t bytes = kBenchmarkPacketCount * kBenchmarkPacketSize;
+  std::cout << std::setw(10) << groupSize << std::setw(16)
+            << getMegabytesPerSecond(bytes, encodeTime) << std::setw(16)
+            << getMegabytesPerSecond(bytes, decodeTime) << std::setw(12)
+            << decoder.totalRecovered << std::endl;
+}
+
+static void benchmarkGoodput(double lossRate, size_t groupSize,
+                             bool adaptive) {
+  FECEncoder encoder(groupSize);
+  if (adaptive) {
+    encoder.adapt(lossRate);
+  }
+
+  auto wire = encodeAll(encoder, kBenchmarkPacketCount);
+
+  std::mt19937 random(2859);
+  std::bernoulli_distribution isLost(lossRate);
+
+  FECDecoder decoder;
+  std::vector<DataPacket> output;
+  for (auto& packet : wire) {
+    if (!isLost(random)) {
+      decoder.decode(std::move(packet), output);
+    }
+  }
+
+  std::vector<bool> delivered(kBenchmarkPacketCount, false);
+  for (auto& packet : output) {
+    auto index = packet.unpack<uint32_t>();
+    assertTrue(index < kBenchmarkPacketCount && isIntact(packet, index),
+               "FEC delivered a corrupted packet.");
+    delivered[index] = true;
+  }
+
+  auto deliveredCount = std::count(delivered.begin(), delivered.end(), true);
+  auto overhead = static_cast<double>(wire.size() - kBenchmarkPacketCount) /
+                  kBenchmarkPacketCount;
+
+  std::cout << std::setw(10) << lossRate * 100 << std::setw(10)
+            << (adaptive ? std::to_string(encoder.getGroupSize()) + "*"
+                         : std::to_string(groupSize))
+            << std::setw(12) << overhead * 100 << std::setw(12)
+            << (1.0 - static_cast<double>(deliveredCount) /
+                          kBenchmarkPacketCount) *
+                   100
+            << std::setw(12) << decoder.totalRecovered << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  common::Logger::getDefault().setLoggingThreshold(common::LogLevel::ERROR);
+
+  std::cout << std::fixed << std::setprecision(2);
+
+  std::cout << "Throughput (" << kBenchmarkPacketCount << " packets of up to "
+            << kBenchmarkPacketSize << " bytes)" << std::endl;
+  std::cout << std::setw(10) << "group" << std::setw(16) << "encode MB/s"
+            << std::setw(16) << "decode MB/s" << std::setw(12) << "recovered"
+            << std::endl;
+  for (size_t groupSize : {2, 4, 8, 16, 32, 64}) {
+    benchmarkThroughput(groupSize);
+  }
+
+  std::cout << std::endl
+            << "Goodput under random loss (* = adapted to the loss rate)"
+            << std::endl;
+  std::cout << std::setw(10) << "loss %" << std::setw(10) << "group"
+            << std::setw(12) << "overhead %" << std::setw(12) << "residual %"
+            << std::setw(12) << "recovered" << std::endl;
+  for (double lossRate : {0.01, 0.03, 0.05}) {
+    for (size_t groupSize : {4, 8, 16, 32}) {
+      benchmarkGoodput(lossRate, groupSize, false);
+    }
+    benchmarkGoodput(lossRate, FECEncoder::MaxGroupSize, true);
+  }
+
+  return 0;
+}
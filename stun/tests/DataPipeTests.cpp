@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+
+#include <stun/DataPipe.h>
+#include <stun/Dispatcher.h>
+#include <stun/HeaderCompressor.h>
+
+#include <event/EventLoop.h>
+
+#include <chrono>
+#include <cstring>
+
+using namespace std::chrono_literals;
+
+using stun::DataPacket;
+using stun::DataPipe;
+using stun::UDPCoreDataPipe;
+
+TEST(DataPipeTests, PacketAtMaxMTU) {
+  // Sequencing, FEC, coalescing and padding all add their bit to each packet
+  auto common = DataPipe::CommonConfig{"",   1000, false, 0s,    true, 0ms,
+                                       4,    1400, 0ms,   false, false};
+  size_t mtu = stun::Dispatcher::getMaxMTU(common, true);
+
+  event::EventLoop loop;
+  DataPipe server(loop,
+                  DataPipe::Config{UDPCoreDataPipe::ServerConfig{}, common});
+  auto port = dynamic_cast<UDPCoreDataPipe&>(server.getCore()).getPort();
+  DataPipe client(loop, DataPipe::Config{
+                            UDPCoreDataPipe::ClientConfig{
+                                networking::SocketAddress("127.0.0.1", port)},
+                            common});
+
+  // What Tunnel::read() hands over for an IP packet of `mtu` bytes, which
+  // the HeaderCompressor can't compress and so makes one byte longer
+  DataPacket packet;
+  packet.size = networking::kTunnelPacketHeaderSize + mtu;
+  memset(packet.data, 0x42, packet.size);
+  stun::HeaderCompressor compressor;
+  compressor.compress(packet);
+  ASSERT_EQ(packet.size, DataPipe::getMaxPayloadSize(common))
+      << "Packet should take up all the room the DataPipe has.";
+
+  DataPacket expected;
+  expected.fill(packet.data, packet.size);
+  client.outboundQ->push(std::move(packet));
+
+  for (int i = 0; i < 1000 && !server.inboundQ->canPop()->eval(); i++) {
+    loop.runOnce();
+  }
+
+  ASSERT_TRUE(server.inboundQ->canPop()->eval())
+      << "Packet should have gone through.";
+  auto received = server.inboundQ->pop();
+  ASSERT_EQ(received.size, expected.size);
+  ASSERT_EQ(memcmp(received.data, expected.data, expected.size), 0)
+      << "Packet should arrive intact.";
+}
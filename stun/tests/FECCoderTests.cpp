@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+
+#include <stun/FECCoder.h>
+
+#include <string>
+#include <vector>
+
+static stun::DataPacket makePacket(std::string content) {
+  stun::DataPacket packet;
+  packet.fill(reinterpret_cast<Byte*>(&content[0]), content.size());
+  return packet;
+}
+
+static std::string toString(stun::DataPacket const& packet) {
+  return std::string(reinterpret_cast<char const*>(packet.data), packet.size);
+}
+
+// Encodes `contents` as a single group, and returns its data packets followed
+// by the parity packet.
+static std::vector<stun::DataPacket>
+encodeGroup(std::vector<std::string> const& contents) {
+  stun::FECEncoder encoder(contents.size());
+  std::vector<stun::DataPacket> packets;
+
+  for (auto const& content : contents) {
+    auto packet = makePacket(content);
+    auto parity = encoder.encode(packet);
+    packets.push_back(std::move(packet));
+    if (!!parity) {
+      packets.push_back(std::move(*parity));
+    }
+  }
+
+  return packets;
+}
+
+TEST(FECCoderTests, RoundTrip) {
+  auto packets = encodeGroup({"hello", "fec", "world!"});
+  ASSERT_EQ(packets.size(), 4u) << "Group should end with a parity packet.";
+
+  stun::FECDecoder decoder;
+  std::vector<stun::DataPacket> output;
+  for (auto& packet : packets) {
+    decoder.decode(std::move(packet), output);
+  }
+
+  ASSERT_EQ(output.size(), 3u) << "Parity packet should not be delivered.";
+  ASSERT_EQ(toString(output[0]), "hello");
+  ASSERT_EQ(toString(output[1]), "fec");
+  ASSERT_EQ(toString(output[2]), "world!");
+  ASSERT_EQ(decoder.totalRecovered, 0u) << "Nothing should be recovered.";
+}
+
+TEST(FECCoderTests, RecoverSingleLoss) {
+  auto packets = encodeGroup({"hello", "fec", "world!"});
+
+  stun::FECDecoder decoder;
+  std::vector<stun::DataPacket> output;
+  decoder.decode(std::move(packets[0]), output);
+  decoder.decode(std::move(packets[2]), output);
+  decoder.decode(std::move(packets[3]), output);
+
+  ASSERT_EQ(output.size(), 3u) << "Lost packet should be recovered.";
+  ASSERT_EQ(toString(output[2]), "fec");
+  ASSERT_EQ(decoder.totalRecovered, 1u);
+}
+
+TEST(FECCoderTests, NoRecoveryFromDoubleLoss) {
+  auto packets = encodeGroup({"hello", "fec", "world!"});
+
+  stun::FECDecoder decoder;
+  std::vector<stun::DataPacket> output;
+  decoder.decode(std::move(packets[0]), output);
+  decoder.decode(std::move(packets[3]), output);
+
+  ASSERT_EQ(output.size(), 1u) << "Two losses should not be recoverable.";
+  ASSERT_EQ(toString(output[0]), "hello");
+  ASSERT_EQ(decoder.totalRecovered, 0u);
+}
+
+TEST(FECCoderTests, CorruptedLength) {
+  auto packets = encodeGroup({"hello", "fec", "world!"});
+  // Makes the recovered length prefix point way past the group's packets
+  packets[3].data[0] ^= 0xFF;
+
+  stun::FECDecoder decoder;
+  std::vector<stun::DataPacket> output;
+  decoder.decode(std::move(packets[0]), output);
+  decoder.decode(std::move(packets[2]), output);
+  decoder.decode(std::move(packets[3]), output);
+
+  ASSERT_EQ(output.size(), 2u) << "Corrupted packet should be dropped.";
+  ASSERT_EQ(decoder.totalRecovered, 0u);
+}
+
+TEST(FECCoderTests, LateDuplicate) {
+  auto packets = encodeGroup({"hello", "fec", "world!"});
+
+  stun::FECDecoder decoder;
+  std::vector<stun::DataPacket> output;
+  decoder.decode(std::move(packets[0]), output);
+  decoder.decode(std::move(packets[2]), output);
+  decoder.decode(std::move(packets[3]), output);
+  ASSERT_EQ(output.size(), 3u) << "Lost packet should be recovered.";
+
+  // The original shows up after it has already been recovered
+  decoder.decode(std::move(packets[1]), output);
+  ASSERT_EQ(output.size(), 3u) << "Late original should not be delivered.";
+}
+
+TEST(FECCoderTests, NoRoomForTrailer) {
+  stun::DataPacket packet;
+  packet.size = packet.capacity - stun::FECEncoder::Overhead + 1;
+  ASSERT_FALSE(stun::FECEncoder::canEncode(packet))
+      << "Packet should be too big for FEC.";
+
+  packet.size = packet.capacity - stun::FECEncoder::Overhead;
+  ASSERT_TRUE(stun::FECEncoder::canEncode(packet))
+      << "Packet should just fit.";
+}
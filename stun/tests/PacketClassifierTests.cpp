@@ -0,0 +1,148 @@
+#include <gtest/gtest.h>
+
+#include <stun/PacketClassifier.h>
+
+#include <networking/Tunnel.h>
+
+#include <netinet/in.h>
+
+#include <vector>
+
+using stun::PacketClassifier;
+
+static const size_t kIPHeaderSize = 20;
+static const size_t kTCPHeaderSize = 20;
+static const size_t kUDPHeaderSize = 8;
+
+// Builds a tunnel packet carrying an IPv4 TCP or UDP packet with
+// `payloadSize` bytes of payload.
+static std::vector<Byte> makePacket(uint8_t protocol, uint16_t srcPort,
+                                    uint16_t dstPort, size_t payloadSize,
+                                    uint8_t dscp = 0) {
+  size_t transportSize =
+      (protocol == IPPROTO_TCP ? kTCPHeaderSize : kUDPHeaderSize);
+  std::vector<Byte> packet(networking::kTunnelPacketHeaderSize +
+                           kIPHeaderSize + transportSize + payloadSize);
+  packet[2] = 0x08;
+
+  Byte* ip = packet.data() + networking::kTunnelPacketHeaderSize;
+  ip[0] = 0x45;
+  ip[1] = dscp << 2;
+  ip[9] = protocol;
+
+  Byte* transport = ip + kIPHeaderSize;
+  transport[0] = srcPort >> 8;
+  transport[1] = srcPort & 0xff;
+  transport[2] = dstPort >> 8;
+  transport[3] = dstPort & 0xff;
+  if (protocol == IPPROTO_TCP) {
+    transport[12] = (kTCPHeaderSize / 4) << 4;
+  }
+
+  return packet;
+}
+
+static stun::PacketClass classify(std::vector<Byte> const& packet) {
+  return PacketClassifier::classify(packet.data(), packet.size());
+}
+
+TEST(PacketClassifierTests, DSCP) {
+  ASSERT_EQ(classify(makePacket(IPPROTO_UDP, 40000, 443, 1000, 46)),
+            stun::Interactive)
+      << "EF should be interactive.";
+  ASSERT_EQ(classify(makePacket(IPPROTO_TCP, 40000, 179, 1000, 48)),
+            stun::Interactive)
+      << "CS6 should be interactive.";
+  ASSERT_EQ(classify(makePacket(IPPROTO_TCP, 40000, 443, 1000, 1)),
+            stun::Bulk)
+      << "LE should be bulk.";
+  ASSERT_EQ(classify(makePacket(IPPROTO_TCP, 40000, 443, 1000, 8)),
+            stun::Bulk)
+      << "CS1 should be bulk.";
+  ASSERT_EQ(classify(makePacket(IPPROTO_TCP, 40000, 22, 10, 8)), stun::Bulk)
+      << "DSCP should take precedence over ports.";
+  ASSERT_EQ(classify(makePacket(IPPROTO_TCP, 40000, 443, 1000, 10)),
+            stun::Default)
+      << "Other markings should be ignored.";
+}
+
+TEST(PacketClassifierTests, InteractivePorts) {
+  ASSERT_EQ(classify(makePacket(IPPROTO_TCP, 40000, 22, 48)),
+            stun::Interactive)
+      << "SSH should be interactive.";
+  ASSERT_EQ(classify(makePacket(IPPROTO_TCP, 22, 40000, 48)),
+            stun::Interactive)
+      << "Either port should count.";
+  ASSERT_EQ(classify(makePacket(IPPROTO_UDP, 40000, 53, 48)),
+            stun::Interactive)
+      << "DNS should be interactive.";
+  ASSERT_EQ(classify(makePacket(IPPROTO_UDP, 40000, 3478, 100)),
+            stun::Interactive)
+      << "STUN over UDP should be interactive.";
+  ASSERT_EQ(classify(makePacket(IPPROTO_TCP, 40000, 3478, 100)),
+            stun::Default)
+      << "STUN over TCP should not be interactive.";
+  ASSERT_EQ(classify(makePacket(IPPROTO_TCP, 40000, 22, 1000)),
+            stun::Default)
+      << "Big packets on interactive ports should not be interactive.";
+  ASSERT_EQ(classify(makePacket(IPPROTO_UDP, 40000, 443, 48)),
+            stun::Default);
+}
+
+TEST(PacketClassifierTests, BareACK) {
+  ASSERT_EQ(classify(makePacket(IPPROTO_TCP, 40000, 443, 0)),
+            stun::Interactive)
+      << "Bare ACKs should be interactive.";
+  ASSERT_EQ(classify(makePacket(IPPROTO_TCP, 40000, 443, 1)), stun::Default)
+      << "Segments with payload should not be interactive.";
+  ASSERT_EQ(classify(makePacket(IPPROTO_UDP, 40000, 443, 0)), stun::Default)
+      << "Empty UDP packets should not be interactive.";
+
+  // With TCP options, i.e. a longer header
+  auto packet = makePacket(IPPROTO_TCP, 40000, 443, 12);
+  packet[networking::kTunnelPacketHeaderSize + kIPHeaderSize + 12] =
+      ((kTCPHeaderSize + 12) / 4) << 4;
+  ASSERT_EQ(classify(packet), stun::Interactive)
+      << "Options should not count as payload.";
+
+  // Fragments don't carry ports, let alone a TCP header to look at
+  packet = makePacket(IPPROTO_TCP, 40000, 443, 0);
+  packet[networking::kTunnelPacketHeaderSize + 7] = 0x10;
+  ASSERT_EQ(classify(packet), stun::Default)
+      << "Fragments should not be taken for bare ACKs.";
+}
+
+TEST(PacketClassifierTests, Malformed) {
+  std::vector<Byte> packet;
+  ASSERT_EQ(classify(packet), stun::Default) << "Empty packet.";
+
+  packet = {0x00, 0x00, 0x08};
+  ASSERT_EQ(classify(packet), stun::Default) << "Short tunnel header.";
+
+  packet = makePacket(IPPROTO_TCP, 40000, 22, 0, 46);
+  packet.resize(networking::kTunnelPacketHeaderSize + kIPHeaderSize - 1);
+  ASSERT_EQ(classify(packet), stun::Default) << "Truncated IP header.";
+
+  packet = makePacket(IPPROTO_TCP, 40000, 443, 0);
+  packet.resize(networking::kTunnelPacketHeaderSize + kIPHeaderSize + 4);
+  ASSERT_EQ(classify(packet), stun::Default) << "Truncated TCP header.";
+
+  packet = makePacket(IPPROTO_TCP, 40000, 22, 0, 46);
+  packet[networking::kTunnelPacketHeaderSize] = 0x65;
+  ASSERT_EQ(classify(packet), stun::Default) << "Not IPv4.";
+
+  packet = makePacket(IPPROTO_TCP, 40000, 22, 0, 46);
+  packet[networking::kTunnelPacketHeaderSize] = 0x4f;
+  ASSERT_EQ(classify(packet), stun::Default) << "IP header past the end.";
+}
+
+TEST(PacketClassifierTests, Classes) {
+  auto classes = PacketClassifier::getClasses();
+  ASSERT_EQ(classes.size(), 3u);
+  ASSERT_TRUE(classes[stun::Interactive].strict)
+      << "Interactive traffic should go first.";
+  ASSERT_FALSE(classes[stun::Default].strict);
+  ASSERT_FALSE(classes[stun::Bulk].strict);
+  ASSERT_GT(classes[stun::Default].quantum, classes[stun::Bulk].quantum)
+      << "Bulk traffic should get the smaller share.";
+}